@@ -0,0 +1,170 @@
+// Measures heap allocations and time spent compiling keymaps
+//
+//   fex_bench                 generated keymap of increasing size
+//   fex_bench FILE.kmf ...    the given keymaps
+
+#include <chrono>
+#include <fstream>
+#include <new>
+#include <sstream>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+#include "layer.h"
+#include "parser.h"
+#include "serialize.h"
+#include "tokenizer.h"
+
+static bool counting = false;
+static size_t allocations = 0;
+static size_t allocated_bytes = 0;
+
+void *operator new(size_t size)
+{
+    if (counting)
+    {
+        allocations++;
+        allocated_bytes += size;
+    }
+
+    void *ptr = malloc(size ? size : 1);
+    if (!ptr)
+    {
+        throw std::bad_alloc();
+    }
+    return ptr;
+}
+
+void operator delete(void *ptr) noexcept
+{
+    free(ptr);
+}
+
+void operator delete(void *ptr, size_t size) noexcept
+{
+    free(ptr);
+}
+
+// One of each kind of statement, repeated to build large keymaps
+static const char *kTemplate =
+    "# Generated keymap\n"
+    "other keys fall through\n"
+    "R0, K0: A\n"
+    "R0, K1: LEFT CTRL + C\n"
+    "R0, K2: type \"hello world\" quickly\n"
+    "R0, K3: switch to NavigationLayer\n"
+    "R0, K4:\n"
+    "    on press: press LEFT SHIFT\n"
+    "    on release: release LEFT SHIFT\n"
+    "R0, K5: mouse move up 10\n"
+    "R0, K6: 0x2c\n"
+    "R0, K7: wait 10 ms, B, C\n"
+    "R1, K0 + R1, K1: ESCAPE\n"
+    "leader sequence G S: type \"status\"\n";
+
+struct Result
+{
+    size_t allocations;
+    size_t bytes;
+    double micros;
+};
+
+static FILE *report = stdout;
+
+template <typename F>
+static Result measure(int iterations, F f)
+{
+    allocations = 0;
+    allocated_bytes = 0;
+
+    auto start = std::chrono::steady_clock::now();
+    counting = true;
+    for (int i = 0; i < iterations; i++)
+    {
+        f();
+    }
+    counting = false;
+    auto end = std::chrono::steady_clock::now();
+
+    return {
+        allocations / iterations,
+        allocated_bytes / iterations,
+        std::chrono::duration<double, std::micro>(end - start).count() / iterations,
+    };
+}
+
+static void bench(const std::string &name, const std::string &source, int iterations)
+{
+    std::string error;
+
+    Result tokenize = measure(iterations, [&]()
+                              { fex::tokenize(source); });
+
+    Result parse = measure(iterations, [&]()
+                           {
+                               fex::Layer layer;
+                               error = fex::parse_source(source, &layer);
+                           });
+
+    // Loading the same layer back from its compiled form
+    fex::Layer parsed;
+    fex::parse_source(source, &parsed);
+    fex::ByteWriter compiled;
+    parsed.Serialize(&compiled);
+
+    Result load = measure(iterations, [&]()
+                          {
+                              fex::Layer layer;
+                              fex::ByteReader in(compiled.data());
+                              layer.Deserialize(&in);
+                          });
+
+    fprintf(report, "%-24s %8zu bytes  tokenize: %7zu allocs %9zu bytes %10.1f us  parse: %7zu allocs %9zu bytes %10.1f us  load: %7zu allocs %9zu bytes %10.1f us%s\n",
+            name.c_str(), source.size(),
+            tokenize.allocations, tokenize.bytes, tokenize.micros,
+            parse.allocations, parse.bytes, parse.micros,
+            load.allocations, load.bytes, load.micros,
+            error.empty() ? "" : "  (parse error)");
+
+    if (!error.empty())
+    {
+        fprintf(report, "    %s\n", error.c_str());
+    }
+}
+
+int main(int argc, char **argv)
+{
+    // The parser logs to stdout as it goes, keep that out of the report
+    report = fdopen(dup(fileno(stdout)), "w");
+    if (!freopen("/dev/null", "w", stdout))
+    {
+        report = stdout;
+    }
+
+    if (argc > 1)
+    {
+        for (int i = 1; i < argc; i++)
+        {
+            std::ifstream file(argv[i]);
+            std::stringstream contents;
+            contents << file.rdbuf();
+            bench(argv[i], contents.str(), 10);
+        }
+        return 0;
+    }
+
+    for (int copies : {1, 10, 100, 1000})
+    {
+        std::string source;
+        for (int i = 0; i < copies; i++)
+        {
+            source += kTemplate;
+        }
+        bench("generated x" + std::to_string(copies), source, copies >= 1000 ? 3 : 20);
+    }
+
+    return 0;
+}
@@ -0,0 +1,149 @@
+// Compiles keymaps on the host, so errors show up before they reach the keyboard
+//
+//   fexc FILE.kmf ...                  check the keymaps
+//   fexc -o KEYMAP.IMG FILE.kmf ...    and write the image the firmware loads
+//
+// Copy KEYMAP.IMG onto the keyboard's drive, it is used instead of any .kmf files.
+
+#include <fstream>
+#include <sstream>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <unistd.h>
+#include <utility>
+#include <vector>
+
+#include "keymap_image.h"
+#include "layer.h"
+#include "parser.h"
+
+static void usage()
+{
+    fprintf(stderr, "usage: fexc [-o KEYMAP.IMG] FILE.kmf ...\n");
+}
+
+// Layers are named after their file, e.g. keymaps/BaseLayer.kmf is BaseLayer
+static std::string layer_name(const std::string &path)
+{
+    std::string name = path.substr(path.find_last_of('/') + 1);
+    size_t idx = name.rfind('.');
+    if (idx != std::string::npos)
+    {
+        name = name.substr(0, idx);
+    }
+    return name;
+}
+
+int main(int argc, char **argv)
+{
+    std::string output;
+    std::vector<std::string> paths;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-o") == 0)
+        {
+            if (i + 1 >= argc)
+            {
+                usage();
+                return 2;
+            }
+            output = argv[++i];
+        }
+        else if (argv[i][0] == '-')
+        {
+            usage();
+            return 2;
+        }
+        else
+        {
+            paths.push_back(argv[i]);
+        }
+    }
+
+    if (paths.empty())
+    {
+        usage();
+        return 2;
+    }
+
+    // The parser logs to stdout as it goes, only diagnostics are wanted here
+    int saved_stdout = dup(fileno(stdout));
+    if (!freopen("/dev/null", "w", stdout))
+    {
+        saved_stdout = -1;
+    }
+
+    bool failed = false;
+    std::vector<std::pair<std::string, fex::Layer>> layers;
+    layers.reserve(paths.size());
+
+    for (const std::string &path : paths)
+    {
+        std::ifstream file(path, std::ios::binary);
+        if (!file)
+        {
+            fprintf(stderr, "%s: cannot open\n", path.c_str());
+            failed = true;
+            continue;
+        }
+
+        std::stringstream contents;
+        contents << file.rdbuf();
+
+        fex::Layer layer;
+        std::string error = fex::parse_source(contents.str(), &layer);
+        if (error != "")
+        {
+            fprintf(stderr, "%s: %s\n", path.c_str(), error.c_str());
+            failed = true;
+            continue;
+        }
+
+        layers.push_back({layer_name(path), std::move(layer)});
+    }
+
+    if (saved_stdout >= 0)
+    {
+        fflush(stdout);
+        dup2(saved_stdout, fileno(stdout));
+        close(saved_stdout);
+    }
+
+    if (failed)
+    {
+        return 1;
+    }
+
+    if (output.empty())
+    {
+        printf("%d keymaps OK\n", (int)layers.size());
+        return 0;
+    }
+
+    std::vector<std::pair<std::string, const fex::Layer *>> entries;
+    for (auto &[name, layer] : layers)
+    {
+        entries.push_back({name, &layer});
+    }
+
+    // Host images are not tied to any files on the drive
+    std::string image = fex::BuildKeymapImage(entries, 0);
+    if (image.size() > KEYMAP_IMAGE_SIZE)
+    {
+        fprintf(stderr, "%s: image is %d bytes, the keyboard holds %d\n", output.c_str(), (int)image.size(), KEYMAP_IMAGE_SIZE);
+        return 1;
+    }
+
+    std::ofstream out(output, std::ios::binary);
+    out.write(image.data(), image.size());
+    if (!out)
+    {
+        fprintf(stderr, "%s: cannot write\n", output.c_str());
+        return 1;
+    }
+
+    printf("%s: %d layers, %d bytes\n", output.c_str(), (int)layers.size(), (int)image.size());
+    return 0;
+}
@@ -0,0 +1,227 @@
+// Runs the flash translation layer over simulated NOR flash, cutting the power
+// part way through erases and programs, and checks every logical sector still
+// holds either its old or its new contents after each reboot. The flash starts
+// out as a volume written straight onto it, which the first format must keep.
+//
+//   ftl_sim [WRITES [SEED]]
+
+#include <setjmp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+#include "ftl.h"
+
+#define SIM_SECTORS 266 // The same as the firmware's FTL area
+#define SIM_HOT_SECTORS 4 // Rewritten far more often than the rest, like the FAT
+
+static std::vector<uint8_t> flash(SIM_SECTORS * FTL_SECTOR_SIZE, 0xff);
+static jmp_buf power_cut;
+static int ops_until_cut = 0; // Erases and programs left before the power goes, 0 for never
+
+static uint32_t random_u32()
+{
+    static uint32_t state = 1;
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return state;
+}
+
+// Decides whether this operation is the one cut short
+static bool cut_now()
+{
+    return ops_until_cut > 0 && --ops_until_cut == 0;
+}
+
+// Erasing sets every bit, an interrupted erase leaves some of them as they were
+static void sim_erase(uint32_t offset)
+{
+    uint8_t *sector = &flash[offset];
+    if (cut_now())
+    {
+        uint32_t done = random_u32() % FTL_SECTOR_SIZE;
+        memset(sector, 0xff, done);
+        for (uint32_t i = done; i < FTL_SECTOR_SIZE; i++)
+        {
+            sector[i] |= (uint8_t)random_u32();
+        }
+        longjmp(power_cut, 1);
+    }
+    memset(sector, 0xff, FTL_SECTOR_SIZE);
+}
+
+// Programming can only clear bits, an interrupted program clears some of them
+static void sim_program(uint32_t offset, uint8_t const *data, uint32_t len)
+{
+    if (offset % FTL_PAGE_SIZE != 0 || len % FTL_PAGE_SIZE != 0)
+    {
+        fprintf(stderr, "unaligned program at %u, %u bytes\n", (unsigned)offset, (unsigned)len);
+        exit(1);
+    }
+
+    uint8_t *dest = &flash[offset];
+    if (cut_now())
+    {
+        for (uint32_t i = 0; i < len; i++)
+        {
+            dest[i] &= data[i] | (uint8_t)random_u32();
+        }
+        longjmp(power_cut, 1);
+    }
+    for (uint32_t i = 0; i < len; i++)
+    {
+        dest[i] &= data[i];
+    }
+}
+
+// Counters restart with every mount
+static uint32_t checkpoints = 0;
+static uint32_t relocations = 0;
+
+static void mount(ftl_t *ftl)
+{
+    checkpoints += ftl->checkpoints;
+    relocations += ftl->relocations;
+    ftl_setup(ftl, ftl_flash_t{flash.data(), sim_erase, sim_program}, SIM_SECTORS);
+    if (!ftl_mount(ftl))
+    {
+        printf("FAIL: no valid checkpoint after a power cut\n");
+        exit(1);
+    }
+}
+
+// Either a whole new sector, or more data where the old one was still erased
+static void next_contents(const std::vector<uint8_t> &old, std::vector<uint8_t> *contents)
+{
+    if (random_u32() % 2)
+    {
+        for (uint8_t &byte : *contents)
+        {
+            byte = (uint8_t)random_u32();
+        }
+        return;
+    }
+
+    *contents = old;
+    uint32_t start = random_u32() % FTL_SECTOR_SIZE;
+    uint32_t len = random_u32() % (FTL_SECTOR_SIZE - start) + 1;
+    for (uint32_t i = start; i < start + len; i++)
+    {
+        (*contents)[i] &= (uint8_t)random_u32();
+    }
+}
+
+int main(int argc, char **argv)
+{
+    int writes = argc > 1 ? atoi(argv[1]) : 20000;
+    for (uint32_t seed = argc > 2 ? (uint32_t)atoi(argv[2]) : 1; seed > 0; seed--)
+    {
+        random_u32();
+    }
+
+    for (uint8_t &byte : flash)
+    {
+        byte = (uint8_t)random_u32();
+    }
+
+    // The ftl_t outlives longjmp, nothing on the stack below needs unwinding
+    static ftl_t ftl;
+    ftl_setup(&ftl, ftl_flash_t{flash.data(), sim_erase, sim_program}, SIM_SECTORS);
+
+    uint32_t volume = (ftl.physical_count - ftl.logical_count) * FTL_SECTOR_SIZE;
+    std::vector<std::vector<uint8_t>> committed(ftl.logical_count);
+    for (uint32_t l = 0; l < ftl.logical_count; l++)
+    {
+        committed[l].assign(flash.begin() + volume + l * FTL_SECTOR_SIZE, flash.begin() + volume + (l + 1) * FTL_SECTOR_SIZE);
+    }
+
+    ftl_format(&ftl);
+    for (uint32_t l = 0; l < ftl.logical_count; l++)
+    {
+        if (memcmp(flash.data() + ftl_offset(&ftl, l), committed[l].data(), FTL_SECTOR_SIZE) != 0)
+        {
+            printf("FAIL: logical sector %u not kept by the first format\n", (unsigned)l);
+            return 1;
+        }
+    }
+
+    std::vector<uint8_t> contents(FTL_SECTOR_SIZE);
+    int cuts = 0;
+    int new_after_cut = 0;
+
+    for (int i = 0; i < writes; i++)
+    {
+        uint32_t logical = random_u32() % 4 ? random_u32() % SIM_HOT_SECTORS : random_u32() % ftl.logical_count;
+        next_contents(committed[logical], &contents);
+
+        ops_until_cut = random_u32() % 32 == 0 ? random_u32() % 24 + 1 : 0;
+        if (setjmp(power_cut) == 0)
+        {
+            ftl_write(&ftl, logical, contents.data());
+            ops_until_cut = 0;
+            committed[logical] = contents;
+            continue;
+        }
+
+        // Reboot
+        cuts++;
+        mount(&ftl);
+
+        for (uint32_t l = 0; l < ftl.logical_count; l++)
+        {
+            uint8_t const *now = flash.data() + ftl_offset(&ftl, l);
+            if (memcmp(now, committed[l].data(), FTL_SECTOR_SIZE) == 0)
+            {
+                continue;
+            }
+            if (l == logical && memcmp(now, contents.data(), FTL_SECTOR_SIZE) == 0)
+            {
+                committed[l] = contents;
+                new_after_cut++;
+                continue;
+            }
+            printf("FAIL: logical sector %u corrupted after power cut %d (write %d)\n", (unsigned)l, cuts, i);
+            return 1;
+        }
+    }
+
+    // One last reboot without a cut must see every write
+    mount(&ftl);
+    for (uint32_t l = 0; l < ftl.logical_count; l++)
+    {
+        if (memcmp(flash.data() + ftl_offset(&ftl, l), committed[l].data(), FTL_SECTOR_SIZE) != 0)
+        {
+            printf("FAIL: logical sector %u lost after a clean reboot\n", (unsigned)l);
+            return 1;
+        }
+    }
+
+    printf("%d writes, %d power cuts (%d kept the new contents), %d checkpoints, %d relocations\n",
+           writes, cuts, new_after_cut, (int)checkpoints, (int)relocations);
+
+    uint32_t data_count = ftl.physical_count - FTL_META_SECTORS;
+    uint32_t min = ftl.erases[FTL_META_SECTORS], max = ftl.erases[FTL_META_SECTORS];
+    uint64_t total = 0;
+    for (uint32_t p = FTL_META_SECTORS; p < ftl.physical_count; p++)
+    {
+        min = ftl.erases[p] < min ? ftl.erases[p] : min;
+        max = ftl.erases[p] > max ? ftl.erases[p] : max;
+        total += ftl.erases[p];
+    }
+    printf("Data sector erases: min %u, max %u, mean %.1f\n", (unsigned)min, (unsigned)max, (double)total / data_count);
+    printf("Meta sector erases: %u, %u\n", (unsigned)ftl.erases[0], (unsigned)ftl.erases[1]);
+
+    for (uint32_t p = 0; p < ftl.physical_count; p++)
+    {
+        printf("%6u%s", (unsigned)ftl.erases[p], p % 16 == 15 ? "\n" : "");
+    }
+    if (ftl.physical_count % 16)
+    {
+        printf("\n");
+    }
+
+    printf("PASS\n");
+    return 0;
+}
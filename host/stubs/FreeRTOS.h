@@ -0,0 +1,43 @@
+#ifndef HOST_FREERTOS_H_
+#define HOST_FREERTOS_H_
+
+// Just enough of FreeRTOS for the keymap compiler to build on a host
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+typedef void *QueueHandle_t;
+typedef void *TimerHandle_t;
+typedef uint32_t TickType_t;
+typedef long BaseType_t;
+typedef unsigned long UBaseType_t;
+
+#define pdTRUE 1
+#define pdFALSE 0
+#define pdPASS 1
+#define portMAX_DELAY 0xffffffffu
+#define portTICK_PERIOD_MS 1
+#define pdMS_TO_TICKS(x) ((TickType_t)(x))
+
+#define taskENTER_CRITICAL()
+#define taskEXIT_CRITICAL()
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    BaseType_t xQueueSend(QueueHandle_t queue, const void *item, TickType_t wait);
+    TickType_t xTaskGetTickCount(void);
+
+    TimerHandle_t xTimerCreate(const char *name, TickType_t period, UBaseType_t reload, void *id, void (*callback)(TimerHandle_t));
+    BaseType_t xTimerStop(TimerHandle_t timer, TickType_t wait);
+    BaseType_t xTimerChangePeriod(TimerHandle_t timer, TickType_t period, TickType_t wait);
+    void *pvTimerGetTimerID(TimerHandle_t timer);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
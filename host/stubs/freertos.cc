@@ -0,0 +1,51 @@
+#include "FreeRTOS.h"
+#include "semphr.h"
+
+// Nothing is ever sent or scheduled on the host, the compiler only builds layers
+
+BaseType_t xQueueSend(QueueHandle_t queue, const void *item, TickType_t wait)
+{
+    return pdTRUE;
+}
+
+TickType_t xTaskGetTickCount(void)
+{
+    return 0;
+}
+
+TimerHandle_t xTimerCreate(const char *name, TickType_t period, UBaseType_t reload, void *id, void (*callback)(TimerHandle_t))
+{
+    return NULL;
+}
+
+BaseType_t xTimerStop(TimerHandle_t timer, TickType_t wait)
+{
+    return pdPASS;
+}
+
+BaseType_t xTimerChangePeriod(TimerHandle_t timer, TickType_t period, TickType_t wait)
+{
+    return pdPASS;
+}
+
+void *pvTimerGetTimerID(TimerHandle_t timer)
+{
+    return NULL;
+}
+
+// Only one thread builds layers on the host, locks always succeed
+
+SemaphoreHandle_t xSemaphoreCreateMutex(void)
+{
+    return NULL;
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t semaphore, TickType_t wait)
+{
+    return pdTRUE;
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t semaphore)
+{
+    return pdTRUE;
+}
@@ -0,0 +1,6 @@
+#ifndef HOST_QUEUE_H_
+#define HOST_QUEUE_H_
+
+#include "FreeRTOS.h"
+
+#endif
@@ -0,0 +1,21 @@
+#ifndef HOST_SEMPHR_H_
+#define HOST_SEMPHR_H_
+
+#include "FreeRTOS.h"
+
+typedef void *SemaphoreHandle_t;
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    SemaphoreHandle_t xSemaphoreCreateMutex(void);
+    BaseType_t xSemaphoreTake(SemaphoreHandle_t semaphore, TickType_t wait);
+    BaseType_t xSemaphoreGive(SemaphoreHandle_t semaphore);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
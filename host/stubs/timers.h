@@ -0,0 +1,6 @@
+#ifndef HOST_TIMERS_H_
+#define HOST_TIMERS_H_
+
+#include "FreeRTOS.h"
+
+#endif
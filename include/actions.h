@@ -3,12 +3,17 @@
 
 #include <memory>
 #include <string>
+#include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
 #include "FreeRTOS.h"
 #include "queue.h"
+#include "semphr.h"
 
 #include "operation.h"
+#include "repeat.h"
+#include "serialize.h"
 
 namespace fex
 {
@@ -46,6 +51,10 @@ namespace fex
         MOUSE_SCROLL_ACTION,
         MOUSE_MOVE_ACTION,
         MOUSE_CLICK_ACTION,
+        LEADER_ACTION,
+        ONE_SHOT_MODIFIER_ACTION,
+        ONE_SHOT_LAYER_ACTION,
+        REPEATING_KEY_ACTION,
     };
 
     class BoundAction
@@ -56,9 +65,22 @@ namespace fex
         virtual void Print() const = 0;
         virtual void Enqueue(BoundActionEnqueue action, QueueHandle_t queue) = 0;
 
+        // Enqueue on behalf of a key. Equal actions are shared between keys, so
+        // any state kept while the key is held has to be kept per key.
+        virtual void EnqueueFor(int key, BoundActionEnqueue action, QueueHandle_t queue) { Enqueue(action, queue); }
+
         // Only to be used internally. Do not depend on an actions type.
         const BoundActionType &type() const { return type_; }
 
+        // The single key code this action types, if it is that simple
+        virtual bool KeyCode(int *code) const { return false; }
+
+        // Appends the names of the layers this action refers to
+        virtual void References(std::vector<std::string> *layers) const {}
+
+        // Writes the type followed by any parameters, read back by DeserializeAction
+        virtual void Serialize(ByteWriter *out) const { out->U8((uint8_t)type_); }
+
         virtual bool operator==(const BoundAction &other) = 0;
 
     protected:
@@ -76,9 +98,12 @@ namespace fex
 
         virtual void Print() const override;
         virtual void Enqueue(BoundActionEnqueue action, QueueHandle_t queue) override;
+        virtual void Serialize(ByteWriter *out) const override;
 
         const std::vector<int> keycodes() const { return keycodes_; }
 
+        virtual bool KeyCode(int *code) const override;
+
         virtual bool operator==(const BoundAction &other) override;
 
     protected:
@@ -130,6 +155,48 @@ namespace fex
         virtual bool operator==(const BoundAction &other) override;
     };
 
+    // Typematic repeat generated by the keyboard rather than the host
+    class RepeatingKeyAction : public GenericKeyAction
+    {
+    public:
+        RepeatingKeyAction(std::vector<int> keycodes, unsigned long repeat_delay, unsigned long repeat_rate);
+
+        RepeatingKeyAction(RepeatingKeyAction &&other) = default;
+        RepeatingKeyAction &operator=(RepeatingKeyAction &&other) = default;
+
+        virtual void Print() const override;
+        virtual void Enqueue(BoundActionEnqueue action, QueueHandle_t queue) override;
+        virtual void EnqueueFor(int key, BoundActionEnqueue action, QueueHandle_t queue) override;
+        virtual void Serialize(ByteWriter *out) const override;
+
+        const unsigned long repeat_delay() const { return repeat_delay_; }
+        const unsigned long repeat_rate() const { return repeat_rate_; }
+
+        virtual bool operator==(const BoundAction &other) override;
+
+    private:
+        unsigned long repeat_delay_;
+        unsigned long repeat_rate_;
+        RepeatProgram program_;
+    };
+
+    // Modifiers held for the next key only, they are sent in the same report as that key
+    class OneShotModifierAction : public GenericKeyAction
+    {
+    public:
+        OneShotModifierAction(std::vector<int> keycodes) : GenericKeyAction(std::move(keycodes)) { type_ = BoundActionType::ONE_SHOT_MODIFIER_ACTION; }
+
+        OneShotModifierAction(OneShotModifierAction &&other) = default;
+        OneShotModifierAction &operator=(OneShotModifierAction &&other) = default;
+
+        virtual void Print() const override;
+        virtual void Enqueue(BoundActionEnqueue action, QueueHandle_t queue) override;
+
+        virtual bool KeyCode(int *code) const override { return false; }
+
+        virtual bool operator==(const BoundAction &other) override;
+    };
+
     class SequenceAction : public BoundAction
     {
     public:
@@ -140,6 +207,8 @@ namespace fex
 
         virtual void Print() const override;
         virtual void Enqueue(BoundActionEnqueue action, QueueHandle_t queue) override;
+        virtual void Serialize(ByteWriter *out) const override;
+        virtual void References(std::vector<std::string> *layers) const override;
 
         const std::vector<std::unique_ptr<BoundAction>> &sequence() const { return sequence_; }
 
@@ -159,6 +228,7 @@ namespace fex
 
         virtual void Print() const override;
         virtual void Enqueue(BoundActionEnqueue action, QueueHandle_t queue) override;
+        virtual void Serialize(ByteWriter *out) const override;
 
         const unsigned long duration() const { return duration_; }
 
@@ -171,13 +241,15 @@ namespace fex
     class GenericLayerAction : public BoundAction
     {
     public:
-        GenericLayerAction(std::string target_layer) : target_layer_(target_layer) { type_ = BoundActionType::GENERIC_LAYER_ACTION; }
+        GenericLayerAction(std::string target_layer) : target_layer_(target_layer), target_id_(std::hash<std::string>()(target_layer_)) { type_ = BoundActionType::GENERIC_LAYER_ACTION; }
 
         GenericLayerAction(GenericLayerAction &&other) = default;
         GenericLayerAction &operator=(GenericLayerAction &&other) = default;
 
         virtual void Print() const override;
         virtual void Enqueue(BoundActionEnqueue action, QueueHandle_t queue) override;
+        virtual void Serialize(ByteWriter *out) const override;
+        virtual void References(std::vector<std::string> *layers) const override { layers->push_back(target_layer_); }
 
         const std::string &target_layer() const { return target_layer_; }
 
@@ -185,6 +257,7 @@ namespace fex
 
     protected:
         std::string target_layer_;
+        int target_id_; // Layer ids are the hash of the name, so this never needs updating
     };
 
     class SwitchToLayerAction : public GenericLayerAction
@@ -243,41 +316,64 @@ namespace fex
         virtual bool operator==(const BoundAction &other) override;
     };
 
+    // The next key press is looked up on the target layer, the active layer is left alone
+    class OneShotLayerAction : public GenericLayerAction
+    {
+    public:
+        OneShotLayerAction(std::string target_layer) : GenericLayerAction(target_layer) { type_ = BoundActionType::ONE_SHOT_LAYER_ACTION; }
+
+        OneShotLayerAction(OneShotLayerAction &&other) = default;
+        OneShotLayerAction &operator=(OneShotLayerAction &&other) = default;
+
+        virtual void Print() const override;
+        virtual void Enqueue(BoundActionEnqueue action, QueueHandle_t queue) override;
+
+        virtual bool operator==(const BoundAction &other) override;
+    };
+
     class StringTyperAction : public BoundAction
     {
     public:
-        StringTyperAction(std::string payload, unsigned long keystroke_delay, unsigned long repeat_delay)
-            : payload_(payload), keystroke_delay_(keystroke_delay), repeat_delay_(repeat_delay) { type_ = BoundActionType::STRING_TYPER_ACTION; }
+        StringTyperAction(std::string payload, unsigned long keystroke_delay, unsigned long repeat_delay, unsigned long repeat_rate);
 
         StringTyperAction(StringTyperAction &&other) = default;
         StringTyperAction &operator=(StringTyperAction &&other) = default;
 
         virtual void Print() const override;
         virtual void Enqueue(BoundActionEnqueue action, QueueHandle_t queue) override;
+        virtual void EnqueueFor(int key, BoundActionEnqueue action, QueueHandle_t queue) override;
+        virtual void Serialize(ByteWriter *out) const override;
 
         const std::string &payload() const { return payload_; }
         const unsigned long keystroke_delay() const { return keystroke_delay_; }
         const unsigned long repeat_delay() const { return repeat_delay_; }
+        const unsigned long repeat_rate() const { return repeat_rate_; }
 
         virtual bool operator==(const BoundAction &other) override;
 
     protected:
+        // Queues the payload to be typed once
+        void Type(QueueHandle_t queue) const;
+
         std::string payload_;
         unsigned long keystroke_delay_;
-        unsigned long repeat_delay_;
+        unsigned long repeat_delay_; // Before the first repeat
+        unsigned long repeat_rate_;  // Between the end of one repeat and the start of the next
+        RepeatProgram program_;
     };
 
     class NonRepeatingStringTyperAction : public StringTyperAction
     {
     public:
         NonRepeatingStringTyperAction(std::string payload, unsigned long keystroke_delay)
-            : StringTyperAction(payload, keystroke_delay, 0) { type_ = BoundActionType::NON_REPEATING_STRING_TYPER_ACTION; }
+            : StringTyperAction(payload, keystroke_delay, 0, 0) { type_ = BoundActionType::NON_REPEATING_STRING_TYPER_ACTION; }
 
         NonRepeatingStringTyperAction(NonRepeatingStringTyperAction &&other) = default;
         NonRepeatingStringTyperAction &operator=(NonRepeatingStringTyperAction &&other) = default;
 
         virtual void Print() const override;
         virtual void Enqueue(BoundActionEnqueue action, QueueHandle_t queue) override;
+        virtual void EnqueueFor(int key, BoundActionEnqueue action, QueueHandle_t queue) override { Enqueue(action, queue); }
 
         virtual bool operator==(const BoundAction &other) override;
     };
@@ -366,6 +462,20 @@ namespace fex
         virtual bool operator==(const BoundAction &other) override;
     };
 
+    class LeaderAction : public BoundAction
+    {
+    public:
+        LeaderAction() { type_ = BoundActionType::LEADER_ACTION; }
+
+        LeaderAction(LeaderAction &&other) = default;
+        LeaderAction &operator=(LeaderAction &&other) = default;
+
+        virtual void Print() const override;
+        virtual void Enqueue(BoundActionEnqueue action, QueueHandle_t queue) override;
+
+        virtual bool operator==(const BoundAction &other) override;
+    };
+
     class GenericMouseAction : public BoundAction
     {
     public:
@@ -376,6 +486,7 @@ namespace fex
 
         virtual void Print() const override;
         virtual void Enqueue(BoundActionEnqueue action, QueueHandle_t queue) override;
+        virtual void Serialize(ByteWriter *out) const override;
 
         const bool up_down() const { return up_down_; }
         const int8_t speed() const { return speed_; }
@@ -425,6 +536,7 @@ namespace fex
 
         virtual void Print() const override;
         virtual void Enqueue(BoundActionEnqueue action, QueueHandle_t queue) override;
+        virtual void Serialize(ByteWriter *out) const override;
 
         const uint8_t button() const { return button_; }
 
@@ -434,6 +546,36 @@ namespace fex
     private:
         int8_t button_;
     };
+
+    // Returns nullptr if the data is truncated or the type is unknown
+    std::unique_ptr<BoundAction> DeserializeAction(ByteReader *in);
+
+    // Owns every bound action. Equal actions are kept once and shared by all
+    // layers, which hold pointers into the pool. Actions stay after their layer
+    // is unloaded, so loading it again finds them already here, until Retain
+    // drops everything the layers in use no longer refer to.
+    class ActionPool
+    {
+    public:
+        // Must be called before the scheduler is started
+        void Initialize();
+
+        // Returns the pooled action equal to action, adding action if there is none
+        BoundAction *Intern(std::unique_ptr<BoundAction> action);
+
+        // Frees every action not in live, returns how many. Nothing else may
+        // hold a pointer to those, nor be building a layer.
+        size_t Retain(const std::unordered_set<const BoundAction *> &live);
+
+        size_t size() const { return size_; }
+
+    private:
+        SemaphoreHandle_t mutex_ = NULL; // Layers are built by more than one task
+        std::unordered_map<uint32_t, std::vector<std::unique_ptr<BoundAction>>> actions_; // By hash of the serialized action
+        size_t size_ = 0;
+    };
+
+    ActionPool &action_pool();
 }
 
 #endif
\ No newline at end of file
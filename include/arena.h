@@ -0,0 +1,46 @@
+#ifndef ARENA_H_
+#define ARENA_H_
+
+#include <memory_resource>
+#include <stddef.h>
+
+#define PARSE_ARENA_SIZE (4 * 1024) // Per load keymaps task, a statement's tokens and parse tree fit many times over
+
+namespace fex
+{
+    // Bump allocator for the temporaries of compiling a keymap. Freeing does
+    // nothing, memory is only reclaimed all at once by Rewind or Reset, so the
+    // heap is never left fragmented by parsing. Allocations that don't fit in
+    // the buffer go to the heap as usual.
+    class Arena : public std::pmr::memory_resource
+    {
+    public:
+        Arena() = default; // No buffer, everything goes to the heap
+        Arena(void *buffer, size_t size) : buffer_((char *)buffer), size_(size) {}
+
+        Arena(const Arena &) = delete;
+        Arena &operator=(const Arena &) = delete;
+
+        // Rewind(Mark()) drops everything allocated in between, none of it may still be in use
+        size_t Mark() const { return used_; }
+        void Rewind(size_t mark) { used_ = mark; }
+        void Reset() { used_ = 0; }
+
+        size_t size() const { return size_; }
+        size_t peak() const { return peak_; }       // Most of the buffer ever in use
+        size_t spilled() const { return spilled_; } // Bytes that didn't fit and went to the heap
+
+    private:
+        void *do_allocate(size_t bytes, size_t alignment) override;
+        void do_deallocate(void *p, size_t bytes, size_t alignment) override;
+        bool do_is_equal(const std::pmr::memory_resource &other) const noexcept override { return this == &other; }
+
+        char *buffer_ = nullptr;
+        size_t size_ = 0;
+        size_t used_ = 0;
+        size_t peak_ = 0;
+        size_t spilled_ = 0;
+    };
+}
+
+#endif
@@ -0,0 +1,131 @@
+#ifndef COMBO_H_
+#define COMBO_H_
+
+#include <memory>
+#include <stdint.h>
+#include <vector>
+
+#include "FreeRTOS.h"
+#include "queue.h"
+
+#include "actions.h"
+#include "serialize.h"
+
+#define KEY_MASK_BITS 80
+#define COMBO_MAX_KEYS 8
+#define COMBO_MAX_ACTIVE 4
+#define COMBO_DEFAULT_WINDOW_MS 50
+
+namespace fex
+{
+    // One bit per Row * Key value, wide enough to cover the whole 10 byte scan
+    struct KeyMask
+    {
+        uint32_t words[3] = {0, 0, 0};
+
+        void Set(int key) { words[key >> 5] |= (1u << (key & 31)); }
+        void Clear(int key) { words[key >> 5] &= ~(1u << (key & 31)); }
+        bool Test(int key) const { return words[key >> 5] & (1u << (key & 31)); }
+        bool Empty() const { return (words[0] | words[1] | words[2]) == 0; }
+
+        bool SubsetOf(const KeyMask &other) const
+        {
+            return (words[0] & ~other.words[0]) == 0 && (words[1] & ~other.words[1]) == 0 && (words[2] & ~other.words[2]) == 0;
+        }
+
+        bool operator==(const KeyMask &other) const
+        {
+            return words[0] == other.words[0] && words[1] == other.words[1] && words[2] == other.words[2];
+        }
+    };
+
+    struct KeyEvent
+    {
+        int index;       // Position in the scan (byte * 8 + bit)
+        int key;         // Row * Key value
+        bool pressed;
+        TickType_t time;
+    };
+
+    struct Combo
+    {
+        KeyMask keys;
+        BoundAction *action; // Owned by action_pool()
+    };
+
+    class ComboSet
+    {
+    public:
+        ComboSet() = default;
+
+        ComboSet(ComboSet &&other) = default;
+        ComboSet &operator=(ComboSet &&other) = default;
+
+        void Add(const KeyMask &keys, std::unique_ptr<BoundAction> action);
+
+        // Rebuilds the per-key index, must be called after the last Add
+        void Build();
+
+        void Serialize(ByteWriter *out) const;
+        // Adds the serialized combos and rebuilds the index
+        bool Deserialize(ByteReader *in);
+
+        bool Involves(int key) const { return Valid(key) && offsets_[key] != offsets_[key + 1]; }
+        int CandidateCount(int key) const { return Valid(key) ? offsets_[key + 1] - offsets_[key] : 0; }
+        const Combo &Candidate(int key, int n) const { return combos_[index_[offsets_[key] + n]]; }
+
+        bool empty() const { return combos_.empty(); }
+        const std::vector<Combo> &combos() const { return combos_; }
+
+    private:
+        bool Valid(int key) const { return key >= 0 && key < KEY_MASK_BITS && !offsets_.empty(); }
+
+        std::vector<Combo> combos_;
+
+        // Combos containing key k are index_[offsets_[k]] .. index_[offsets_[k + 1]]
+        std::vector<uint16_t> offsets_;
+        std::vector<uint16_t> index_;
+    };
+
+    // Sits between edge detection and normal key dispatch. Keys that belong to
+    // a combo are held back until they either complete one, can no longer
+    // complete one, or the combo window runs out. Everything else is passed
+    // straight through (see Next).
+    class ComboEngine
+    {
+    public:
+        void Process(const ComboSet &combos, const KeyEvent &event, QueueHandle_t queue);
+        void Tick(const ComboSet &combos, TickType_t now, TickType_t window, QueueHandle_t queue);
+
+        // Pops the next event that should be dispatched normally
+        bool Next(KeyEvent *event);
+
+    private:
+        struct ActiveCombo
+        {
+            BoundAction *action; // Pooled, so it outlives the layer that bound it
+            int key;             // First key pressed, the combo's action is enqueued for it
+            KeyMask held;
+            bool released;
+        };
+
+        void Resolve(const ComboSet &combos, QueueHandle_t queue);
+        void Fire(const Combo &combo, QueueHandle_t queue);
+        void Emit(const KeyEvent &event);
+        const Combo *Exact(const ComboSet &combos, const KeyMask &keys, int key) const;
+        bool Superset(const ComboSet &combos, const KeyMask &keys, int key, bool strict) const;
+
+        KeyEvent pending_[COMBO_MAX_KEYS];
+        int pending_count_ = 0;
+        KeyMask pending_mask_;
+
+        ActiveCombo active_[COMBO_MAX_ACTIVE] = {};
+        KeyMask consumed_;
+
+        KeyEvent ready_[COMBO_MAX_KEYS * 2];
+        int ready_head_ = 0;
+        int ready_count_ = 0;
+    };
+}
+
+#endif
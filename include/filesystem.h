@@ -2,10 +2,15 @@
 #define INCLUDE_FILESYSTEM_H_
 
 #include <string>
+#include <string_view>
 #include <vector>
 
 #include "ff.h"
 
+// Largest file MappedFile maps. Flash writes wait while one is open, so a
+// longer parse would stall the drive and the other loader.
+#define MAPPED_FILE_MAX_SIZE 4096
+
 namespace fex
 {
 
@@ -26,14 +31,63 @@ namespace fex
         bool AddFile(const std::string& filename, const std::string& contents);
         std::string ReadFile(const std::string& filename);
         bool FileExists(const std::string& filename);
+        bool Stat(const std::string& filename, FILINFO *info);
         bool DeleteFile(const std::string& filename);
 
+        // Makes filename size bytes long, in one run of clusters, unless it
+        // already is, and finds the sector it starts at
+        bool Reserve(const std::string &filename, uint32_t size, uint32_t *sector);
+
     private:
         FRESULT ListAcc(char *path, std::vector<std::string> *out);
 
         FATFS fs_;
     };
 
+    // Reads one file front to back, for files too large to hold in memory
+    class FileReader
+    {
+    public:
+        FileReader() = default;
+        ~FileReader();
+
+        FileReader(const FileReader &) = delete;
+        FileReader &operator=(const FileReader &) = delete;
+
+        bool Open(const std::string &filename);
+
+        // 0 at the end of the file or on error
+        size_t Read(char *buffer, size_t size);
+
+    private:
+        FIL fp_;
+        bool open_ = false;
+    };
+
+    // A small file read in place through XIP, for files stored contiguously.
+    // Until it is closed nothing is written to flash, so keep it short and
+    // leave the filesystem alone meanwhile.
+    class MappedFile
+    {
+    public:
+        MappedFile() = default;
+        ~MappedFile() { Close(); }
+
+        MappedFile(const MappedFile &) = delete;
+        MappedFile &operator=(const MappedFile &) = delete;
+
+        // False if the file is missing, fragmented or larger than MAPPED_FILE_MAX_SIZE,
+        // read it with a FileReader instead
+        bool Open(const std::string &filename);
+        void Close();
+
+        std::string_view contents() const { return contents_; }
+
+    private:
+        std::string_view contents_;
+        bool mapped_ = false;
+    };
+
 }
 
 #endif
\ No newline at end of file
@@ -0,0 +1,83 @@
+#ifndef FTL_H_
+#define FTL_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#define FTL_SECTOR_SIZE 4096
+#define FTL_PAGE_SIZE 256
+#define FTL_MAX_SECTORS 320   // Physical sectors an area may have, sizes the tables
+#define FTL_META_SECTORS 2    // Checkpoint and journal, A/B
+#define FTL_SPARE_SECTORS 8   // Always free, so every write has somewhere else to go
+#define FTL_WEAR_INTERVAL 32  // Writes between static wear levelling checks
+#define FTL_WEAR_SPREAD 16    // Erase count gap that moves cold data onto worn sectors
+
+#define FTL_LOGICAL_SECTORS(physical) ((physical) - FTL_META_SECTORS - FTL_SPARE_SECTORS)
+
+    // Raw flash under the translation layer. Offsets are from the start of the
+    // area, which can be read directly through base. program is given whole
+    // pages, and may be called again on a page to clear more bits.
+    typedef struct
+    {
+        uint8_t const *base;
+        void (*erase)(uint32_t offset);
+        void (*program)(uint32_t offset, uint8_t const *data, uint32_t len);
+    } ftl_flash_t;
+
+    // Maps logical sectors onto physical ones. A write always goes to a free
+    // sector, the least worn, and only takes effect once the mapping change
+    // is appended to the journal, so a power cut leaves either the old or
+    // the new contents. When the journal fills, the whole map is written as
+    // a checkpoint to the other meta sector, the newest valid one wins.
+    typedef struct
+    {
+        ftl_flash_t flash;
+        uint32_t physical_count; // Including the meta sectors, which come first
+        uint32_t logical_count;
+
+        uint16_t map[FTL_MAX_SECTORS];    // Logical to physical
+        uint16_t owner[FTL_MAX_SECTORS];  // Physical to logical, FTL_FREE if unmapped
+        uint32_t erases[FTL_MAX_SECTORS]; // By physical sector, meta sectors included
+
+        uint32_t seq;          // Of the last change, checkpoint or journal entry
+        uint32_t bank;         // Meta sector holding the checkpoint in use
+        uint32_t journal_next; // Next free entry in that bank
+        uint32_t writes;
+        bool mounted;
+
+        // Counters
+        uint32_t erase_count;
+        uint32_t program_only; // Writes to a free sector that needed no erase
+        uint32_t pages_programmed;
+        uint32_t checkpoints;
+        uint32_t relocations;  // Cold sectors moved by wear levelling
+    } ftl_t;
+
+#define FTL_FREE 0xffff
+
+    void ftl_setup(ftl_t *ftl, ftl_flash_t flash, uint32_t physical_count);
+
+    // Loads the newest checkpoint and replays its journal, false if there is none
+    bool ftl_mount(ftl_t *ftl);
+
+    // Starts over with logical sectors mapped in order onto the last sectors of
+    // the area, so data written straight onto those is kept. Erase counts are
+    // kept if mounted.
+    void ftl_format(ftl_t *ftl);
+
+    // Logical sector's physical offset, for reading through base
+    uint32_t ftl_offset(ftl_t const *ftl, uint32_t logical);
+
+    // Replaces a logical sector, data must not be in the flash itself
+    void ftl_write(ftl_t *ftl, uint32_t logical, uint8_t const *data);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,60 @@
+#ifndef KEYMAP_CACHE_H_
+#define KEYMAP_CACHE_H_
+
+#include <stdint.h>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "arena.h"
+#include "filesystem.h"
+#include "layer.h"
+#include "serialize.h"
+
+#define KEYMAP_CACHE_MAGIC 0x434d4b46 // "FKMC"
+#define KEYMAP_CACHE_VERSION 1
+
+namespace fex
+{
+    // Identifies the source a compiled keymap was built from. The size and
+    // timestamp let an untouched source skip being read at all, the hash
+    // catches sources that were rewritten with the same contents.
+    struct KeymapStamp
+    {
+        uint32_t size;
+        uint16_t date;
+        uint16_t time;
+        uint32_t hash;
+    };
+
+    // What a loaded keymap was built from and which layers it refers to, so a
+    // reload can tell what needs compiling again without parsing the file
+    struct KeymapDeps
+    {
+        KeymapStamp stamp;
+        std::vector<std::string> references; // Layer::References
+    };
+
+    std::string CompileKeymap(const Layer &layer, const KeymapStamp &stamp);
+
+    // Hash of the file's contents, streamed
+    uint32_t HashFile(const std::string &path);
+
+    // Checks the header and the checksum of what follows it, leaves in
+    // positioned at the serialized layer
+    bool ReadKeymapHeader(ByteReader *in, KeymapStamp *stamp);
+
+    // Loads NAME.kmf, going through the compiled NAME.kmc next to it when it
+    // is still current and rewriting it when it is not. Returns the parse error, if any.
+    // Compiling takes its temporaries from arena, when given. Without
+    // update_cache nothing is written, for when the host has the drive mounted.
+    // deps is filled in on success.
+    std::string LoadKeymap(Filesystem &fs, const std::string &name, Layer *layer, KeymapDeps *deps,
+                           Arena *arena = nullptr, bool update_cache = true);
+
+    // Changes whenever a keymap source is added, removed or written, found
+    // from the directory entries alone. Never 0.
+    uint32_t KeymapSourcesStamp(Filesystem &fs, const std::vector<std::string> &names);
+}
+
+#endif
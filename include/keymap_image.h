@@ -0,0 +1,63 @@
+#ifndef KEYMAP_IMAGE_H_
+#define KEYMAP_IMAGE_H_
+
+#include <stdint.h>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "layer.h"
+#include "serialize.h"
+
+#define KEYMAP_IMAGE_MAGIC 0x474d4946 // "FIMG"
+#define KEYMAP_IMAGE_VERSION 2
+#define KEYMAP_IMAGE_HEADER_SIZE 20
+#define KEYMAP_IMAGE_SIZE (216 * 1024) // Partition size, must match flash.h
+
+namespace fex
+{
+    // Every layer in one CRC'd blob, kept in its own flash partition
+    // (KEYMAP_IMAGE_OFFSET) and read in place over XIP.
+    //
+    //   u32 magic, u16 version, u16 layer count, u32 sources, u32 body size, u32 body crc
+    //   body: per layer, the name then Layer::Serialize as a record, both as ByteWriter strings
+    struct KeymapImageInfo
+    {
+        uint16_t layer_count;
+        uint32_t sources; // KeymapSourcesStamp of the files it was built from, 0 if unknown
+        std::string_view body;
+    };
+
+    struct KeymapImageEntry
+    {
+        std::string name;
+        std::string_view record; // Points into the image
+    };
+
+    std::string BuildKeymapImage(const std::vector<std::pair<std::string, const Layer *>> &layers, uint32_t sources);
+
+    // Builds an image a layer at a time, as layers finish loading
+    class KeymapImageBuilder
+    {
+    public:
+        void Add(const std::string &name, const Layer &layer);
+        void AddRecord(const std::string &name, std::string_view record); // As found by IndexKeymapImage
+        std::string Finish(uint32_t sources) const;
+
+    private:
+        ByteWriter body_;
+        uint16_t layer_count_ = 0;
+    };
+
+    // image may extend past the end of the image, e.g. the whole partition
+    bool CheckKeymapImage(std::string_view image, KeymapImageInfo *info);
+
+    bool ReadKeymapImage(const KeymapImageInfo &info, std::vector<std::pair<std::string, Layer>> *layers);
+
+    // Finds each layer's record without loading any of them
+    bool IndexKeymapImage(const KeymapImageInfo &info, std::vector<KeymapImageEntry> *entries);
+    bool LoadKeymapRecord(std::string_view record, Layer *layer);
+}
+
+#endif
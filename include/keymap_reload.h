@@ -0,0 +1,19 @@
+#ifndef KEYMAP_RELOAD_H_
+#define KEYMAP_RELOAD_H_
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#define KEYMAP_RELOAD_DEBOUNCE_MS 1000 // Quiet time after the last request before reloading
+
+    // Recompiles the keymaps on the drive and swaps them in, without a reboot.
+    // Requests are debounced, as hosts write a file in many pieces. Task context only.
+    void keymap_reload_request(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
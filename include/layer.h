@@ -1,16 +1,21 @@
 #ifndef LAYER_H_
 #define LAYER_H_
 
+#include <atomic>
 #include <memory>
 #include <string>
 #include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
 #include "FreeRTOS.h"
 #include "queue.h"
 
 #include "actions.h"
+#include "combo.h"
+#include "leader.h"
 #include "operation.h"
+#include "serialize.h"
 
 namespace fex
 {
@@ -18,7 +23,7 @@ namespace fex
         int,                     // Row * Key
             std::unordered_map<
                 Operation,       // Operation
-                std::unique_ptr<BoundAction>>>   // Action
+                BoundAction *>>          // Action, owned by action_pool()
         KeyBindings;
 
     class Layer
@@ -33,21 +38,83 @@ namespace fex
         void Bind(int key, std::unique_ptr<BoundAction> action, Operation operation);
         void Enqueue(int key, Operation operation, BoundActionEnqueue action, QueueHandle_t queue);
 
+        void BindCombo(const KeyMask &keys, std::unique_ptr<BoundAction> action);
+        void BuildComboIndex() { combos_.Build(); }
+
+        void BindLeaderSequence(std::vector<uint8_t> sequence, std::unique_ptr<BoundAction> action);
+        void BuildLeaderTrie() { leader_.Build(); }
+
+        // Key code typed by the key's press binding, used to walk leader sequences
+        bool KeyCode(int key, int *code) const;
+
+        // Names of the layers reachable from this one, sorted, each once
+        std::vector<std::string> References() const;
+
+        // Adds every pooled action the layer refers to
+        void Actions(std::unordered_set<const BoundAction *> *actions) const;
+
+        // Everything parse_source produces for the layer, the name is not included
+        void Serialize(ByteWriter *out) const;
+        bool Deserialize(ByteReader *in);
+
         const std::string &name() { return name_; }
         const bool on_hold_bound() { return on_hold_bound_; }
         bool unassigned_keys_fall_through() { return unassigned_keys_fall_through_; }
         const KeyBindings& bindings() { return bindings_; }
+        const ComboSet &combos() const { return combos_; }
+        const LeaderTrie &leader() const { return leader_; }
+        unsigned long combo_window() const { return combo_window_; }
 
         void set_name(const std::string &name) { name_ = name; }
         void set_unassigned_keys_fall_through(bool value) { unassigned_keys_fall_through_ = value; }
+        void set_combo_window(unsigned long value) { combo_window_ = value; }
 
     private:
         std::string name_;
         bool on_hold_bound_ = false;
-        bool unassigned_keys_fall_through_;
+        bool unassigned_keys_fall_through_ = false;
         KeyBindings bindings_;
+        ComboSet combos_;
+        LeaderTrie leader_;
+        unsigned long combo_window_ = COMBO_DEFAULT_WINDOW_MS;
     };
 
+    // The active layer. Switches happen synchronously in the process keys task,
+    // every other task reads the published snapshot.
+    class LayerState
+    {
+    public:
+        // Process keys task only (or main, before scheduling)
+        void Switch(int layer);
+        int active() const { return active_; }
+
+        // Safe from any task
+        int snapshot() const { return published_.load(std::memory_order_acquire); }
+
+    private:
+        int active_ = 0;
+        std::atomic<int> published_{0};
+    };
+
+    LayerState &layer_state();
+
+    // Layer used for the next key press only, owned by the process keys task
+    class OneShotLayer
+    {
+    public:
+        // Arming the layer that is already armed cancels it
+        void Arm(int layer);
+        void Cancel() { armed_ = false; }
+        bool armed() const { return armed_; }
+        int layer() const { return layer_; }
+
+    private:
+        bool armed_ = false;
+        int layer_ = 0;
+    };
+
+    OneShotLayer &one_shot_layer();
+
 }
 
 #endif
\ No newline at end of file
@@ -0,0 +1,69 @@
+#ifndef LAYER_CACHE_H_
+#define LAYER_CACHE_H_
+
+#include <initializer_list>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "layer.h"
+
+#define LAYER_CACHE_RESIDENT 4 // Layers loaded from the keymap image kept in RAM at once
+
+namespace fex
+{
+    // Every known layer by id (hash of its name). Layers indexed from the keymap
+    // image are only loaded when first used, and the least recently used are
+    // dropped again past LAYER_CACHE_RESIDENT. Layers inserted directly stay resident.
+    //
+    // Process keys task only (or main, before scheduling)
+    class LayerCache
+    {
+    public:
+        void Index(int id, const std::string &name, std::string_view record);
+        void Insert(int id, const std::string &name, Layer layer);
+
+        // Forgets every layer not in keep. Those kept keep their record, so they
+        // have to be indexed again, or unlinked, before the image is rewritten.
+        void Detach(const std::vector<int> &keep);
+
+        // Loads every layer that has a record and drops it, so the image can be
+        // rewritten underneath them
+        void Unlink();
+
+        // Unknown ids get an empty layer, as the map this replaced did
+        Layer &Get(int id);
+        bool Contains(int id) const { return entries_.find(id) != entries_.end(); }
+        const std::string &Name(int id) { return entries_[id].name; }
+
+        // Drops layers past the limit, never those in keep. References from Get
+        // are only valid until the next Trim.
+        void Trim(std::initializer_list<int> keep);
+
+        // Adds the pooled actions of every loaded layer
+        void Actions(std::unordered_set<const BoundAction *> *actions) const;
+
+        // Shares the current ids and names through shared_layer_set() if they
+        // changed, for tasks other than the owner
+        void Publish();
+
+    private:
+        struct Entry
+        {
+            std::string name;
+            std::string_view record; // Empty if the layer can't be reloaded
+            std::unique_ptr<Layer> layer;
+            uint32_t last_used = 0;
+        };
+
+        std::unordered_map<int, Entry> entries_;
+        int resident_ = 0; // Loaded layers that have a record
+        uint32_t clock_ = 0;
+        bool changed_ = false;
+    };
+}
+
+#endif
@@ -0,0 +1,81 @@
+#ifndef LAYER_SET_H_
+#define LAYER_SET_H_
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace fex
+{
+    // The known layers, never changed once published
+    struct LayerSet
+    {
+        struct Entry
+        {
+            int id;
+            std::string name;
+        };
+
+        std::vector<Entry> layers;
+        uint32_t generation = 0; // Bumped by every publish
+
+        const std::string *Name(int id) const;
+    };
+
+    // Hands the layer set from the process keys task to any task, on either
+    // core, without locks. Readers count themselves into one of two epochs;
+    // a replaced set is freed once both epochs have been seen without readers.
+    class SharedLayerSet
+    {
+    public:
+        class Reader
+        {
+        public:
+            Reader(Reader &&other) : owner_(other.owner_), epoch_(other.epoch_), set_(other.set_) { other.owner_ = nullptr; }
+            ~Reader();
+
+            Reader(const Reader &) = delete;
+            Reader &operator=(const Reader &) = delete;
+
+            const LayerSet &operator*() const { return *set_; }
+            const LayerSet *operator->() const { return set_; }
+
+        private:
+            friend class SharedLayerSet;
+            Reader(SharedLayerSet *owner, int epoch, const LayerSet *set) : owner_(owner), epoch_(epoch), set_(set) {}
+
+            SharedLayerSet *owner_;
+            int epoch_;
+            const LayerSet *set_;
+        };
+
+        // Any task. The set stays valid for as long as the Reader, keep it short lived.
+        Reader Read();
+
+        // Process keys task only (or main, before scheduling)
+        void Publish(std::unique_ptr<LayerSet> set);
+
+        // Frees the replaced sets whose readers are gone, true once nothing is left to free.
+        // Process keys task only, Publish never waits for readers.
+        bool Reclaim();
+
+    private:
+        struct Retired
+        {
+            const LayerSet *set;
+            bool clear[2]; // Epoch seen without readers since the set was replaced
+        };
+
+        std::atomic<const LayerSet *> current_{nullptr};
+        std::atomic<int> epoch_{0};
+        std::atomic<int> readers_[2] = {};
+
+        std::vector<Retired> retired_;
+        uint32_t generation_ = 0;
+    };
+
+    SharedLayerSet &shared_layer_set();
+}
+
+#endif
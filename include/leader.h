@@ -0,0 +1,87 @@
+#ifndef LEADER_H_
+#define LEADER_H_
+
+#include <memory>
+#include <stdint.h>
+#include <vector>
+
+#include "FreeRTOS.h"
+#include "queue.h"
+
+#include "actions.h"
+#include "serialize.h"
+
+#define LEADER_TIMEOUT_MS 1000
+
+namespace fex
+{
+    // Leader sequences compiled into a flat transition table. Key codes are
+    // mapped onto a compact alphabet so each node is one row of
+    // alphabet_size() entries and a step is a single lookup.
+    class LeaderTrie
+    {
+    public:
+        LeaderTrie() = default;
+
+        LeaderTrie(LeaderTrie &&other) = default;
+        LeaderTrie &operator=(LeaderTrie &&other) = default;
+
+        void Add(std::vector<uint8_t> sequence, std::unique_ptr<BoundAction> action);
+
+        // Compiles every added sequence into the table, must be called after the last Add
+        void Build();
+
+        // Writes the compiled table, Deserialize restores it without a Build
+        void Serialize(ByteWriter *out) const;
+        bool Deserialize(ByteReader *in);
+
+        // Returns the child of node for code, or 0 if there is none (the root is never a child)
+        uint16_t Step(uint16_t node, uint8_t code) const;
+
+        BoundAction *action(uint16_t node) const;
+        const std::vector<BoundAction *> &actions() const { return actions_; }
+        bool leaf(uint16_t node) const { return leaf_[node]; }
+        bool empty() const { return actions_.empty(); }
+        int alphabet_size() const { return symbols_; }
+
+    private:
+        std::vector<std::pair<std::vector<uint8_t>, int>> sequences_;
+        std::vector<BoundAction *> actions_; // Owned by action_pool()
+
+        std::vector<uint8_t> alphabet_; // key code -> symbol + 1, 0 if unused
+        int symbols_ = 0;
+
+        std::vector<uint16_t> transitions_; // node * symbols_ + symbol -> child
+        std::vector<int16_t> node_action_;  // index into actions_, -1 if none
+        std::vector<bool> leaf_;
+    };
+
+    // Runtime state of the leader key, owned by the process keys task
+    class LeaderEngine
+    {
+    public:
+        // Starts a sequence as of the poll last passed to Tick
+        void Begin();
+        void Cancel() { active_ = false; }
+        bool active() const { return active_; }
+
+        // Advances the sequence by one key, pressed at now
+        void Feed(const LeaderTrie &trie, uint8_t code, TickType_t now, QueueHandle_t queue);
+
+        // Called once per poll with its time, before its keys are dispatched.
+        // Every time the engine keeps is on this clock.
+        void Tick(const LeaderTrie &trie, TickType_t now, QueueHandle_t queue);
+
+    private:
+        void Fire(BoundAction *action, QueueHandle_t queue);
+
+        bool active_ = false;
+        uint16_t node_ = 0;
+        TickType_t last_key_ = 0;
+        TickType_t now_ = 0;
+    };
+
+    LeaderEngine &leader_engine();
+}
+
+#endif
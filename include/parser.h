@@ -1,10 +1,12 @@
 #ifndef PARSER_H
 #define PARSER_H
 
+#include <memory_resource>
 #include <string>
-#include <unordered_map>
+#include <string_view>
 #include <vector>
 
+#include "arena.h"
 #include "layer.h"
 #include "operation.h"
 #include "tokenizer.h"
@@ -12,17 +14,46 @@
 namespace fex
 {
 
-  typedef std::unordered_map< // Row x Key map
-      int,
-        std::unordered_map< // Operation map
-          Operation,
-          std::vector< // Tokens representing the action
-            Token>>>
-      Binding;
-  typedef std::vector<Binding> BindingList;
-  typedef std::vector<Token> TopLevel;
-
-	std::string parse_source(const std::string &source , Layer* layer);
+  // Spans point into the token vector the tree was parsed from
+  struct Binding
+  {
+    int key; // Row x Key value
+    TokenSpan actions[(int)Operation::RELEASE + 1]; // Indexed by Operation, empty if unbound
+  };
+  typedef std::pmr::vector<Binding> BindingList;
+  typedef std::pmr::vector<TokenSpan> TopLevel; // Statement token followed by its parameters
+
+  struct ComboBinding
+  {
+    std::pmr::vector<int> keys; // Row x Key values pressed together
+    TokenSpan action;
+  };
+  typedef std::pmr::vector<ComboBinding> ComboList;
+
+  struct LeaderBinding
+  {
+    TokenSpan keys; // Key names typed after the leader key
+    TokenSpan action;
+  };
+  typedef std::pmr::vector<LeaderBinding> LeaderList;
+
+  // Only lives until the layer is built, so it is kept out of the long lived heap
+  struct ParseTree
+  {
+    ParseTree() = default;
+    explicit ParseTree(std::pmr::memory_resource *memory) : top_level(memory), bindings(memory), combos(memory), leaders(memory) {}
+
+    TopLevel top_level;
+    BindingList bindings;
+    ComboList combos;
+    LeaderList leaders;
+  };
+
+  // Temporaries are allocated from arena when given, it can be reset once the layer is built
+	std::string parse_source(std::string_view source, Layer* layer, Arena *arena = nullptr);
+
+  // Same result as parse_source, holding one statement of the source at a time
+  std::string parse_stream(TokenStream *stream, Layer *layer, Arena *arena = nullptr);
 
 }
 
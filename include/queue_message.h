@@ -10,7 +10,6 @@ namespace fex
         PRESS,
         RELEASE,
         DELAY,
-        LAYER_SWITCH,
         MOUSE_MOVE_LEFT_RIGHT,
         MOUSE_MOVE_UP_DOWN,
         MOUSE_SCROLL_LEFT_RIGHT,
@@ -19,6 +18,8 @@ namespace fex
         MOUSE_RELEASE,
         REBOOT,
         REBOOT_BOOTLOADER,
+        ONE_SHOT_MODIFIER,
+        RELOAD_KEYMAPS,
     };
 
     // Queue for key presses:
@@ -30,7 +31,6 @@ namespace fex
         unsigned char codes[KEY_ROLL_OVER];
         unsigned char length;
         unsigned long delay;
-        int layer;
         int8_t mouse_delta;
         uint8_t mouse_click;
     } QueueMessage;
@@ -0,0 +1,89 @@
+#ifndef REPEAT_H_
+#define REPEAT_H_
+
+#include <stdint.h>
+#include <vector>
+
+#include "FreeRTOS.h"
+#include "timers.h"
+
+#define REPEAT_MAX_SLOTS 4
+#define REPEAT_MAX_READY 16
+#define REPEAT_RETRY_MS 10
+#define REPEAT_DEFAULT_DELAY_MS 500
+#define REPEAT_DEFAULT_RATE_MS 33
+
+namespace fex
+{
+    // A single change to the keyboard report
+    struct RepeatDelta
+    {
+        uint8_t code;
+        bool press;
+    };
+
+    struct RepeatStep
+    {
+        RepeatDelta delta;
+        unsigned long wait; // ms until the next step
+    };
+
+    // Built once per binding, played in a loop for as long as the key is held
+    typedef std::vector<RepeatStep> RepeatProgram;
+
+    // Plays repeat programs from a FreeRTOS software timer. The timer task
+    // produces report deltas and the HID task applies them (see Next), so
+    // repeats never go through the event queue.
+    class RepeatScheduler
+    {
+    public:
+        // Must be called before the scheduler is started
+        void Initialize();
+
+        // owner and key are used to stop the program later, program must outlive
+        // owner. Owners may be shared by several keys, each plays its own copy.
+        // The first pass starts after delay, the wait after the first pass is first_gap
+        void Start(const void *owner, int key, const RepeatProgram *program, unsigned long delay, unsigned long first_gap);
+
+        // With finish_pass the program stops at the end of the current pass instead of right away
+        void Stop(const void *owner, int key, bool finish_pass);
+
+        // Pops the next delta that should be applied to the report
+        bool Next(RepeatDelta *delta);
+
+        // No program is playing, so no owner is referenced
+        bool Idle();
+
+    private:
+        struct Slot
+        {
+            const void *owner;
+            int key;
+            const RepeatProgram *program;
+            size_t step;
+            TickType_t due;
+            uint8_t down; // Code pressed by the last delta, 0 if none
+            unsigned long first_gap;
+            bool wrapped;
+            bool stopping;
+            bool releasing; // Stopped, but the release of down didn't fit in ready_
+        };
+
+        static void TimerCallback(TimerHandle_t timer);
+
+        void Advance(TickType_t now);
+        void Arm(TickType_t now);
+        bool Push(const RepeatDelta &delta);
+
+        TimerHandle_t timer_ = NULL;
+        Slot slots_[REPEAT_MAX_SLOTS] = {};
+
+        RepeatDelta ready_[REPEAT_MAX_READY];
+        int ready_head_ = 0;
+        int ready_count_ = 0;
+    };
+
+    RepeatScheduler &repeat_scheduler();
+}
+
+#endif
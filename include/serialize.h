@@ -0,0 +1,57 @@
+#ifndef SERIALIZE_H_
+#define SERIALIZE_H_
+
+#include <stdint.h>
+#include <string>
+#include <string_view>
+
+namespace fex
+{
+    // Little endian values appended to a byte string
+    class ByteWriter
+    {
+    public:
+        void U8(uint8_t value) { data_.push_back(value); }
+        void U16(uint16_t value);
+        void U32(uint32_t value);
+        void String(std::string_view value);
+
+        const std::string &data() const { return data_; }
+
+    private:
+        std::string data_;
+    };
+
+    // Reads back what ByteWriter wrote. Reading past the end returns zeros and
+    // marks the reader failed, so callers only need to check failed() once.
+    class ByteReader
+    {
+    public:
+        ByteReader(std::string_view data) : data_(data) {}
+
+        uint8_t U8();
+        uint16_t U16();
+        uint32_t U32();
+        std::string String();
+        std::string_view View(); // Reads a String without copying it out of data
+
+        bool failed() const { return failed_; }
+        bool done() const { return offset_ == data_.size(); }
+        std::string_view rest() const { return data_.substr(offset_); }
+
+    private:
+        const uint8_t *Take(size_t length);
+
+        std::string_view data_;
+        size_t offset_ = 0;
+        bool failed_ = false;
+    };
+
+    // 32 bit FNV-1a, pass the previous result as hash to continue it over more data
+    uint32_t hash_bytes(std::string_view data, uint32_t hash = 2166136261u);
+
+    // IEEE CRC-32, as used by zlib
+    uint32_t crc32(std::string_view data);
+}
+
+#endif
@@ -0,0 +1,50 @@
+#ifndef TELEMETRY_H_
+#define TELEMETRY_H_
+
+#include <atomic>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "FreeRTOS.h"
+#include "semphr.h"
+
+#include "combo.h"
+#include "filesystem.h"
+
+#define TELEMETRY_LATENCY_BUCKETS 6 // 0, 1, 2-3, 4-7, 8-15 and 16+ ms
+
+namespace fex
+{
+    // Counters published in the virtual files on the drive (see virtual_files.h),
+    // recorded from any task
+    class Telemetry
+    {
+    public:
+        // Reserves STATS.TXT and LAYERS.TXT, with the filesystem mounted and
+        // before the host can see it
+        void Publish(Filesystem &fs);
+
+        // Process keys task
+        void CountPress(int key);
+        void RecordLatency(uint32_t ms); // From the keys being polled to being processed
+
+        void ClearParseErrors();
+        void AddParseError(const std::string &error);
+
+        // Contents of STATS.TXT and LAYERS.TXT as of now
+        std::string Stats();
+        std::string Layers();
+
+    private:
+        std::atomic<uint32_t> presses_[KEY_MASK_BITS] = {};
+        std::atomic<uint32_t> latency_[TELEMETRY_LATENCY_BUCKETS] = {};
+
+        SemaphoreHandle_t mutex_ = xSemaphoreCreateMutex(); // Guards parse_errors_
+        std::vector<std::string> parse_errors_;
+    };
+
+    Telemetry &telemetry();
+}
+
+#endif
@@ -1,6 +1,15 @@
 #ifndef TOKENIZER_H
 #define TOKENIZER_H
 
+#include <functional>
+#include <memory_resource>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#define TOKEN_STREAM_CHUNK 256
+#define TOKEN_LOOKAHEAD 24 // Longest multi-word keyword tail, plus the boundary
+
 namespace fex
 {
 
@@ -63,6 +72,12 @@ namespace fex
         PARAMETER_TIME_MIN,
         TOP_OTHER_KEYS_FALL_THROUGH,
         TOP_BLOCK_OTHER_KEYS,
+        TOP_COMBO_WINDOW,
+        ACTION_LEADER,
+        TOP_LEADER_SEQUENCE,
+        ACTION_ONE_SHOT,
+        PARAMETER_AFTER,
+        PARAMETER_EVERY,
     };
 
     struct Token
@@ -73,14 +88,96 @@ namespace fex
         int line_number;
     };
 
-    std::string TokenStr(const std::string &source, const Token &token);
-    std::string TokenRunStr(const std::string &source, const Token& start, const Token& end);
+    // Non-owning run of tokens, the token vector must outlive it
+    class TokenSpan
+    {
+    public:
+        TokenSpan() {}
+        TokenSpan(const Token *begin, const Token *end) : begin_(begin), end_(end) {}
+        TokenSpan(const std::vector<Token> &tokens) : begin_(tokens.data()), end_(tokens.data() + tokens.size()) {}
+        TokenSpan(const std::pmr::vector<Token> &tokens) : begin_(tokens.data()), end_(tokens.data() + tokens.size()) {}
+
+        const Token *begin() const { return begin_; }
+        const Token *end() const { return end_; }
+        size_t size() const { return end_ - begin_; }
+        bool empty() const { return begin_ == end_; }
+
+        const Token &operator[](size_t index) const { return begin_[index]; }
+        const Token &back() const { return *(end_ - 1); }
+
+        TokenSpan from(size_t index) const { return {begin_ + index, end_}; }
+
+    private:
+        const Token *begin_ = nullptr;
+        const Token *end_ = nullptr;
+    };
+
+    // Views into source, source must outlive them
+    std::string_view TokenStr(std::string_view source, const Token &token);
+    std::string_view TokenRunStr(std::string_view source, const Token& start, const Token& end);
 
     // TODO(fex): move to utils class
     std::string errmsg(const std::string &message, int line_number);
-    std::string to_lower(const std::string &s);
+    bool iequals(std::string_view a, std::string_view b);
+    unsigned long to_ulong(std::string_view s, int base = 10);
+
+    // Lookup tables are binary searched by name
+    template <typename T, size_t N>
+    constexpr bool sorted_by_name(const T (&table)[N])
+    {
+        for (size_t i = 1; i < N; i++)
+        {
+            if (table[i].name < table[i - 1].name)
+            {
+                return false;
+            }
+        }
+        return true;
+    }
 
-    std::pair<std::string, std::vector<Token>> tokenize(const std::string &source);
+    std::pair<std::string, std::pmr::vector<Token>> tokenize(
+        std::string_view source, std::pmr::memory_resource *memory = std::pmr::get_default_resource());
+
+    // Tokenizes a source read a chunk at a time, only text that hasn't been
+    // released is held. Token starts are offsets into the whole source.
+    class TokenStream
+    {
+    public:
+        // Fills buffer with up to size bytes of the source, 0 at the end
+        typedef std::function<size_t(char *buffer, size_t size)> Read;
+
+        explicit TokenStream(Read read, std::pmr::memory_resource *memory = std::pmr::get_default_resource())
+            : read_(std::move(read)), buffer_(memory) {}
+
+        // Tokenizes source in place, it must outlive the stream
+        explicit TokenStream(std::string_view source) : source_(source), eof_(true) {}
+
+        // False at the end of the source or on error
+        bool Next(Token *token);
+        const std::string &error() const { return error_; }
+
+        // Text from start (an offset into the source), valid until the next call to Next
+        std::string_view Text(int start, int length) const;
+
+        // Text before offset is no longer needed
+        void Release(int offset);
+
+    private:
+        bool Fill();
+
+        // Text read so far, or the whole source when it was given up front
+        std::string_view text() const { return read_ ? std::string_view(buffer_) : source_; }
+
+        Read read_;
+        std::pmr::string buffer_; // Source text from base_ onwards
+        std::string_view source_;
+        int base_ = 0;
+        int released_ = 0;
+        int index_ = 0;
+        int line_number_ = 1;
+        bool eof_ = false;
+        std::string error_;
+    };
 
 }
 
@@ -0,0 +1,28 @@
+#ifndef VIRTUAL_FILES_H_
+#define VIRTUAL_FILES_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#define VIRTUAL_FILE_SIZE 4096 // One sector, the text is padded out with spaces
+
+    // STATS.TXT and LAYERS.TXT on the drive are generated whenever the host
+    // reads them, nothing is written to flash. USB device task only.
+
+    // Fills buffer if lba is a virtual file's sector, false otherwise
+    bool virtual_file_read(uint32_t lba, uint32_t offset, void *buffer, uint32_t bufsize);
+
+    // The host wrote to lba. A virtual file there is deleted or overwritten,
+    // and its sector is served from flash from now on.
+    void virtual_file_written(uint32_t lba);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -7,10 +7,24 @@
 #include "FreeRTOS.h"
 #include "queue.h"
 
+#include "layer.h"
+#include "leader.h"
 #include "queue_message.h"
+#include "repeat.h"
 
 namespace fex
 {
+        static uint8_t ascii_keycode(char c)
+        {
+                // TODO(fex): This is a really bad hack for this
+                return 0x04 + (std::toupper(c) - 'A');
+        }
+
+        static bool is_modifier(int code)
+        {
+                // Left Control (0xe0) through Right GUI (0xe7)
+                return code >= 0xe0 && code <= 0xe7;
+        }
 
         void GenericKeyAction::Print() const
         {
@@ -52,6 +66,17 @@ namespace fex
                 xQueueSend(queue, (void *)&msg, 10);
         }
 
+        bool GenericKeyAction::KeyCode(int *code) const
+        {
+                if (keycodes_.size() != 1)
+                {
+                        return false;
+                }
+
+                *code = keycodes_[0];
+                return true;
+        }
+
         bool GenericKeyAction::operator==(const BoundAction &other)
         {
                 if (other.type() != BoundActionType::GENERIC_KEY_ACTION)
@@ -63,6 +88,16 @@ namespace fex
                 return keycodes() == o->keycodes();
         }
 
+        void GenericKeyAction::Serialize(ByteWriter *out) const
+        {
+                BoundAction::Serialize(out);
+                out->U16(keycodes_.size());
+                for (int code : keycodes_)
+                {
+                        out->U16(code);
+                }
+        }
+
         void PressKeyAction::Print() const
         {
                 printf("PressKeyAction\n");
@@ -141,6 +176,108 @@ namespace fex
                 return keycodes() == o->keycodes();
         }
 
+        RepeatingKeyAction::RepeatingKeyAction(std::vector<int> keycodes, unsigned long repeat_delay, unsigned long repeat_rate)
+            : GenericKeyAction(std::move(keycodes)), repeat_delay_(repeat_delay), repeat_rate_(repeat_rate)
+        {
+                type_ = BoundActionType::REPEATING_KEY_ACTION;
+
+                // Modifiers stay held, each repeat releases and presses the rest
+                for (int code : keycodes_)
+                {
+                        if (!is_modifier(code))
+                        {
+                                program_.push_back({{(uint8_t)code, false}, 0});
+                        }
+                }
+                for (int code : keycodes_)
+                {
+                        if (!is_modifier(code))
+                        {
+                                program_.push_back({{(uint8_t)code, true}, 0});
+                        }
+                }
+
+                if (!program_.empty())
+                {
+                        program_.back().wait = repeat_rate_;
+                }
+        }
+
+        void RepeatingKeyAction::Print() const
+        {
+                printf("RepeatingKeyAction: after %lums every %lums\n", repeat_delay_, repeat_rate_);
+        }
+
+        void RepeatingKeyAction::Enqueue(BoundActionEnqueue action, QueueHandle_t queue)
+        {
+                EnqueueFor(-1, action, queue);
+        }
+
+        void RepeatingKeyAction::EnqueueFor(int key, BoundActionEnqueue action, QueueHandle_t queue)
+        {
+                if (action == BoundActionEnqueue::DO)
+                {
+                        GenericKeyAction::Enqueue(action, queue);
+                        repeat_scheduler().Start(this, key, &program_, repeat_delay_, repeat_rate_);
+                }
+                else
+                {
+                        repeat_scheduler().Stop(this, key, false);
+                        GenericKeyAction::Enqueue(action, queue);
+                }
+        }
+
+        bool RepeatingKeyAction::operator==(const BoundAction &other)
+        {
+                if (other.type() != BoundActionType::REPEATING_KEY_ACTION)
+                {
+                        return false;
+                }
+
+                const RepeatingKeyAction *o = static_cast<const RepeatingKeyAction *>(&other);
+                return keycodes() == o->keycodes() && repeat_delay() == o->repeat_delay() && repeat_rate() == o->repeat_rate();
+        }
+
+        void RepeatingKeyAction::Serialize(ByteWriter *out) const
+        {
+                GenericKeyAction::Serialize(out);
+                out->U32(repeat_delay_);
+                out->U32(repeat_rate_);
+        }
+
+        void OneShotModifierAction::Print() const
+        {
+                printf("OneShotModifierAction\n");
+        }
+
+        void OneShotModifierAction::Enqueue(BoundActionEnqueue action, QueueHandle_t queue)
+        {
+                if (action == BoundActionEnqueue::DO)
+                {
+                        QueueMessage msg;
+
+                        msg.type = MessageType::ONE_SHOT_MODIFIER;
+                        for (int i = 0; i < KEY_ROLL_OVER; i++)
+                        {
+                                msg.codes[i] = (i < keycodes_.size()) ? keycodes_[i] : 0;
+                        }
+                        msg.length = (keycodes_.size() > KEY_ROLL_OVER) ? KEY_ROLL_OVER : keycodes_.size();
+
+                        xQueueSend(queue, (void *)&msg, 10);
+                }
+        }
+
+        bool OneShotModifierAction::operator==(const BoundAction &other)
+        {
+                if (other.type() != BoundActionType::ONE_SHOT_MODIFIER_ACTION)
+                {
+                        return false;
+                }
+
+                const OneShotModifierAction *o = static_cast<const OneShotModifierAction *>(&other);
+                return keycodes() == o->keycodes();
+        }
+
         void SequenceAction::Print() const
         {
                 printf("SequenceAction(%d):\n", type_);
@@ -191,6 +328,24 @@ namespace fex
                 return true;
         }
 
+        void SequenceAction::Serialize(ByteWriter *out) const
+        {
+                BoundAction::Serialize(out);
+                out->U16(sequence_.size());
+                for (const auto &action : sequence_)
+                {
+                        action->Serialize(out);
+                }
+        }
+
+        void SequenceAction::References(std::vector<std::string> *layers) const
+        {
+                for (const auto &action : sequence_)
+                {
+                        action->References(layers);
+                }
+        }
+
         void DelayAction::Print() const
         {
                 printf("DelayAction\n");
@@ -219,6 +374,12 @@ namespace fex
                 return duration() == o->duration();
         }
 
+        void DelayAction::Serialize(ByteWriter *out) const
+        {
+                BoundAction::Serialize(out);
+                out->U32(duration_);
+        }
+
         void GenericLayerAction::Print() const
         {
                 printf("GenericLayerAction\n");
@@ -239,6 +400,12 @@ namespace fex
                 return target_layer() == o->target_layer();
         }
 
+        void GenericLayerAction::Serialize(ByteWriter *out) const
+        {
+                BoundAction::Serialize(out);
+                out->String(target_layer_);
+        }
+
         void SwitchToLayerAction::Print() const
         {
                 printf("SwitchToLayerAction: %s\n", target_layer_.c_str());
@@ -249,11 +416,7 @@ namespace fex
                 if (action == BoundActionEnqueue::DO)
                 {
                         printf("Switch to: %s\n", target_layer_.c_str());
-                        QueueMessage msg;
-
-                        msg.type = MessageType::LAYER_SWITCH;
-                        msg.layer = std::hash<std::string>()(target_layer_);
-                        xQueueSend(queue, (void *)&msg, 10);
+                        layer_state().Switch(target_id_);
                 }
         }
 
@@ -328,6 +491,53 @@ namespace fex
                 return target_layer() == o->target_layer();
         }
 
+        void OneShotLayerAction::Print() const
+        {
+                printf("OneShotLayerAction: %s\n", target_layer_.c_str());
+        }
+
+        void OneShotLayerAction::Enqueue(BoundActionEnqueue action, QueueHandle_t queue)
+        {
+                if (action == BoundActionEnqueue::DO)
+                {
+                        one_shot_layer().Arm(target_id_);
+                }
+        }
+
+        bool OneShotLayerAction::operator==(const BoundAction &other)
+        {
+                if (other.type() != BoundActionType::ONE_SHOT_LAYER_ACTION)
+                {
+                        return false;
+                }
+
+                const OneShotLayerAction *o = static_cast<const OneShotLayerAction *>(&other);
+                return target_layer() == o->target_layer();
+        }
+
+        StringTyperAction::StringTyperAction(std::string payload, unsigned long keystroke_delay, unsigned long repeat_delay, unsigned long repeat_rate)
+            : payload_(payload), keystroke_delay_(keystroke_delay), repeat_delay_(repeat_delay), repeat_rate_(repeat_rate)
+        {
+                type_ = BoundActionType::STRING_TYPER_ACTION;
+
+                if (repeat_rate_ == 0)
+                {
+                        return;
+                }
+
+                // Precompute the reports for one pass, the scheduler loops it while held
+                for (const char c : payload_)
+                {
+                        program_.push_back({{ascii_keycode(c), true}, 0});
+                        program_.push_back({{ascii_keycode(c), false}, keystroke_delay_});
+                }
+
+                if (!program_.empty())
+                {
+                        program_.back().wait = repeat_rate_;
+                }
+        }
+
         void StringTyperAction::Print() const
         {
                 printf("StringTyperAction\n");
@@ -335,6 +545,43 @@ namespace fex
 
         void StringTyperAction::Enqueue(BoundActionEnqueue action, QueueHandle_t queue)
         {
+                EnqueueFor(-1, action, queue);
+        }
+
+        void StringTyperAction::EnqueueFor(int key, BoundActionEnqueue action, QueueHandle_t queue)
+        {
+                // The first pass is always typed in full, even on a quick tap
+                if (action == BoundActionEnqueue::DO)
+                {
+                        repeat_scheduler().Start(this, key, &program_, 0, repeat_delay_);
+                }
+                else
+                {
+                        repeat_scheduler().Stop(this, key, true);
+                }
+        }
+
+        void StringTyperAction::Type(QueueHandle_t queue) const
+        {
+                QueueMessage msg;
+                for (const char c : payload_)
+                {
+                        unsigned char x = ascii_keycode(c);
+
+                        msg.type = MessageType::PRESS;
+                        msg.codes[0] = x;
+                        msg.length = 1;
+                        xQueueSend(queue, (void *)&msg, 10);
+
+                        msg.type = MessageType::RELEASE;
+                        msg.codes[0] = x;
+                        msg.length = 1;
+                        xQueueSend(queue, (void *)&msg, 10);
+
+                        msg.type = MessageType::DELAY;
+                        msg.delay = keystroke_delay_;
+                        xQueueSend(queue, (void *)&msg, 10);
+                }
         }
 
         bool StringTyperAction::operator==(const BoundAction &other)
@@ -345,7 +592,16 @@ namespace fex
                 }
 
                 const StringTyperAction *o = static_cast<const StringTyperAction *>(&other);
-                return payload() == o->payload() && keystroke_delay() == o->keystroke_delay() && repeat_delay() == o->repeat_delay();
+                return payload() == o->payload() && keystroke_delay() == o->keystroke_delay() && repeat_delay() == o->repeat_delay() && repeat_rate() == o->repeat_rate();
+        }
+
+        void StringTyperAction::Serialize(ByteWriter *out) const
+        {
+                BoundAction::Serialize(out);
+                out->String(payload_);
+                out->U32(keystroke_delay_);
+                out->U32(repeat_delay_);
+                out->U32(repeat_rate_);
         }
 
         void NonRepeatingStringTyperAction::Print() const
@@ -357,26 +613,7 @@ namespace fex
         {
                 if (action == BoundActionEnqueue::DO)
                 {
-                        QueueMessage msg;
-                        for (const char c : payload_)
-                        {
-                                // TODO(fex): This is a really bad hack for this
-                                unsigned char x = 0x04 + (std::toupper(c) - 'A');
-
-                                msg.type = MessageType::PRESS;
-                                msg.codes[0] = x;
-                                msg.length = 1;
-                                xQueueSend(queue, (void *)&msg, 10);
-
-                                msg.type = MessageType::RELEASE;
-                                msg.codes[0] = x;
-                                msg.length = 1;
-                                xQueueSend(queue, (void *)&msg, 10);
-
-                                msg.type = MessageType::DELAY;
-                                msg.delay = keystroke_delay_;
-                                xQueueSend(queue, (void *)&msg, 10);
-                        }
+                        Type(queue);
                 }
         }
 
@@ -388,7 +625,7 @@ namespace fex
                 }
 
                 const NonRepeatingStringTyperAction *o = static_cast<const NonRepeatingStringTyperAction *>(&other);
-                return payload() == o->payload() && keystroke_delay() == o->keystroke_delay() && repeat_delay() == o->repeat_delay();
+                return payload() == o->payload() && keystroke_delay() == o->keystroke_delay() && repeat_delay() == o->repeat_delay() && repeat_rate() == o->repeat_rate();
         }
 
         void ResetKeebAction::Print() const
@@ -480,6 +717,12 @@ namespace fex
 
         void ReloadKeymapAction::Enqueue(BoundActionEnqueue action, QueueHandle_t queue)
         {
+                if (action == BoundActionEnqueue::DO)
+                {
+                        QueueMessage msg;
+                        msg.type = MessageType::RELOAD_KEYMAPS;
+                        xQueueSend(queue, (void *)&msg, 10);
+                }
         }
 
         bool ReloadKeymapAction::operator==(const BoundAction &other)
@@ -487,6 +730,24 @@ namespace fex
                 return other.type() == BoundActionType::RELOAD_KEYMAP_ACTION;
         }
 
+        void LeaderAction::Print() const
+        {
+                printf("LeaderAction\n");
+        }
+
+        void LeaderAction::Enqueue(BoundActionEnqueue action, QueueHandle_t queue)
+        {
+                if (action == BoundActionEnqueue::DO)
+                {
+                        leader_engine().Begin();
+                }
+        }
+
+        bool LeaderAction::operator==(const BoundAction &other)
+        {
+                return other.type() == BoundActionType::LEADER_ACTION;
+        }
+
         void GenericMouseAction::Print() const
         {
                 printf("GenericMouseAction: up_down: %d speed: %d\n", up_down_, speed_);
@@ -507,6 +768,13 @@ namespace fex
                 return up_down() == o->up_down() && speed() == o->speed();
         }
 
+        void GenericMouseAction::Serialize(ByteWriter *out) const
+        {
+                BoundAction::Serialize(out);
+                out->U8(up_down_);
+                out->U8(speed_);
+        }
+
         void MouseScrollAction::Print() const
         {
                 printf("MouseScrollAction: up_down: %d speed: %d\n", up_down_, speed_);
@@ -584,4 +852,234 @@ namespace fex
                 const MouseClickAction *o = static_cast<const MouseClickAction *>(&other);
                 return button() == o->button();
         }
-}
\ No newline at end of file
+
+        void MouseClickAction::Serialize(ByteWriter *out) const
+        {
+                BoundAction::Serialize(out);
+                out->U8(button_);
+        }
+
+        static std::vector<int> read_keycodes(ByteReader *in)
+        {
+                std::vector<int> keycodes(in->U16());
+                for (int &code : keycodes)
+                {
+                        code = in->U16();
+                }
+                return keycodes;
+        }
+
+        std::unique_ptr<BoundAction> DeserializeAction(ByteReader *in)
+        {
+                std::unique_ptr<BoundAction> action;
+
+                BoundActionType type = (BoundActionType)in->U8();
+                switch (type)
+                {
+                case BoundActionType::GENERIC_KEY_ACTION:
+                        action = std::make_unique<GenericKeyAction>(read_keycodes(in));
+                        break;
+                case BoundActionType::PRESS_KEY_ACTION:
+                        action = std::make_unique<PressKeyAction>(read_keycodes(in));
+                        break;
+                case BoundActionType::RELEASE_KEY_ACTION:
+                        action = std::make_unique<ReleaseKeyAction>(read_keycodes(in));
+                        break;
+                case BoundActionType::CLICK_KEY_ACTION:
+                        action = std::make_unique<ClickKeyAction>(read_keycodes(in));
+                        break;
+                case BoundActionType::ONE_SHOT_MODIFIER_ACTION:
+                        action = std::make_unique<OneShotModifierAction>(read_keycodes(in));
+                        break;
+                case BoundActionType::REPEATING_KEY_ACTION:
+                {
+                        std::vector<int> keycodes = read_keycodes(in);
+                        unsigned long repeat_delay = in->U32();
+                        unsigned long repeat_rate = in->U32();
+                        action = std::make_unique<RepeatingKeyAction>(std::move(keycodes), repeat_delay, repeat_rate);
+                        break;
+                }
+                case BoundActionType::SEQUENCE_ACTION:
+                {
+                        std::vector<std::unique_ptr<BoundAction>> sequence(in->U16());
+                        for (auto &step : sequence)
+                        {
+                                step = DeserializeAction(in);
+                                if (!step)
+                                {
+                                        return nullptr;
+                                }
+                        }
+                        action = std::make_unique<SequenceAction>(std::move(sequence));
+                        break;
+                }
+                case BoundActionType::DELAY_ACTION:
+                        action = std::make_unique<DelayAction>(in->U32());
+                        break;
+                case BoundActionType::SWITCH_TO_LAYER_ACTION:
+                        action = std::make_unique<SwitchToLayerAction>(in->String());
+                        break;
+                case BoundActionType::TEMPORARY_LAYER_ACTION:
+                        action = std::make_unique<TemporaryLayerAction>(in->String());
+                        break;
+                case BoundActionType::LEAVE_LAYER_ACTION:
+                        action = std::make_unique<LeaveLayerAction>(in->String());
+                        break;
+                case BoundActionType::TOGGLE_LAYER_ACTION:
+                        action = std::make_unique<ToggleLayerAction>(in->String());
+                        break;
+                case BoundActionType::ONE_SHOT_LAYER_ACTION:
+                        action = std::make_unique<OneShotLayerAction>(in->String());
+                        break;
+                case BoundActionType::STRING_TYPER_ACTION:
+                case BoundActionType::NON_REPEATING_STRING_TYPER_ACTION:
+                {
+                        std::string payload = in->String();
+                        unsigned long keystroke_delay = in->U32();
+                        unsigned long repeat_delay = in->U32();
+                        unsigned long repeat_rate = in->U32();
+                        if (type == BoundActionType::NON_REPEATING_STRING_TYPER_ACTION)
+                        {
+                                action = std::make_unique<NonRepeatingStringTyperAction>(std::move(payload), keystroke_delay);
+                        }
+                        else
+                        {
+                                action = std::make_unique<StringTyperAction>(std::move(payload), keystroke_delay, repeat_delay, repeat_rate);
+                        }
+                        break;
+                }
+                case BoundActionType::RESET_KEEB_ACTION:
+                        action = std::make_unique<ResetKeebAction>();
+                        break;
+                case BoundActionType::KEEB_BOOTLOADER_ACTION:
+                        action = std::make_unique<KeebBootloaderAction>();
+                        break;
+                case BoundActionType::RESET_LAYER_ACTION:
+                        action = std::make_unique<ResetLayerAction>();
+                        break;
+                case BoundActionType::NOTHINGBURGER_ACTION:
+                        action = std::make_unique<NothingburgerAction>();
+                        break;
+                case BoundActionType::PASS_THROUGH_ACTION:
+                        action = std::make_unique<PassThroughAction>();
+                        break;
+                case BoundActionType::RELOAD_KEYMAP_ACTION:
+                        action = std::make_unique<ReloadKeymapAction>();
+                        break;
+                case BoundActionType::LEADER_ACTION:
+                        action = std::make_unique<LeaderAction>();
+                        break;
+                case BoundActionType::MOUSE_SCROLL_ACTION:
+                case BoundActionType::MOUSE_MOVE_ACTION:
+                {
+                        bool up_down = in->U8();
+                        int8_t speed = in->U8();
+                        if (type == BoundActionType::MOUSE_SCROLL_ACTION)
+                        {
+                                action = std::make_unique<MouseScrollAction>(up_down, speed);
+                        }
+                        else
+                        {
+                                action = std::make_unique<MouseMoveAction>(up_down, speed);
+                        }
+                        break;
+                }
+                case BoundActionType::MOUSE_CLICK_ACTION:
+                        action = std::make_unique<MouseClickAction>(in->U8());
+                        break;
+                default:
+                        // The generic base actions are never bound
+                        return nullptr;
+                }
+
+                if (in->failed())
+                {
+                        return nullptr;
+                }
+                return action;
+        }
+
+        void ActionPool::Initialize()
+        {
+                mutex_ = xSemaphoreCreateMutex();
+                if (mutex_ == NULL)
+                {
+                        printf("---- FAILED TO CREATE ACTION POOL MUTEX ----\n");
+                }
+        }
+
+        BoundAction *ActionPool::Intern(std::unique_ptr<BoundAction> action)
+        {
+                ByteWriter serialized;
+                action->Serialize(&serialized);
+                uint32_t hash = hash_bytes(serialized.data());
+
+                if (mutex_ != NULL)
+                {
+                        xSemaphoreTake(mutex_, portMAX_DELAY);
+                }
+
+                BoundAction *pooled = nullptr;
+                std::vector<std::unique_ptr<BoundAction>> &bucket = actions_[hash];
+                for (const std::unique_ptr<BoundAction> &candidate : bucket)
+                {
+                        if (*candidate == *action)
+                        {
+                                pooled = candidate.get();
+                                break;
+                        }
+                }
+
+                if (!pooled)
+                {
+                        pooled = action.get();
+                        bucket.push_back(std::move(action));
+                        size_++;
+                }
+
+                if (mutex_ != NULL)
+                {
+                        xSemaphoreGive(mutex_);
+                }
+                return pooled;
+        }
+
+        size_t ActionPool::Retain(const std::unordered_set<const BoundAction *> &live)
+        {
+                if (mutex_ != NULL)
+                {
+                        xSemaphoreTake(mutex_, portMAX_DELAY);
+                }
+
+                size_t freed = 0;
+                for (auto it = actions_.begin(); it != actions_.end();)
+                {
+                        std::vector<std::unique_ptr<BoundAction>> &bucket = it->second;
+                        for (size_t i = 0; i < bucket.size();)
+                        {
+                                if (live.count(bucket[i].get()))
+                                {
+                                        i++;
+                                        continue;
+                                }
+                                bucket[i] = std::move(bucket.back());
+                                bucket.pop_back();
+                                freed++;
+                        }
+                        it = bucket.empty() ? actions_.erase(it) : std::next(it);
+                }
+                size_ -= freed;
+
+                if (mutex_ != NULL)
+                {
+                        xSemaphoreGive(mutex_);
+                }
+                return freed;
+        }
+
+        ActionPool &action_pool()
+        {
+                static ActionPool pool;
+                return pool;
+        }
+}
@@ -0,0 +1,33 @@
+#include "arena.h"
+
+#include <algorithm>
+#include <stdint.h>
+
+namespace fex
+{
+    void *Arena::do_allocate(size_t bytes, size_t alignment)
+    {
+        uintptr_t base = (uintptr_t)buffer_;
+        size_t start = ((base + used_ + alignment - 1) & ~(alignment - 1)) - base;
+        if (start + bytes <= size_)
+        {
+            used_ = start + bytes;
+            peak_ = std::max(peak_, used_);
+            return buffer_ + start;
+        }
+
+        spilled_ += bytes;
+        return std::pmr::new_delete_resource()->allocate(bytes, alignment);
+    }
+
+    void Arena::do_deallocate(void *p, size_t bytes, size_t alignment)
+    {
+        // Buffer memory comes back with Rewind or Reset
+        if ((char *)p >= buffer_ && (char *)p < buffer_ + size_)
+        {
+            return;
+        }
+
+        std::pmr::new_delete_resource()->deallocate(p, bytes, alignment);
+    }
+}
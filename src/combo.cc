@@ -0,0 +1,292 @@
+#include "combo.h"
+
+#include <stdio.h>
+
+namespace fex
+{
+    void ComboSet::Add(const KeyMask &keys, std::unique_ptr<BoundAction> action)
+    {
+        combos_.push_back({keys, action_pool().Intern(std::move(action))});
+    }
+
+    void ComboSet::Build()
+    {
+        offsets_.assign(KEY_MASK_BITS + 1, 0);
+        index_.clear();
+
+        if (combos_.empty())
+        {
+            return;
+        }
+
+        // Counting sort combos into per key buckets
+        for (const Combo &combo : combos_)
+        {
+            for (int key = 0; key < KEY_MASK_BITS; key++)
+            {
+                if (combo.keys.Test(key))
+                {
+                    offsets_[key + 1]++;
+                }
+            }
+        }
+
+        for (int key = 0; key < KEY_MASK_BITS; key++)
+        {
+            offsets_[key + 1] += offsets_[key];
+        }
+
+        index_.resize(offsets_[KEY_MASK_BITS]);
+        std::vector<uint16_t> fill(offsets_.begin(), offsets_.end() - 1);
+        for (uint16_t i = 0; i < combos_.size(); i++)
+        {
+            for (int key = 0; key < KEY_MASK_BITS; key++)
+            {
+                if (combos_[i].keys.Test(key))
+                {
+                    index_[fill[key]++] = i;
+                }
+            }
+        }
+    }
+
+    void ComboSet::Serialize(ByteWriter *out) const
+    {
+        out->U16(combos_.size());
+        for (const Combo &combo : combos_)
+        {
+            for (uint32_t word : combo.keys.words)
+            {
+                out->U32(word);
+            }
+            combo.action->Serialize(out);
+        }
+    }
+
+    bool ComboSet::Deserialize(ByteReader *in)
+    {
+        uint16_t count = in->U16();
+        for (uint16_t i = 0; i < count; i++)
+        {
+            KeyMask keys;
+            for (uint32_t &word : keys.words)
+            {
+                word = in->U32();
+            }
+
+            std::unique_ptr<BoundAction> action = DeserializeAction(in);
+            if (!action)
+            {
+                return false;
+            }
+            Add(keys, std::move(action));
+        }
+
+        Build();
+        return !in->failed();
+    }
+
+    void ComboEngine::Process(const ComboSet &combos, const KeyEvent &event, QueueHandle_t queue)
+    {
+        if (event.key < 0 || event.key >= KEY_MASK_BITS)
+        {
+            if (event.pressed)
+            {
+                Resolve(combos, queue);
+            }
+            Emit(event);
+            return;
+        }
+
+        if (!event.pressed)
+        {
+            if (consumed_.Test(event.key))
+            {
+                consumed_.Clear(event.key);
+                for (ActiveCombo &active : active_)
+                {
+                    if (!active.action || !active.held.Test(event.key))
+                    {
+                        continue;
+                    }
+
+                    // Releasing any key of the combo releases the combo
+                    if (!active.released)
+                    {
+                        active.action->EnqueueFor(active.key, BoundActionEnqueue::UNDO, queue);
+                        active.released = true;
+                    }
+
+                    active.held.Clear(event.key);
+                    if (active.held.Empty())
+                    {
+                        active.action = nullptr;
+                    }
+                    break;
+                }
+                return;
+            }
+
+            if (pending_count_ > 0 && pending_mask_.Test(event.key))
+            {
+                Resolve(combos, queue);
+                if (consumed_.Test(event.key))
+                {
+                    Process(combos, event, queue);
+                    return;
+                }
+            }
+
+            Emit(event);
+            return;
+        }
+
+        if (!combos.Involves(event.key))
+        {
+            Resolve(combos, queue);
+            Emit(event);
+            return;
+        }
+
+        KeyMask next = pending_mask_;
+        next.Set(event.key);
+
+        if (pending_count_ == COMBO_MAX_KEYS || !Superset(combos, next, event.key, false))
+        {
+            Resolve(combos, queue);
+            next = KeyMask();
+            next.Set(event.key);
+        }
+
+        pending_[pending_count_++] = event;
+        pending_mask_ = next;
+
+        // Fire as soon as the combo is unambiguous rather than waiting out the window
+        const Combo *exact = Exact(combos, pending_mask_, event.key);
+        if (exact && !Superset(combos, pending_mask_, event.key, true))
+        {
+            Fire(*exact, queue);
+        }
+    }
+
+    void ComboEngine::Tick(const ComboSet &combos, TickType_t now, TickType_t window, QueueHandle_t queue)
+    {
+        if (pending_count_ > 0 && now - pending_[0].time >= window)
+        {
+            Resolve(combos, queue);
+        }
+    }
+
+    bool ComboEngine::Next(KeyEvent *event)
+    {
+        if (ready_count_ == 0)
+        {
+            return false;
+        }
+
+        *event = ready_[ready_head_];
+        ready_head_ = (ready_head_ + 1) % (COMBO_MAX_KEYS * 2);
+        ready_count_--;
+        return true;
+    }
+
+    void ComboEngine::Resolve(const ComboSet &combos, QueueHandle_t queue)
+    {
+        if (pending_count_ == 0)
+        {
+            return;
+        }
+
+        const Combo *exact = Exact(combos, pending_mask_, pending_[0].key);
+        if (exact)
+        {
+            Fire(*exact, queue);
+            return;
+        }
+
+        // Not a combo after all, let the keys through in the order they were pressed
+        for (int i = 0; i < pending_count_; i++)
+        {
+            Emit(pending_[i]);
+        }
+
+        pending_count_ = 0;
+        pending_mask_ = KeyMask();
+    }
+
+    void ComboEngine::Fire(const Combo &combo, QueueHandle_t queue)
+    {
+        ActiveCombo *slot = nullptr;
+        for (ActiveCombo &active : active_)
+        {
+            if (!active.action)
+            {
+                slot = &active;
+                break;
+            }
+        }
+
+        // With nowhere to track the release the keys go through as themselves
+        if (!slot)
+        {
+            for (int i = 0; i < pending_count_; i++)
+            {
+                Emit(pending_[i]);
+            }
+
+            pending_count_ = 0;
+            pending_mask_ = KeyMask();
+            return;
+        }
+
+        *slot = {combo.action, pending_[0].key, pending_mask_, false};
+        combo.action->EnqueueFor(pending_[0].key, BoundActionEnqueue::DO, queue);
+
+        for (int i = 0; i < pending_count_; i++)
+        {
+            consumed_.Set(pending_[i].key);
+        }
+
+        pending_count_ = 0;
+        pending_mask_ = KeyMask();
+    }
+
+    void ComboEngine::Emit(const KeyEvent &event)
+    {
+        if (ready_count_ == COMBO_MAX_KEYS * 2)
+        {
+            printf("combo: dropped key event\n");
+            return;
+        }
+
+        ready_[(ready_head_ + ready_count_) % (COMBO_MAX_KEYS * 2)] = event;
+        ready_count_++;
+    }
+
+    const Combo *ComboEngine::Exact(const ComboSet &combos, const KeyMask &keys, int key) const
+    {
+        for (int i = 0; i < combos.CandidateCount(key); i++)
+        {
+            const Combo &combo = combos.Candidate(key, i);
+            if (combo.keys == keys)
+            {
+                return &combo;
+            }
+        }
+        return nullptr;
+    }
+
+    bool ComboEngine::Superset(const ComboSet &combos, const KeyMask &keys, int key, bool strict) const
+    {
+        // Any combo containing all of keys must contain key, so only its bucket is checked
+        for (int i = 0; i < combos.CandidateCount(key); i++)
+        {
+            const Combo &combo = combos.Candidate(key, i);
+            if (keys.SubsetOf(combo.keys) && !(strict && combo.keys == keys))
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+}
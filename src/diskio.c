@@ -94,7 +94,7 @@ DRESULT disk_ioctl(
     if (cmd == GET_SECTOR_COUNT)
     {
         DWORD *v = (DWORD *)buff;
-        *v = FATFS_SIZE / SECTOR_SIZE;
+        *v = FATFS_SECTOR_COUNT;
         return RES_OK;
     }
     if (cmd == GET_BLOCK_SIZE)
@@ -5,6 +5,9 @@
 #include <string.h>
 #include <vector>
 
+#include "FreeRTOS.h"
+#include "semphr.h"
+
 #include "ff.h"
 #include "flash.h"
 
@@ -12,8 +15,24 @@
 
 namespace fex
 {
+    // FatFs is built without FF_FS_REENTRANT, and keymaps are loaded by a task on each core
+    class FsLock
+    {
+    public:
+        FsLock() { xSemaphoreTakeRecursive(mutex(), portMAX_DELAY); }
+        ~FsLock() { xSemaphoreGiveRecursive(mutex()); }
+
+    private:
+        static SemaphoreHandle_t mutex()
+        {
+            static SemaphoreHandle_t mutex = xSemaphoreCreateRecursiveMutex();
+            return mutex;
+        }
+    };
+
     bool Filesystem::Initialize()
     {
+        FsLock lock;
         FRESULT fr;
 
         if (!Mount())
@@ -32,8 +51,8 @@ namespace fex
 
             AddFile("README.txt", 
                     "Copy .kmf (keymap file) files into this directory to assign key maps.\n\n"
-                    "After copying over the keymaps power cycle the keyboard for them to take effect.\n"
-                    "To reflash keymaps either bind a key to XXXX or press and hold all 4 corner keys");
+                    "Keymaps take effect a moment after they are copied over.\n"
+                    "To reload keymaps by hand bind a key to 'reload key maps'");
 
             printf("Initialized filesystem!\n");
             return true;
@@ -53,6 +72,7 @@ namespace fex
 
     bool Filesystem::Mount()
     {
+        FsLock lock;
         FRESULT fr = f_mount(&fs_, "", 1);
         if (fr != FR_OK)
         {
@@ -64,6 +84,7 @@ namespace fex
 
     bool Filesystem::Unmount()
     {
+        FsLock lock;
         FRESULT fr = f_unmount("");
         if (fr != FR_OK)
         {
@@ -75,6 +96,7 @@ namespace fex
 
     std::vector<std::string> Filesystem::List(std::string path)
     {
+        FsLock lock;
         std::vector<std::string> out;
 
         std::vector<char> copy(path.begin(), path.end());
@@ -149,11 +171,13 @@ namespace fex
 
     void Filesystem::EraseAll()
     {
+        FsLock lock;
         flash_erase(FATFS_OFFSET, FATFS_SIZE);
     }
 
     bool Filesystem::AddFile(const std::string &filename, const std::string &contents)
     {
+        FsLock lock;
         FIL fp;
         FRESULT fr;
 
@@ -172,17 +196,25 @@ namespace fex
 
     bool Filesystem::FileExists(const std::string &filename)
     {
+        FsLock lock;
         return f_stat(filename.c_str(), NULL) == FR_OK;
     }
 
+    bool Filesystem::Stat(const std::string &filename, FILINFO *info)
+    {
+        FsLock lock;
+        return f_stat(filename.c_str(), info) == FR_OK;
+    }
+
     bool Filesystem::DeleteFile(const std::string &filename)
     {
+        FsLock lock;
         return f_unlink(filename.c_str()) == FR_OK;
     }
 
     std::string Filesystem::ReadFile(const std::string &filename)
     {
-
+        FsLock lock;
         FIL fp;
         FRESULT fr;
 
@@ -192,17 +224,117 @@ namespace fex
             return "";
         }
 
-        std::string out = "";
-        char buffer[4097];
+        // Read straight into the string, compiled keymaps contain '\0'
+        std::string out(f_size(&fp), '\0');
         UINT br = 0;
-        do {
-            fr = f_read(&fp, buffer, 4096, &br);
-            UINT index = MIN(br, 4096);
-            buffer[index] = '\0';
-            out += buffer;
-
-        } while(br == 4096);
-        
+        fr = f_read(&fp, out.data(), out.size(), &br);
+        out.resize(fr == FR_OK ? br : 0);
+
+        f_close(&fp);
         return out;
     }
+
+    FileReader::~FileReader()
+    {
+        FsLock lock;
+        if (open_)
+        {
+            f_close(&fp_);
+        }
+    }
+
+    bool FileReader::Open(const std::string &filename)
+    {
+        FsLock lock;
+        open_ = f_open(&fp_, filename.c_str(), FA_READ) == FR_OK;
+        return open_;
+    }
+
+    size_t FileReader::Read(char *buffer, size_t size)
+    {
+        FsLock lock;
+        UINT br = 0;
+        if (!open_ || f_read(&fp_, buffer, size, &br) != FR_OK)
+        {
+            return 0;
+        }
+        return br;
+    }
+
+    // Where a file stored in one run of clusters starts, false if it is missing or fragmented
+    static bool LocateFile(const std::string &filename, uint32_t *sector, FSIZE_t *size)
+    {
+        FsLock lock;
+        FIL fp;
+        if (f_open(&fp, filename.c_str(), FA_READ) != FR_OK)
+        {
+            return false;
+        }
+
+        *size = f_size(&fp);
+        DWORD first = fp.obj.sclust;
+        FATFS *fs = fp.obj.fs;
+        DWORD cluster_size = (DWORD)fs->csize * SECTOR_SIZE;
+
+        // Seeking into each cluster follows the chain, it must run straight on
+        bool contiguous = true;
+        for (FSIZE_t offset = cluster_size; offset < *size && contiguous; offset += cluster_size)
+        {
+            contiguous = f_lseek(&fp, offset + 1) == FR_OK && fp.clust == first + offset / cluster_size;
+        }
+        f_close(&fp);
+
+        *sector = *size > 0 ? fs->database + (first - 2) * fs->csize : 0;
+        return contiguous;
+    }
+
+    bool Filesystem::Reserve(const std::string &filename, uint32_t size, uint32_t *sector)
+    {
+        FsLock lock;
+        FSIZE_t found;
+        if (LocateFile(filename, sector, &found) && found == size)
+        {
+            return true;
+        }
+
+        f_unlink(filename.c_str());
+        return AddFile(filename, std::string(size, ' ')) && LocateFile(filename, sector, &found) && found == size;
+    }
+
+    bool MappedFile::Open(const std::string &filename)
+    {
+        Close();
+
+        FsLock lock;
+        uint32_t sector;
+        FSIZE_t size;
+        if (!LocateFile(filename, &sector, &size) || size > MAPPED_FILE_MAX_SIZE)
+        {
+            return false;
+        }
+        if (size == 0)
+        {
+            return true;
+        }
+
+        const char *data = (const char *)flash_map(FATFS_OFFSET + sector * SECTOR_SIZE, size);
+        if (!data)
+        {
+            return false;
+        }
+
+        contents_ = std::string_view(data, size);
+        mapped_ = true;
+        return true;
+    }
+
+    void MappedFile::Close()
+    {
+        if (mapped_)
+        {
+            flash_unmap();
+            mapped_ = false;
+        }
+        contents_ = std::string_view();
+    }
 }
@@ -0,0 +1,413 @@
+#include "ftl.h"
+
+#include <stddef.h>
+#include <string.h>
+
+#define FTL_MAGIC 0x4c544658 // "XFTL"
+#define FTL_VERSION 2
+
+typedef struct
+{
+    uint32_t magic;
+    uint16_t version;
+    uint16_t logical_count;
+    uint16_t physical_count;
+    uint16_t reserved;
+    uint32_t seq;
+    uint32_t crc; // Of everything else in the header and the tables that follow
+} ftl_checkpoint_t;
+
+// A logical sector moved to another physical one
+typedef struct
+{
+    uint32_t seq;
+    uint16_t logical;
+    uint16_t physical;
+    uint32_t erases; // The physical sector's erase count after the move
+    uint32_t crc;
+} ftl_entry_t;
+
+_Static_assert(sizeof(ftl_checkpoint_t) == 20, "checkpoint header must be packed");
+_Static_assert(sizeof(ftl_entry_t) == 16 && FTL_PAGE_SIZE % sizeof(ftl_entry_t) == 0, "entries must not straddle pages");
+_Static_assert(sizeof(ftl_checkpoint_t) + FTL_MAX_SECTORS * 6 <= FTL_SECTOR_SIZE / 2, "checkpoint must leave room for a journal");
+
+static uint32_t _ftl_crc(uint32_t crc, void const *data, uint32_t len)
+{
+    uint8_t const *bytes = (uint8_t const *)data;
+    crc = ~crc;
+    for (uint32_t i = 0; i < len; i++)
+    {
+        crc ^= bytes[i];
+        for (int bit = 0; bit < 8; bit++)
+        {
+            crc = (crc >> 1) ^ (0xedb88320 & -(crc & 1));
+        }
+    }
+    return ~crc;
+}
+
+static bool _ftl_data_sector(ftl_t const *ftl, uint32_t physical)
+{
+    return physical >= FTL_META_SECTORS && physical < ftl->physical_count;
+}
+
+// Meta sectors come first, outside a volume written straight onto the area
+static uint32_t _ftl_bank_sector(uint32_t bank)
+{
+    return bank;
+}
+
+// Entries follow the checkpoint, from the next page on
+static uint32_t _ftl_journal_start(ftl_t const *ftl)
+{
+    uint32_t size = sizeof(ftl_checkpoint_t) + ftl->logical_count * sizeof(uint16_t) + ftl->physical_count * sizeof(uint32_t);
+    return (size + FTL_PAGE_SIZE - 1) & ~(FTL_PAGE_SIZE - 1);
+}
+
+static uint32_t _ftl_journal_capacity(ftl_t const *ftl)
+{
+    return (FTL_SECTOR_SIZE - _ftl_journal_start(ftl)) / sizeof(ftl_entry_t);
+}
+
+static void _ftl_set(ftl_t *ftl, uint32_t logical, uint32_t physical)
+{
+    // Readers on other tasks only look at map, and only need either value
+    __atomic_store_n(&ftl->map[logical], (uint16_t)physical, __ATOMIC_RELEASE);
+    ftl->owner[physical] = logical;
+}
+
+static bool _ftl_erased(uint8_t const *data, uint32_t len)
+{
+    for (uint32_t i = 0; i < len; i++)
+    {
+        if (data[i] != 0xff)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Fills a page buffer and programs it whenever it is full
+typedef struct
+{
+    ftl_t *ftl;
+    uint32_t offset;
+    uint32_t fill;
+    uint8_t page[FTL_PAGE_SIZE];
+} ftl_pager_t;
+
+static void _ftl_put(ftl_pager_t *pager, void const *data, uint32_t len)
+{
+    uint8_t const *bytes = (uint8_t const *)data;
+    while (len > 0)
+    {
+        uint32_t count = FTL_PAGE_SIZE - pager->fill;
+        count = count < len ? count : len;
+        memcpy(pager->page + pager->fill, bytes, count);
+        pager->fill += count;
+        bytes += count;
+        len -= count;
+
+        if (pager->fill == FTL_PAGE_SIZE)
+        {
+            pager->ftl->flash.program(pager->offset, pager->page, FTL_PAGE_SIZE);
+            pager->ftl->pages_programmed++;
+            pager->offset += FTL_PAGE_SIZE;
+            pager->fill = 0;
+        }
+    }
+}
+
+static void _ftl_put_end(ftl_pager_t *pager)
+{
+    if (pager->fill > 0)
+    {
+        memset(pager->page + pager->fill, 0xff, FTL_PAGE_SIZE - pager->fill);
+        pager->ftl->flash.program(pager->offset, pager->page, FTL_PAGE_SIZE);
+        pager->ftl->pages_programmed++;
+    }
+}
+
+// Writes the whole map to the other bank, which then takes over
+static void _ftl_checkpoint(ftl_t *ftl)
+{
+    uint32_t bank = ftl->bank ^ 1;
+    uint32_t sector = _ftl_bank_sector(bank);
+    ftl->flash.erase(sector * FTL_SECTOR_SIZE);
+    ftl->erases[sector]++;
+    ftl->erase_count++;
+
+    ftl_checkpoint_t header = {FTL_MAGIC, FTL_VERSION, (uint16_t)ftl->logical_count, (uint16_t)ftl->physical_count, 0, ftl->seq + 1, 0};
+    uint32_t crc = _ftl_crc(0, &header, offsetof(ftl_checkpoint_t, crc));
+    crc = _ftl_crc(crc, ftl->map, ftl->logical_count * sizeof(uint16_t));
+    header.crc = _ftl_crc(crc, ftl->erases, ftl->physical_count * sizeof(uint32_t));
+
+    ftl_pager_t pager = {ftl, sector * FTL_SECTOR_SIZE, 0};
+    _ftl_put(&pager, &header, sizeof(header));
+    _ftl_put(&pager, ftl->map, ftl->logical_count * sizeof(uint16_t));
+    _ftl_put(&pager, ftl->erases, ftl->physical_count * sizeof(uint32_t));
+    _ftl_put_end(&pager);
+
+    ftl->seq = header.seq;
+    ftl->bank = bank;
+    ftl->journal_next = 0;
+    ftl->checkpoints++;
+}
+
+// Makes a move durable, the old physical sector is free from here on
+static void _ftl_commit(ftl_t *ftl, uint32_t logical, uint32_t physical)
+{
+    ftl->owner[ftl->map[logical]] = FTL_FREE;
+    _ftl_set(ftl, logical, physical);
+
+    if (ftl->journal_next >= _ftl_journal_capacity(ftl))
+    {
+        _ftl_checkpoint(ftl);
+        return;
+    }
+
+    ftl_entry_t entry = {ftl->seq + 1, (uint16_t)logical, (uint16_t)physical, ftl->erases[physical], 0};
+    entry.crc = _ftl_crc(0, &entry, offsetof(ftl_entry_t, crc));
+
+    // Programming the rest of the page as erased leaves earlier entries as they are
+    uint32_t offset = _ftl_bank_sector(ftl->bank) * FTL_SECTOR_SIZE + _ftl_journal_start(ftl) + ftl->journal_next * sizeof(ftl_entry_t);
+    uint8_t page[FTL_PAGE_SIZE];
+    memset(page, 0xff, sizeof(page));
+    memcpy(page + offset % FTL_PAGE_SIZE, &entry, sizeof(entry));
+    ftl->flash.program(offset - offset % FTL_PAGE_SIZE, page, FTL_PAGE_SIZE);
+    ftl->pages_programmed++;
+
+    ftl->seq = entry.seq;
+    ftl->journal_next++;
+}
+
+// The least or most worn unmapped data sector
+static uint32_t _ftl_free_sector(ftl_t const *ftl, bool most_worn)
+{
+    uint32_t found = FTL_FREE;
+    for (uint32_t i = FTL_META_SECTORS; i < ftl->physical_count; i++)
+    {
+        if (ftl->owner[i] != FTL_FREE)
+        {
+            continue;
+        }
+        if (found == FTL_FREE || (most_worn ? ftl->erases[i] > ftl->erases[found] : ftl->erases[i] < ftl->erases[found]))
+        {
+            found = i;
+        }
+    }
+    return found;
+}
+
+// Puts data into a free sector, erasing it first only if a bit has to be set.
+// data may be another sector of the flash.
+static void _ftl_program(ftl_t *ftl, uint32_t physical, uint8_t const *data)
+{
+    uint32_t offset = physical * FTL_SECTOR_SIZE;
+    uint8_t const *now = ftl->flash.base + offset;
+
+    bool erase = false;
+    for (uint32_t i = 0; i < FTL_SECTOR_SIZE && !erase; i++)
+    {
+        erase = (data[i] & ~now[i]) != 0;
+    }
+
+    if (erase)
+    {
+        ftl->flash.erase(offset);
+        ftl->erases[physical]++;
+        ftl->erase_count++;
+    }
+    else
+    {
+        ftl->program_only++;
+    }
+
+    uint8_t page[FTL_PAGE_SIZE];
+    for (uint32_t i = 0; i < FTL_SECTOR_SIZE; i += FTL_PAGE_SIZE)
+    {
+        if (erase ? _ftl_erased(data + i, FTL_PAGE_SIZE) : memcmp(data + i, now + i, FTL_PAGE_SIZE) == 0)
+        {
+            continue;
+        }
+
+        // Flash can't be read while it is programmed
+        memcpy(page, data + i, FTL_PAGE_SIZE);
+        ftl->flash.program(offset + i, page, FTL_PAGE_SIZE);
+        ftl->pages_programmed++;
+    }
+}
+
+// Moves the data that is never rewritten onto the most worn free sector, so
+// the little worn sector it sat on takes a share of the writes
+static void _ftl_level(ftl_t *ftl)
+{
+    uint32_t worn = _ftl_free_sector(ftl, true);
+    uint32_t cold = FTL_FREE;
+    for (uint32_t i = FTL_META_SECTORS; i < ftl->physical_count; i++)
+    {
+        if (ftl->owner[i] != FTL_FREE && (cold == FTL_FREE || ftl->erases[i] < ftl->erases[cold]))
+        {
+            cold = i;
+        }
+    }
+
+    if (worn == FTL_FREE || cold == FTL_FREE || ftl->erases[worn] < ftl->erases[cold] + FTL_WEAR_SPREAD)
+    {
+        return;
+    }
+
+    _ftl_program(ftl, worn, ftl->flash.base + cold * FTL_SECTOR_SIZE);
+    _ftl_commit(ftl, ftl->owner[cold], worn);
+    ftl->relocations++;
+}
+
+// Loads a bank's checkpoint, false if it is missing, torn or doesn't fit this area
+static bool _ftl_load(ftl_t *ftl, uint32_t bank, uint32_t *seq)
+{
+    uint8_t const *sector = ftl->flash.base + _ftl_bank_sector(bank) * FTL_SECTOR_SIZE;
+    ftl_checkpoint_t header;
+    memcpy(&header, sector, sizeof(header));
+    if (header.magic != FTL_MAGIC || header.version != FTL_VERSION ||
+        header.logical_count != ftl->logical_count || header.physical_count != ftl->physical_count)
+    {
+        return false;
+    }
+
+    uint8_t const *map = sector + sizeof(header);
+    uint8_t const *erases = map + ftl->logical_count * sizeof(uint16_t);
+    uint32_t crc = _ftl_crc(0, &header, offsetof(ftl_checkpoint_t, crc));
+    crc = _ftl_crc(crc, map, ftl->logical_count * sizeof(uint16_t));
+    crc = _ftl_crc(crc, erases, ftl->physical_count * sizeof(uint32_t));
+    if (crc != header.crc)
+    {
+        return false;
+    }
+
+    memcpy(ftl->map, map, ftl->logical_count * sizeof(uint16_t));
+    memcpy(ftl->erases, erases, ftl->physical_count * sizeof(uint32_t));
+    for (uint32_t i = 0; i < ftl->physical_count; i++)
+    {
+        ftl->owner[i] = FTL_FREE;
+    }
+    for (uint32_t i = 0; i < ftl->logical_count; i++)
+    {
+        if (!_ftl_data_sector(ftl, ftl->map[i]) || ftl->owner[ftl->map[i]] != FTL_FREE)
+        {
+            return false;
+        }
+        ftl->owner[ftl->map[i]] = i;
+    }
+
+    *seq = header.seq;
+    return true;
+}
+
+void ftl_setup(ftl_t *ftl, ftl_flash_t flash, uint32_t physical_count)
+{
+    memset(ftl, 0, sizeof(*ftl));
+    ftl->flash = flash;
+    ftl->physical_count = physical_count < FTL_MAX_SECTORS ? physical_count : FTL_MAX_SECTORS;
+    ftl->logical_count = FTL_LOGICAL_SECTORS(ftl->physical_count);
+}
+
+bool ftl_mount(ftl_t *ftl)
+{
+    // The newest checkpoint wins, the other one is either older or torn
+    uint32_t seq[2] = {0, 0};
+    bool valid[2] = {false, false};
+    for (uint32_t bank = 0; bank < FTL_META_SECTORS; bank++)
+    {
+        valid[bank] = _ftl_load(ftl, bank, &seq[bank]);
+    }
+    if (!valid[0] && !valid[1])
+    {
+        return false;
+    }
+
+    uint32_t bank = (valid[1] && (!valid[0] || seq[1] > seq[0])) ? 1 : 0;
+    if (!_ftl_load(ftl, bank, &ftl->seq))
+    {
+        return false;
+    }
+    ftl->bank = bank;
+
+    // Replay the journal up to the first blank entry. Torn entries are skipped,
+    // the entries after one still follow on from the last good one.
+    uint8_t const *journal = ftl->flash.base + _ftl_bank_sector(bank) * FTL_SECTOR_SIZE + _ftl_journal_start(ftl);
+    ftl->journal_next = 0;
+    for (uint32_t i = 0; i < _ftl_journal_capacity(ftl); i++)
+    {
+        ftl_entry_t entry;
+        memcpy(&entry, journal + i * sizeof(entry), sizeof(entry));
+        if (_ftl_erased((uint8_t const *)&entry, sizeof(entry)))
+        {
+            break;
+        }
+        ftl->journal_next = i + 1;
+
+        if (entry.crc != _ftl_crc(0, &entry, offsetof(ftl_entry_t, crc)) || entry.seq != ftl->seq + 1 ||
+            entry.logical >= ftl->logical_count || !_ftl_data_sector(ftl, entry.physical) || ftl->owner[entry.physical] != FTL_FREE)
+        {
+            continue;
+        }
+
+        ftl->owner[ftl->map[entry.logical]] = FTL_FREE;
+        _ftl_set(ftl, entry.logical, entry.physical);
+        ftl->erases[entry.physical] = entry.erases;
+        ftl->seq = entry.seq;
+    }
+
+    ftl->mounted = true;
+    return true;
+}
+
+void ftl_format(ftl_t *ftl)
+{
+    if (!ftl->mounted)
+    {
+        memset(ftl->erases, 0, sizeof(ftl->erases));
+    }
+
+    for (uint32_t i = 0; i < ftl->physical_count; i++)
+    {
+        ftl->owner[i] = FTL_FREE;
+    }
+    for (uint32_t i = 0; i < ftl->logical_count; i++)
+    {
+        _ftl_set(ftl, i, ftl->physical_count - ftl->logical_count + i);
+    }
+
+    // A stale checkpoint in bank 1 must not outrank the new one in bank 0
+    uint32_t sector = _ftl_bank_sector(1);
+    ftl->flash.erase(sector * FTL_SECTOR_SIZE);
+    ftl->erases[sector]++;
+    ftl->erase_count++;
+
+    ftl->bank = 1;
+    _ftl_checkpoint(ftl);
+    ftl->mounted = true;
+}
+
+uint32_t ftl_offset(ftl_t const *ftl, uint32_t logical)
+{
+    return __atomic_load_n(&ftl->map[logical], __ATOMIC_ACQUIRE) * FTL_SECTOR_SIZE;
+}
+
+void ftl_write(ftl_t *ftl, uint32_t logical, uint8_t const *data)
+{
+    if (logical >= ftl->logical_count || memcmp(data, ftl->flash.base + ftl_offset(ftl, logical), FTL_SECTOR_SIZE) == 0)
+    {
+        return;
+    }
+
+    uint32_t physical = _ftl_free_sector(ftl, false);
+    _ftl_program(ftl, physical, data);
+    _ftl_commit(ftl, logical, physical);
+
+    if (++ftl->writes % FTL_WEAR_INTERVAL == 0)
+    {
+        _ftl_level(ftl);
+    }
+}
@@ -0,0 +1,159 @@
+#include "keymap_cache.h"
+
+#include <stdio.h>
+
+#include "parser.h"
+
+namespace fex
+{
+    uint32_t HashFile(const std::string &path)
+    {
+        FileReader reader;
+        reader.Open(path);
+
+        char buffer[TOKEN_STREAM_CHUNK];
+        uint32_t hash = hash_bytes("");
+        size_t count;
+        while ((count = reader.Read(buffer, sizeof(buffer))) > 0)
+        {
+            hash = hash_bytes(std::string_view(buffer, count), hash);
+        }
+        return hash;
+    }
+
+    std::string CompileKeymap(const Layer &layer, const KeymapStamp &stamp)
+    {
+        ByteWriter out;
+        out.U32(KEYMAP_CACHE_MAGIC);
+        out.U16(KEYMAP_CACHE_VERSION);
+        out.U32(stamp.size);
+        out.U16(stamp.date);
+        out.U16(stamp.time);
+        out.U32(stamp.hash);
+
+        ByteWriter body;
+        layer.Serialize(&body);
+        out.U32(hash_bytes(body.data()));
+        return out.data() + body.data();
+    }
+
+    bool ReadKeymapHeader(ByteReader *in, KeymapStamp *stamp)
+    {
+        if (in->U32() != KEYMAP_CACHE_MAGIC || in->U16() != KEYMAP_CACHE_VERSION)
+        {
+            return false;
+        }
+
+        stamp->size = in->U32();
+        stamp->date = in->U16();
+        stamp->time = in->U16();
+        stamp->hash = in->U32();
+        uint32_t checksum = in->U32();
+        return !in->failed() && checksum == hash_bytes(in->rest());
+    }
+
+    static void SetDeps(const Layer &layer, const KeymapStamp &stamp, KeymapDeps *deps)
+    {
+        deps->stamp = stamp;
+        deps->references = layer.References();
+    }
+
+    std::string LoadKeymap(Filesystem &fs, const std::string &name, Layer *layer, KeymapDeps *deps, Arena *arena, bool update_cache)
+    {
+        std::string source_path = "//" + name + ".kmf";
+        std::string cache_path = "//" + name + ".kmc";
+
+        FILINFO info;
+        if (!fs.Stat(source_path, &info))
+        {
+            return "Missing keymap: " + name;
+        }
+
+        std::string compiled = fs.ReadFile(cache_path);
+        ByteReader in(compiled);
+        KeymapStamp cached;
+        bool have_cache = ReadKeymapHeader(&in, &cached);
+
+        // Sources are streamed rather than read whole, they can be much larger than free RAM.
+        // FAT times only resolve to two seconds, so a matching stamp alone proves nothing.
+        KeymapStamp stamp = {(uint32_t)info.fsize, info.fdate, info.ftime, HashFile(source_path)};
+
+        if (have_cache && cached.hash == stamp.hash)
+        {
+            if (layer->Deserialize(&in) && in.done())
+            {
+                bool restamp = cached.size != stamp.size || cached.date != stamp.date || cached.time != stamp.time;
+                printf("%s: %s\n", name.c_str(), restamp ? "source unchanged, loaded compiled keymap" : "loaded compiled keymap");
+
+                // Same contents with a new timestamp, only the stamp needs updating
+                if (restamp && update_cache)
+                {
+                    fs.AddFile(cache_path, CompileKeymap(*layer, stamp));
+                }
+                SetDeps(*layer, stamp, deps);
+                return "";
+            }
+
+            printf("%s: compiled keymap is corrupt\n", name.c_str());
+            *layer = Layer();
+        }
+
+        printf("%s: compiling keymap\n", name.c_str());
+        std::string error;
+        MappedFile mapped;
+        if (mapped.Open(source_path))
+        {
+            // Tokenized straight out of flash, without copying the source
+            TokenStream stream(mapped.contents());
+            error = parse_stream(&stream, layer, arena);
+            mapped.Close();
+        }
+        else
+        {
+            FileReader reader;
+            if (!reader.Open(source_path))
+            {
+                return "Missing keymap: " + name;
+            }
+            TokenStream stream([&](char *buffer, size_t size)
+                               { return reader.Read(buffer, size); },
+                               arena ? arena : std::pmr::get_default_resource());
+            error = parse_stream(&stream, layer, arena);
+        }
+
+        if (error != "")
+        {
+            // Don't leave a cache that no longer matches its source
+            if (update_cache)
+            {
+                fs.DeleteFile(cache_path);
+            }
+            return error;
+        }
+
+        if (update_cache && !fs.AddFile(cache_path, CompileKeymap(*layer, stamp)))
+        {
+            printf("%s: failed to write compiled keymap\n", name.c_str());
+        }
+        SetDeps(*layer, stamp, deps);
+        return "";
+    }
+
+    uint32_t KeymapSourcesStamp(Filesystem &fs, const std::vector<std::string> &names)
+    {
+        ByteWriter out;
+        for (const std::string &name : names)
+        {
+            FILINFO info = {};
+            fs.Stat("//" + name + ".kmf", &info);
+
+            out.String(name);
+            out.U32(info.fsize);
+            out.U16(info.fdate);
+            out.U16(info.ftime);
+        }
+
+        uint32_t stamp = hash_bytes(out.data());
+        return stamp ? stamp : 1;
+    }
+}
@@ -0,0 +1,109 @@
+#include "keymap_image.h"
+
+#include <stdio.h>
+
+#include "serialize.h"
+
+namespace fex
+{
+    std::string BuildKeymapImage(const std::vector<std::pair<std::string, const Layer *>> &layers, uint32_t sources)
+    {
+        KeymapImageBuilder builder;
+        for (const auto &layer : layers)
+        {
+            builder.Add(layer.first, *layer.second);
+        }
+        return builder.Finish(sources);
+    }
+
+    void KeymapImageBuilder::Add(const std::string &name, const Layer &layer)
+    {
+        ByteWriter record;
+        layer.Serialize(&record);
+        AddRecord(name, record.data());
+    }
+
+    void KeymapImageBuilder::AddRecord(const std::string &name, std::string_view record)
+    {
+        body_.String(name);
+        body_.String(record);
+        layer_count_++;
+    }
+
+    std::string KeymapImageBuilder::Finish(uint32_t sources) const
+    {
+        ByteWriter header;
+        header.U32(KEYMAP_IMAGE_MAGIC);
+        header.U16(KEYMAP_IMAGE_VERSION);
+        header.U16(layer_count_);
+        header.U32(sources);
+        header.U32(body_.data().size());
+        header.U32(crc32(body_.data()));
+        return header.data() + body_.data();
+    }
+
+    bool CheckKeymapImage(std::string_view image, KeymapImageInfo *info)
+    {
+        ByteReader in(image);
+        if (in.U32() != KEYMAP_IMAGE_MAGIC || in.U16() != KEYMAP_IMAGE_VERSION)
+        {
+            return false;
+        }
+
+        info->layer_count = in.U16();
+        info->sources = in.U32();
+        uint32_t size = in.U32();
+        uint32_t crc = in.U32();
+
+        if (in.failed() || size > image.size() - KEYMAP_IMAGE_HEADER_SIZE)
+        {
+            return false;
+        }
+
+        info->body = image.substr(KEYMAP_IMAGE_HEADER_SIZE, size);
+        if (crc32(info->body) != crc)
+        {
+            printf("keymap image: bad crc\n");
+            return false;
+        }
+        return true;
+    }
+
+    bool ReadKeymapImage(const KeymapImageInfo &info, std::vector<std::pair<std::string, Layer>> *layers)
+    {
+        std::vector<KeymapImageEntry> entries;
+        if (!IndexKeymapImage(info, &entries))
+        {
+            return false;
+        }
+
+        for (KeymapImageEntry &entry : entries)
+        {
+            Layer layer;
+            if (!LoadKeymapRecord(entry.record, &layer))
+            {
+                return false;
+            }
+            layers->push_back({std::move(entry.name), std::move(layer)});
+        }
+        return true;
+    }
+
+    bool IndexKeymapImage(const KeymapImageInfo &info, std::vector<KeymapImageEntry> *entries)
+    {
+        ByteReader in(info.body);
+        for (uint16_t i = 0; i < info.layer_count; i++)
+        {
+            std::string name = in.String();
+            std::string_view record = in.View();
+            entries->push_back({std::move(name), record});
+        }
+        return !in.failed() && in.done();
+    }
+
+    bool LoadKeymapRecord(std::string_view record, Layer *layer)
+    {
+        ByteReader in(record);
+        return layer->Deserialize(&in) && in.done();
+    }
+}
@@ -1,5 +1,7 @@
 #include "layer.h"
 
+#include <algorithm>
+
 namespace fex
 {
     bool Layer::Bound(int key, Operation operation)
@@ -15,18 +17,138 @@ namespace fex
         if (operation == Operation::HOLD) {
             on_hold_bound_ = true;
         }
+        BoundAction *pooled = action_pool().Intern(std::move(action));
+
         auto row_key_it = bindings_.find(key);
         if (row_key_it == bindings_.end())
         {
-            std::unordered_map<Operation, std::unique_ptr<BoundAction>> op_action;
-            op_action.insert({operation, std::move(action)});
+            std::unordered_map<Operation, BoundAction *> op_action;
+            op_action.insert({operation, pooled});
 
             bindings_.insert({key, std::move(op_action)});
 
             return;
         }
 
-        row_key_it->second.insert({operation, std::move(action)});
+        row_key_it->second.insert({operation, pooled});
+    }
+
+    void Layer::BindCombo(const KeyMask &keys, std::unique_ptr<BoundAction> action)
+    {
+        combos_.Add(keys, std::move(action));
+    }
+
+    void Layer::BindLeaderSequence(std::vector<uint8_t> sequence, std::unique_ptr<BoundAction> action)
+    {
+        leader_.Add(std::move(sequence), std::move(action));
+    }
+
+    bool Layer::KeyCode(int key, int *code) const
+    {
+        auto it = bindings_.find(key);
+        if (it == bindings_.end())
+        {
+            return false;
+        }
+
+        auto op_it = it->second.find(Operation::PRESS);
+        if (op_it == it->second.end())
+        {
+            return false;
+        }
+
+        return op_it->second->KeyCode(code);
+    }
+
+    std::vector<std::string> Layer::References() const
+    {
+        std::vector<std::string> layers;
+        for (const auto &[key, operations] : bindings_)
+        {
+            for (const auto &[operation, action] : operations)
+            {
+                action->References(&layers);
+            }
+        }
+        for (const Combo &combo : combos_.combos())
+        {
+            combo.action->References(&layers);
+        }
+        for (const BoundAction *action : leader_.actions())
+        {
+            action->References(&layers);
+        }
+
+        std::sort(layers.begin(), layers.end());
+        layers.erase(std::unique(layers.begin(), layers.end()), layers.end());
+        return layers;
+    }
+
+    void Layer::Actions(std::unordered_set<const BoundAction *> *actions) const
+    {
+        for (const auto &[key, operations] : bindings_)
+        {
+            for (const auto &[operation, action] : operations)
+            {
+                actions->insert(action);
+            }
+        }
+        for (const Combo &combo : combos_.combos())
+        {
+            actions->insert(combo.action);
+        }
+        for (const BoundAction *action : leader_.actions())
+        {
+            actions->insert(action);
+        }
+    }
+
+    void Layer::Serialize(ByteWriter *out) const
+    {
+        out->U8(unassigned_keys_fall_through_);
+        out->U32(combo_window_);
+
+        uint16_t count = 0;
+        for (const auto &key : bindings_)
+        {
+            count += key.second.size();
+        }
+
+        out->U16(count);
+        for (const auto &key : bindings_)
+        {
+            for (const auto &operation : key.second)
+            {
+                out->U16(key.first);
+                out->U8((uint8_t)operation.first);
+                operation.second->Serialize(out);
+            }
+        }
+
+        combos_.Serialize(out);
+        leader_.Serialize(out);
+    }
+
+    bool Layer::Deserialize(ByteReader *in)
+    {
+        unassigned_keys_fall_through_ = in->U8();
+        combo_window_ = in->U32();
+
+        uint16_t count = in->U16();
+        for (uint16_t i = 0; i < count; i++)
+        {
+            int key = in->U16();
+            Operation operation = (Operation)in->U8();
+
+            std::unique_ptr<BoundAction> action = DeserializeAction(in);
+            if (!action)
+            {
+                return false;
+            }
+            Bind(key, std::move(action), operation);
+        }
+
+        return combos_.Deserialize(in) && leader_.Deserialize(in);
     }
 
     void Layer::Enqueue(int key, Operation operation, BoundActionEnqueue action, QueueHandle_t queue)
@@ -47,7 +169,43 @@ namespace fex
         }
 
         op_it->second->Print();
-        op_it->second->Enqueue(action, queue);
+        op_it->second->EnqueueFor(key, action, queue);
+    }
+
+    void LayerState::Switch(int layer)
+    {
+        // A leader sequence walks the trie of the layer it started on
+        if (layer != active_)
+        {
+            leader_engine().Cancel();
+        }
+
+        active_ = layer;
+        published_.store(layer, std::memory_order_release);
+    }
+
+    LayerState &layer_state()
+    {
+        static LayerState state;
+        return state;
+    }
+
+    void OneShotLayer::Arm(int layer)
+    {
+        if (armed_ && layer_ == layer)
+        {
+            armed_ = false;
+            return;
+        }
+
+        armed_ = true;
+        layer_ = layer;
+    }
+
+    OneShotLayer &one_shot_layer()
+    {
+        static OneShotLayer one_shot;
+        return one_shot;
     }
 
 }
\ No newline at end of file
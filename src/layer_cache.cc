@@ -0,0 +1,154 @@
+#include "layer_cache.h"
+
+#include <algorithm>
+#include <stdio.h>
+
+#include "flash.h"
+#include "keymap_image.h"
+#include "layer_set.h"
+
+namespace fex
+{
+    void LayerCache::Index(int id, const std::string &name, std::string_view record)
+    {
+        Entry &entry = entries_[id];
+        if (entry.layer && entry.record.empty())
+        {
+            resident_++;
+        }
+
+        entry.name = name;
+        entry.record = record;
+        changed_ = true;
+    }
+
+    void LayerCache::Insert(int id, const std::string &name, Layer layer)
+    {
+        Entry &entry = entries_[id];
+        if (entry.layer && !entry.record.empty())
+        {
+            resident_--;
+        }
+
+        entry.name = name;
+        entry.record = {};
+        entry.layer = std::make_unique<Layer>(std::move(layer));
+        entry.last_used = ++clock_;
+        changed_ = true;
+    }
+
+    void LayerCache::Detach(const std::vector<int> &keep)
+    {
+        for (auto it = entries_.begin(); it != entries_.end();)
+        {
+            if (std::find(keep.begin(), keep.end(), it->first) == keep.end())
+            {
+                if (it->second.layer && !it->second.record.empty())
+                {
+                    resident_--;
+                }
+                it = entries_.erase(it);
+                continue;
+            }
+            ++it;
+        }
+        changed_ = true;
+    }
+
+    void LayerCache::Unlink()
+    {
+        for (auto &[id, entry] : entries_)
+        {
+            if (!entry.record.empty())
+            {
+                Get(id);
+                entry.record = {};
+                resident_--;
+            }
+        }
+    }
+
+    Layer &LayerCache::Get(int id)
+    {
+        Entry &entry = entries_[id];
+        entry.last_used = ++clock_;
+        if (entry.layer)
+        {
+            return *entry.layer;
+        }
+
+        entry.layer = std::make_unique<Layer>();
+        if (!entry.record.empty())
+        {
+            printf("Loading layer %s\n", entry.name.c_str());
+
+            // Waits out a flash erase or program, if one is under way
+            flash_xip_lock();
+            bool loaded = LoadKeymapRecord(entry.record, entry.layer.get());
+            flash_xip_unlock();
+            if (!loaded)
+            {
+                printf("Layer %s is corrupt\n", entry.name.c_str());
+                *entry.layer = Layer();
+            }
+            resident_++;
+        }
+        return *entry.layer;
+    }
+
+    void LayerCache::Trim(std::initializer_list<int> keep)
+    {
+        while (resident_ > LAYER_CACHE_RESIDENT)
+        {
+            Entry *oldest = nullptr;
+            for (auto &[id, entry] : entries_)
+            {
+                if (!entry.layer || entry.record.empty() || std::find(keep.begin(), keep.end(), id) != keep.end())
+                {
+                    continue;
+                }
+                if (!oldest || entry.last_used < oldest->last_used)
+                {
+                    oldest = &entry;
+                }
+            }
+
+            if (!oldest)
+            {
+                return;
+            }
+
+            printf("Unloading layer %s\n", oldest->name.c_str());
+            oldest->layer.reset();
+            resident_--;
+        }
+    }
+
+    void LayerCache::Actions(std::unordered_set<const BoundAction *> *actions) const
+    {
+        for (const auto &[id, entry] : entries_)
+        {
+            if (entry.layer)
+            {
+                entry.layer->Actions(actions);
+            }
+        }
+    }
+
+    void LayerCache::Publish()
+    {
+        if (!changed_)
+        {
+            shared_layer_set().Reclaim();
+            return;
+        }
+
+        auto set = std::make_unique<LayerSet>();
+        for (const auto &[id, entry] : entries_)
+        {
+            set->layers.push_back({id, entry.name});
+        }
+        shared_layer_set().Publish(std::move(set));
+        changed_ = false;
+    }
+}
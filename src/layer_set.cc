@@ -0,0 +1,87 @@
+#include "layer_set.h"
+
+namespace fex
+{
+    const std::string *LayerSet::Name(int id) const
+    {
+        for (const Entry &entry : layers)
+        {
+            if (entry.id == id)
+            {
+                return &entry.name;
+            }
+        }
+        return nullptr;
+    }
+
+    SharedLayerSet::Reader::~Reader()
+    {
+        if (owner_)
+        {
+            owner_->readers_[epoch_]--;
+        }
+    }
+
+    SharedLayerSet::Reader SharedLayerSet::Read()
+    {
+        static const LayerSet empty;
+
+        while (true)
+        {
+            // Only counts if the epoch didn't flip in between, otherwise the
+            // publisher may already have stopped looking at it
+            int epoch = epoch_.load();
+            readers_[epoch]++;
+            if (epoch_.load() == epoch)
+            {
+                const LayerSet *set = current_.load();
+                return Reader(this, epoch, set ? set : &empty);
+            }
+            readers_[epoch]--;
+        }
+    }
+
+    void SharedLayerSet::Publish(std::unique_ptr<LayerSet> set)
+    {
+        set->generation = ++generation_;
+
+        // Readers that count themselves in after the flip only see the new set
+        const LayerSet *replaced = current_.exchange(set.release());
+        epoch_.store(epoch_.load() ^ 1);
+        if (replaced)
+        {
+            retired_.push_back({replaced, {false, false}});
+        }
+
+        Reclaim();
+    }
+
+    bool SharedLayerSet::Reclaim()
+    {
+        // A replaced set can be held by readers of either epoch that counted
+        // themselves in before it was replaced. Once each epoch has been seen
+        // without readers since, nobody holds it.
+        bool clear[2] = {readers_[0].load() == 0, readers_[1].load() == 0};
+        for (auto it = retired_.begin(); it != retired_.end();)
+        {
+            it->clear[0] = it->clear[0] || clear[0];
+            it->clear[1] = it->clear[1] || clear[1];
+            if (it->clear[0] && it->clear[1])
+            {
+                delete it->set;
+                it = retired_.erase(it);
+            }
+            else
+            {
+                it++;
+            }
+        }
+        return retired_.empty();
+    }
+
+    SharedLayerSet &shared_layer_set()
+    {
+        static SharedLayerSet shared;
+        return shared;
+    }
+}
@@ -0,0 +1,204 @@
+#include "leader.h"
+
+#include <stdio.h>
+
+namespace fex
+{
+    void LeaderTrie::Add(std::vector<uint8_t> sequence, std::unique_ptr<BoundAction> action)
+    {
+        sequences_.push_back({std::move(sequence), (int)actions_.size()});
+        actions_.push_back(action_pool().Intern(std::move(action)));
+    }
+
+    void LeaderTrie::Build()
+    {
+        alphabet_.assign(256, 0);
+        symbols_ = 0;
+        for (const auto &sequence : sequences_)
+        {
+            for (uint8_t code : sequence.first)
+            {
+                if (alphabet_[code] == 0)
+                {
+                    alphabet_[code] = ++symbols_;
+                }
+            }
+        }
+
+        // Root node
+        transitions_.assign(symbols_, 0);
+        node_action_.assign(1, -1);
+        leaf_.assign(1, false);
+
+        for (const auto &sequence : sequences_)
+        {
+            uint16_t node = 0;
+            for (uint8_t code : sequence.first)
+            {
+                uint16_t &child = transitions_[node * symbols_ + alphabet_[code] - 1];
+                if (child == 0)
+                {
+                    child = node_action_.size();
+                    transitions_.resize(transitions_.size() + symbols_, 0);
+                    node_action_.push_back(-1);
+                    leaf_.push_back(true);
+                    leaf_[node] = false;
+                }
+                node = transitions_[node * symbols_ + alphabet_[code] - 1];
+            }
+
+            // Later declarations of the same sequence win
+            node_action_[node] = sequence.second;
+        }
+
+        sequences_.clear();
+        sequences_.shrink_to_fit();
+    }
+
+    uint16_t LeaderTrie::Step(uint16_t node, uint8_t code) const
+    {
+        if (symbols_ == 0 || alphabet_[code] == 0)
+        {
+            return 0;
+        }
+        return transitions_[node * symbols_ + alphabet_[code] - 1];
+    }
+
+    BoundAction *LeaderTrie::action(uint16_t node) const
+    {
+        int16_t index = node_action_[node];
+        return (index < 0) ? nullptr : actions_[index];
+    }
+
+    void LeaderTrie::Serialize(ByteWriter *out) const
+    {
+        out->U16(actions_.size());
+        for (const auto &action : actions_)
+        {
+            action->Serialize(out);
+        }
+
+        out->U16(symbols_);
+        out->U16(alphabet_.size());
+        for (uint8_t symbol : alphabet_)
+        {
+            out->U8(symbol);
+        }
+
+        out->U16(node_action_.size());
+        for (size_t node = 0; node < node_action_.size(); node++)
+        {
+            out->U16(node_action_[node]);
+            out->U8(leaf_[node]);
+            for (int symbol = 0; symbol < symbols_; symbol++)
+            {
+                out->U16(transitions_[node * symbols_ + symbol]);
+            }
+        }
+    }
+
+    bool LeaderTrie::Deserialize(ByteReader *in)
+    {
+        actions_.resize(in->U16());
+        for (auto &action : actions_)
+        {
+            std::unique_ptr<BoundAction> read = DeserializeAction(in);
+            if (!read)
+            {
+                return false;
+            }
+            action = action_pool().Intern(std::move(read));
+        }
+
+        symbols_ = in->U16();
+        alphabet_.resize(in->U16());
+        for (uint8_t &symbol : alphabet_)
+        {
+            symbol = in->U8();
+        }
+
+        uint16_t nodes = in->U16();
+        node_action_.resize(nodes);
+        leaf_.resize(nodes);
+        transitions_.resize(nodes * symbols_);
+        for (size_t node = 0; node < nodes; node++)
+        {
+            node_action_[node] = in->U16();
+            leaf_[node] = in->U8();
+            for (int symbol = 0; symbol < symbols_; symbol++)
+            {
+                transitions_[node * symbols_ + symbol] = in->U16();
+            }
+        }
+
+        return !in->failed();
+    }
+
+    void LeaderEngine::Begin()
+    {
+        active_ = true;
+        node_ = 0;
+        last_key_ = now_;
+    }
+
+    void LeaderEngine::Feed(const LeaderTrie &trie, uint8_t code, TickType_t now, QueueHandle_t queue)
+    {
+        if (!active_)
+        {
+            return;
+        }
+
+        if (trie.empty())
+        {
+            Fire(nullptr, queue);
+            return;
+        }
+
+        uint16_t next = trie.Step(node_, code);
+        if (next == 0)
+        {
+            // Off the end of every sequence, a shorter match still counts
+            Fire(trie.action(node_), queue);
+            return;
+        }
+
+        node_ = next;
+        last_key_ = now;
+
+        // Nothing longer can match, don't wait for the timeout
+        if (trie.leaf(node_))
+        {
+            Fire(trie.action(node_), queue);
+        }
+    }
+
+    void LeaderEngine::Tick(const LeaderTrie &trie, TickType_t now, QueueHandle_t queue)
+    {
+        now_ = now;
+        if (active_ && now - last_key_ > pdMS_TO_TICKS(LEADER_TIMEOUT_MS))
+        {
+            Fire((node_ == 0 || trie.empty()) ? nullptr : trie.action(node_), queue);
+        }
+    }
+
+    void LeaderEngine::Fire(BoundAction *action, QueueHandle_t queue)
+    {
+        active_ = false;
+
+        if (!action)
+        {
+            printf("leader: no sequence matched\n");
+            return;
+        }
+
+        action->Print();
+        action->Enqueue(BoundActionEnqueue::DO, queue);
+        action->Enqueue(BoundActionEnqueue::UNDO, queue);
+    }
+
+    LeaderEngine &leader_engine()
+    {
+        static LeaderEngine engine;
+        return engine;
+    }
+}
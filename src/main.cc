@@ -6,9 +6,13 @@
 #include "timers.h"
 
 /* System Libraries */
+#include <atomic>
+#include <malloc.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unordered_map>
+#include <unordered_set>
 
 /* Board Libraries */
 #include "hardware/gpio.h"
@@ -26,18 +30,32 @@
 
 /* Application Code */
 #include "actions.h"
+#include "arena.h"
+#include "combo.h"
 #include "filesystem.h"
+#include "flash.h"
+#include "keymap_cache.h"
+#include "keymap_image.h"
+#include "keymap_reload.h"
 #include "layer.h"
+#include "layer_cache.h"
+#include "layer_set.h"
+#include "leader.h"
 #include "parser.h"
 #include "queue_message.h"
+#include "repeat.h"
+#include "telemetry.h"
 #include "tokenizer.h"
 
 /* Task Stack Sizes */
-#define USB_DEVICE_STACK_SIZE (3 * configMINIMAL_STACK_SIZE / 2) * (CFG_TUSB_DEBUG ? 2 : 1)
+#define USB_DEVICE_STACK_SIZE (512 * 2) * (CFG_TUSB_DEBUG ? 2 : 1) // STATS.TXT and LAYERS.TXT are generated in the read callback
 #define USB_HID_STACK_SIZE (512)
 #define POLL_KEYS_STACK_SIZE (512)
 #define PROCESS_KEYS_STACK_SIZE (512 * 2)
 #define DRAW_DISPLAYS_STACK_SIZE (512)
+#define LOAD_KEYMAPS_STACK_SIZE (512 * 4)
+#define RELOAD_KEYMAPS_STACK_SIZE (512 * 4)
+#define FLASH_WRITER_STACK_SIZE (512)
 #define BLINK_STACK_SIZE (configMINIMAL_STACK_SIZE)
 
 /* Priorities at which the tasks are created. */
@@ -46,6 +64,9 @@
 #define POLL_KEYS_TASK_PRIORITY (configMAX_PRIORITIES - 3)
 #define PROCESS_KEYS_TASK_PRIORITY (configMAX_PRIORITIES - 3)
 #define DRAW_DISPLAYS_TASK_PRIORITY (configMAX_PRIORITIES - 4)
+#define LOAD_KEYMAPS_TASK_PRIORITY (tskIDLE_PRIORITY + 1)
+#define RELOAD_KEYMAPS_TASK_PRIORITY (tskIDLE_PRIORITY + 1)
+#define FLASH_WRITER_TASK_PRIORITY (tskIDLE_PRIORITY + 2)
 #define BLINK_TASK_PRIORITY (tskIDLE_PRIORITY)
 
 /* Task Periods */
@@ -60,6 +81,8 @@
 /* Application Constants */
 #define EVENT_QUEUE_LENGTH (100)
 #define KEY_QUEUE_LENGTH (100)
+#define LAYER_QUEUE_LENGTH (8)
+#define FALLBACK_LAYER (0)
 #define BLINK_TASK_LED (PICO_DEFAULT_LED_PIN)
 #define CORE_0_AFFINITY_MASK (1 << 0)
 #define CORE_1_AFFINITY_MASK (1 << 1)
@@ -84,6 +107,9 @@ StaticTask_t usb_device_task;
 StackType_t usb_hid_task_stack[USB_HID_STACK_SIZE];
 StaticTask_t usb_hid_task;
 
+/* Parse Arenas, one per load keymaps task */
+char parse_arena_buffers[2][PARSE_ARENA_SIZE];
+
 /* Dynamic Task Handles */
 
 /*-----------------------------------------------------------*/
@@ -93,6 +119,19 @@ StaticTask_t usb_hid_task;
  */
 static void prvHardwareInit(void);
 
+/*
+ * Keymaps
+ */
+static std::vector<std::string> prvListKeymapFiles();
+static bool prvWriteKeymapImage(const std::string &built);
+static bool prvIndexKeymapImage(std::string_view image, bool any_sources, std::string_view header = {});
+static void prvReloadKeymaps(fex::Arena *arena);
+
+/*
+ * Diagnostics
+ */
+static void prvReportHeap(const char *when);
+
 /*
  * FreeRTOS Application Tasks
  */
@@ -102,6 +141,9 @@ static void prvPollKeysTask(void *pvParameters);
 static void prvProcessKeysTask(void *pvParameters);
 static void prvDrawDisplaysTask(void *pvParameters);
 static void prvBlinkTask(void *pvParameters);
+static void prvLoadKeymapsTask(void *pvParameters);
+static void prvReloadKeymapsTask(void *pvParameters);
+static void prvFlashWriterTask(void *pvParameters);
 
 /*-----------------------------------------------------------*/
 
@@ -111,8 +153,9 @@ fex::Filesystem fs;
 
 // Mutex not needed since only one task uses it
 // Shared because main initializes it before scheduling
-int layer = 0;
-std::unordered_map<int, std::pair<std::string, fex::Layer>> layers;
+// The active layer lives in fex::layer_state(), other tasks see the layer
+// names through fex::shared_layer_set()
+fex::LayerCache layers;
 
 // OLED and Expander task both use I2C, should be mutexed
 SemaphoreHandle_t xI2CMutex;
@@ -120,6 +163,38 @@ SemaphoreHandle_t xI2CMutex;
 QueueHandle_t xEventQueue;
 QueueHandle_t xKeyQueue;
 
+// Layers compiled by the load keymaps tasks, installed by the process keys task
+struct LoadedLayer
+{
+  std::string name;
+  fex::Layer layer;
+};
+QueueHandle_t xLayerQueue; // LoadedLayer *, ownership passes to the receiver
+
+// Keymap files left to compile, shared by the load keymaps tasks
+std::vector<std::string> keymap_files;
+std::atomic<int> next_keymap_file{0};
+std::atomic<int> keymap_loaders_running{0};
+std::atomic<bool> keymap_loaders_done{false}; // Set once the last loader has finished with the image
+std::atomic<bool> keymap_image_written{false}; // Loaded layers can now be reloaded from the image
+uint32_t keymap_sources = 0;
+
+// Guards keymap_image, keymap_deps and parse_status while loading
+SemaphoreHandle_t xKeymapMutex;
+fex::KeymapImageBuilder keymap_image;
+std::unordered_map<std::string, fex::KeymapDeps> keymap_deps; // By file, as of the layers in use
+
+// A reload swaps in the changed layers and drops the removed ones in one go
+struct KeymapReload
+{
+  std::vector<std::string> names;   // Every keymap file, changed or not
+  std::vector<LoadedLayer> changed;
+  std::string image;                // Written to flash once installed, layers load from it until then
+};
+TaskHandle_t reload_keymaps_handle = NULL;
+QueueHandle_t xReloadQueue;           // KeymapReload *, ownership passes to the receiver
+SemaphoreHandle_t xReloadInstalled;   // Given once the process keys task has swapped the layers in
+
 // Should probably be a mutex, but I think a bool works for now
 bool hid_send_complete = true;
 
@@ -133,11 +208,11 @@ int main(void)
   prvHardwareInit();
 
   printf("Starting fexware.\n");
+  flash_init();
 
   // printf("Erasing...\n");
   // fs.EraseAll();
 
-  std::vector<std::string> files;
   bool keymap_boot_override = false;
 
   printf("Initializing filesystem\n");
@@ -145,56 +220,57 @@ int main(void)
   {
     printf("Mounting filesystem\n");
     fs.Mount();
-    printf("Listing filesystem\n");
-    files = fs.List("/");
-    printf("Done listing filesystem\n");
+    keymap_files = prvListKeymapFiles();
+    fex::telemetry().Publish(fs);
   }
 
-  printf("Collecting files on disk\n");
-  std::vector<std::string> keymap_files;
-  for (auto file : files)
-  {
-    printf("--- '%s'\n", file.c_str());
+  // Recorded in images built from these files
+  keymap_sources = fex::KeymapSourcesStamp(fs, keymap_files);
+  std::string_view image((const char *)(XIP_BASE + KEYMAP_IMAGE_OFFSET), KEYMAP_IMAGE_SIZE);
 
-    int idx = file.rfind('.');
-    if (idx != std::string::npos)
+  fex::KeymapImageInfo info;
+
+  // An image compiled on the host (fexc) takes the place of the keymap files
+  bool host_image = false;
+  if (fs.FileExists("//KEYMAP.IMG"))
+  {
+    std::string built = fs.ReadFile("//KEYMAP.IMG");
+    if (!fex::CheckKeymapImage(built, &info))
     {
-      std::string ext = file.substr(idx + 1);
-      if (ext == "kmf")
-      {
-        keymap_files.push_back(file.substr(2, idx - 2));
-      }
+      parse_status = "KEYMAP.IMG: invalid image";
+      fex::telemetry().AddParseError(parse_status);
+    }
+    else if (image.substr(0, built.size()) == built)
+    {
+      host_image = true;
+    }
+    else
+    {
+      host_image = prvWriteKeymapImage(built);
     }
   }
 
-  printf("Keymap Files:\n");
-  for (auto file : keymap_files)
+  // Only the index is read, layers load on first use
+  if (prvIndexKeymapImage(image, host_image))
   {
-    fex::Layer l;
-    printf("===== %s =====\n", file.c_str());
-    std::string source = fs.ReadFile("//" + file + ".kmf");
-    std::string error = fex::parse_source(source, &l);
-    printf("%s\n", source.c_str());
-    printf("==============\n");
-    printf("Parsing: '%s'\n", error.c_str());
-    printf("==============\n");
-
-    if (error != "")
+    if (layers.Contains(std::hash<std::string>()("BaseLayer")))
     {
-      parse_status = error;
+      fex::layer_state().Switch(std::hash<std::string>()("BaseLayer"));
     }
+    keymap_files.clear();
+  }
 
-    if (file == "BaseLayer")
-    {
-      layer = std::hash<std::string>()("BaseLayer");
-    }
+  // Keys work from the start on a built-in layer, the keymap files are compiled
+  // by the load keymaps tasks once the scheduler is running
+  layers.Insert(FALLBACK_LAYER, "Fallback", fex::Layer());
+  layers.Publish();
 
-    layers[std::hash<std::string>()(file)] = std::pair{file, std::move(l)};
+  if (keymap_files.empty())
+  {
+    // TODO(fex): might be an issue if Initalize fails
+    fs.Unmount();
   }
 
-  // TODO(fex): might be an issue if Initalize fails
-  fs.Unmount();
-
   xI2CMutex = xSemaphoreCreateMutex();
   if (xI2CMutex == NULL)
   {
@@ -216,6 +292,37 @@ int main(void)
     return 1;
   }
 
+  xLayerQueue = xQueueCreate(LAYER_QUEUE_LENGTH, sizeof(LoadedLayer *));
+  if (xLayerQueue == NULL)
+  {
+    printf("---- FAILED TO CREATE LAYER QUEUE ----\n");
+    return 1;
+  }
+
+  xKeymapMutex = xSemaphoreCreateMutex();
+  if (xKeymapMutex == NULL)
+  {
+    printf("---- FAILED TO CREATE MUTEX ----\n");
+    return 1;
+  }
+
+  xReloadQueue = xQueueCreate(1, sizeof(KeymapReload *));
+  if (xReloadQueue == NULL)
+  {
+    printf("---- FAILED TO CREATE RELOAD QUEUE ----\n");
+    return 1;
+  }
+
+  xReloadInstalled = xSemaphoreCreateBinary();
+  if (xReloadInstalled == NULL)
+  {
+    printf("---- FAILED TO CREATE SEMAPHORE ----\n");
+    return 1;
+  }
+
+  fex::repeat_scheduler().Initialize();
+  fex::action_pool().Initialize();
+
   // TODO(fex): pressing a key twice will sometimes miss a press
   TaskHandle_t poll_keys_handle;
   TaskHandle_t process_keys_handle;
@@ -226,6 +333,11 @@ int main(void)
   // xTaskCreate(prvDrawDisplaysTask, "draw_displays", DRAW_DISPLAYS_STACK_SIZE, NULL, DRAW_DISPLAYS_TASK_PRIORITY, &draw_displays_handle);
   xTaskCreate(prvBlinkTask, "blink", BLINK_STACK_SIZE, NULL, BLINK_TASK_PRIORITY, &blink_handle);
 
+  // Erases take tens of milliseconds, keep them away from USB on core 0
+  TaskHandle_t flash_writer_handle;
+  xTaskCreate(prvFlashWriterTask, "flash_writer", FLASH_WRITER_STACK_SIZE, NULL, FLASH_WRITER_TASK_PRIORITY, &flash_writer_handle);
+  vTaskCoreAffinitySet(flash_writer_handle, CORE_1_AFFINITY_MASK);
+
   TaskHandle_t usb_d_handle = xTaskCreateStatic(prvUsbDeviceTask, "usb_device", USB_DEVICE_STACK_SIZE, NULL, USB_DEVICE_TASK_PRIORITY, usb_device_task_stack, &usb_device_task);
   TaskHandle_t usb_hid_handle = xTaskCreateStatic(prvUsbHidTask, "usb_hid", USB_HID_STACK_SIZE, NULL, USB_HID_TASK_PRIORITY, usb_hid_task_stack, &usb_hid_task);
 
@@ -238,6 +350,24 @@ int main(void)
   // vTaskCoreAffinitySet(draw_displays_handle, CORE_1_AFFINITY_MASK);
   vTaskCoreAffinitySet(blink_handle, CORE_1_AFFINITY_MASK);
 
+  // One loader per core, each takes the next file until none are left
+  keymap_loaders_done = keymap_files.empty();
+  if (!keymap_files.empty())
+  {
+    TaskHandle_t load_keymaps_handles[2];
+    keymap_loaders_running = 2;
+    prvReportHeap("before load");
+    xTaskCreate(prvLoadKeymapsTask, "load_keymaps_0", LOAD_KEYMAPS_STACK_SIZE, parse_arena_buffers[0], LOAD_KEYMAPS_TASK_PRIORITY, &load_keymaps_handles[0]);
+    xTaskCreate(prvLoadKeymapsTask, "load_keymaps_1", LOAD_KEYMAPS_STACK_SIZE, parse_arena_buffers[1], LOAD_KEYMAPS_TASK_PRIORITY, &load_keymaps_handles[1]);
+    vTaskCoreAffinitySet(load_keymaps_handles[0], CORE_0_AFFINITY_MASK);
+    vTaskCoreAffinitySet(load_keymaps_handles[1], CORE_1_AFFINITY_MASK);
+  }
+
+  // Core 0 is kept free for USB. Reloads only start once the loaders are
+  // done, so the arena buffer of the core 1 loader is reused.
+  xTaskCreate(prvReloadKeymapsTask, "reload_keymaps", RELOAD_KEYMAPS_STACK_SIZE, parse_arena_buffers[1], RELOAD_KEYMAPS_TASK_PRIORITY, &reload_keymaps_handle);
+  vTaskCoreAffinitySet(reload_keymaps_handle, CORE_1_AFFINITY_MASK);
+
   vTaskStartScheduler();
 
   for (;;)
@@ -407,6 +537,87 @@ static void prvProcessKeysTask(void *pvParameters)
   memset(timeouts, -1, sizeof(timeouts));
   TickType_t hold = pdMS_TO_TICKS(200);
 
+  fex::ComboEngine combos;
+  fex::LeaderEngine &leader = fex::leader_engine();
+  fex::KeyMask leader_keys;
+  fex::LayerState &state = fex::layer_state();
+  fex::OneShotLayer &one_shot = fex::one_shot_layer();
+  int one_shot_key = -1;
+  int one_shot_target = 0;
+  KeymapReload *installed = nullptr; // Kept while layers load from its image
+
+  auto dispatch = [&](const fex::KeyEvent &event)
+  {
+    // Keys typed after the leader key walk its sequence instead of being sent
+    if (event.key >= 0 && event.key < KEY_MASK_BITS)
+    {
+      int code;
+      if (event.pressed && leader.active() && layers.Get(state.active()).KeyCode(event.key, &code))
+      {
+        leader_keys.Set(event.key);
+        leader.Feed(layers.Get(state.active()).leader(), code, event.time, xEventQueue);
+        return;
+      }
+
+      if (!event.pressed && leader_keys.Test(event.key))
+      {
+        leader_keys.Clear(event.key);
+        return;
+      }
+    }
+
+    // The press after a one shot layer, and its release, are looked up on that layer
+    if (event.pressed && one_shot.armed() && event.key >= 0)
+    {
+      one_shot.Cancel();
+      if (layers.Contains(one_shot.layer()))
+      {
+        one_shot_key = event.key;
+        one_shot_target = one_shot.layer();
+      }
+    }
+
+    int target_layer = state.active();
+    if (event.key == one_shot_key)
+    {
+      target_layer = one_shot_target;
+      if (!event.pressed)
+      {
+        one_shot_key = -1;
+      }
+    }
+
+    fex::Layer &target = layers.Get(target_layer);
+
+    if (target.on_hold_bound())
+    // if (layers.Get(layer).Bound(event.key, fex::Operation::HOLD))
+    {
+      if (event.pressed)
+      {
+        printf("fex: pressed??\n");
+        timeouts[event.index] = event.time;
+      }
+      else
+      {
+        if (timeouts[event.index] != -1 && event.time - timeouts[event.index] < hold)
+        {
+          target.Enqueue(event.key, fex::Operation::PRESS, fex::BoundActionEnqueue::DO, xEventQueue);
+          target.Enqueue(event.key, fex::Operation::PRESS, fex::BoundActionEnqueue::UNDO, xEventQueue);
+        }
+        else // TODO(fex): holding a key w/o a hold bind sends no key (key is dropped)
+        {
+          target.Enqueue(event.key, fex::Operation::HOLD, fex::BoundActionEnqueue::UNDO, xEventQueue);
+        }
+        timeouts[event.index] = -1;
+      }
+    }
+    else
+    {
+      fex::BoundActionEnqueue bae = (event.pressed) ? fex::BoundActionEnqueue::DO : fex::BoundActionEnqueue::UNDO;
+      target.Enqueue(event.key, fex::Operation::PRESS, bae, xEventQueue);
+    }
+  };
+
   uint8_t previous[10];
   uint8_t current[10];
   memset(previous, 0xFF, 10);
@@ -419,8 +630,112 @@ static void prvProcessKeysTask(void *pvParameters)
     }
 
 
+    // Install layers as they finish loading. The image is only written after
+    // the last layer is queued, so check for it first.
+    bool image_written = keymap_image_written.exchange(false);
+    LoadedLayer *loaded;
+    while (xQueueReceive(xLayerQueue, (void *)&loaded, 0) == pdTRUE)
+    {
+      int layer = std::hash<std::string>()(loaded->name);
+      if (layer == state.active())
+      {
+        leader.Cancel();
+      }
+      layers.Insert(layer, loaded->name, std::move(loaded->layer));
+      if (loaded->name == "BaseLayer" && state.active() == FALLBACK_LAYER)
+      {
+        state.Switch(layer);
+      }
+      delete loaded;
+    }
+
+    // A reload replaces layers under the active one, so it waits until nothing
+    // from the old layers is in use: no key held down, no repeat playing and
+    // no layer from the load keymaps tasks still queued
+    if (uxQueueMessagesWaiting(xReloadQueue) > 0 && uxQueueMessagesWaiting(xLayerQueue) == 0 && fex::repeat_scheduler().Idle())
+    {
+      bool held = false;
+      for (int i = 0; i < 80; i++)
+      {
+        if (keys[i] >= 0 && !(previous[i / 8] & (1 << (i % 8))))
+        {
+          held = true;
+        }
+      }
+
+      KeymapReload *reload;
+      if (!held && xQueueReceive(xReloadQueue, (void *)&reload, 0) == pdTRUE)
+      {
+        leader.Cancel();
+        one_shot.Cancel();
+
+        // Ids are name hashes, so layers that didn't change stay where they are
+        std::vector<int> keep = {FALLBACK_LAYER};
+        for (const std::string &name : reload->names)
+        {
+          keep.push_back(std::hash<std::string>()(name));
+        }
+        layers.Detach(keep);
+        for (LoadedLayer &loaded : reload->changed)
+        {
+          layers.Insert(std::hash<std::string>()(loaded.name), loaded.name, std::move(loaded.layer));
+        }
+        reload->changed.clear();
+
+        // The old image is about to be overwritten, records move to the new one
+        if (!prvIndexKeymapImage(reload->image, true))
+        {
+          layers.Unlink();
+        }
+        delete installed;
+        installed = reload;
+
+        if (!layers.Contains(state.active()))
+        {
+          int base = std::hash<std::string>()("BaseLayer");
+          state.Switch(layers.Contains(base) ? base : FALLBACK_LAYER);
+        }
+
+        // Only loaded layers refer to actions now, unloaded ones intern theirs again
+        std::unordered_set<const fex::BoundAction *> live;
+        layers.Actions(&live);
+        size_t freed = fex::action_pool().Retain(live);
+        printf("Freed %d unused actions, %d left\n", (int)freed, (int)fex::action_pool().size());
+
+        xSemaphoreGive(xReloadInstalled);
+      }
+    }
+
+    if (image_written)
+    {
+      // Left alone unless it is the installed reload's image, a boot loader's could be the one written
+      std::string_view written((const char *)(XIP_BASE + KEYMAP_IMAGE_OFFSET), KEYMAP_IMAGE_SIZE);
+      std::string_view header = installed ? std::string_view(installed->image).substr(0, KEYMAP_IMAGE_HEADER_SIZE) : std::string_view();
+      if (prvIndexKeymapImage(written, false, header))
+      {
+        delete installed;
+        installed = nullptr;
+      }
+    }
+
+    layers.Trim({state.active(), one_shot.layer(), one_shot_target});
+    layers.Publish();
+
     TickType_t now = key.time;
     memcpy(current, key.keys, 10);
+    fex::telemetry().RecordLatency((xTaskGetTickCount() - now) * portTICK_PERIOD_MS);
+
+    fex::KeyEvent event;
+    const fex::Layer &active = layers.Get(state.active());
+
+    leader.Tick(active.leader(), now, xEventQueue);
+
+    // Flush keys held back for a combo once the window has passed
+    combos.Tick(active.combos(), now, pdMS_TO_TICKS(active.combo_window()), xEventQueue);
+    while (combos.Next(&event))
+    {
+      dispatch(event);
+    }
 
     for (int i = 0; i < 10; i++)
     {
@@ -428,12 +743,13 @@ static void prvProcessKeysTask(void *pvParameters)
       {
         // volatile int x = i * 8 + j;
         // printf("%d\n", x);
-        if (layers[layer].second.Bound(keys[i * 8 + j], fex::Operation::HOLD) 
+        int held_layer = (keys[i * 8 + j] == one_shot_key) ? one_shot_target : state.active();
+        if (layers.Get(held_layer).Bound(keys[i * 8 + j], fex::Operation::HOLD) 
         && timeouts[i * 8 + j] != -1 
         && now - timeouts[i * 8 + j] > hold)
         {
           printf("holdng key: %d\n", timeouts[i * 8 + j]);
-          layers[layer].second.Enqueue(keys[i * 8 + j], fex::Operation::HOLD, fex::BoundActionEnqueue::DO, xEventQueue);
+          layers.Get(held_layer).Enqueue(keys[i * 8 + j], fex::Operation::HOLD, fex::BoundActionEnqueue::DO, xEventQueue);
           timeouts[i * 8 + j] = -1;
         }
       }
@@ -447,34 +763,16 @@ static void prvProcessKeysTask(void *pvParameters)
       {
         if ((prev & 1) != (curr & 1))
         {
-          bool pressed = !(curr & 1);
-
-          if (layers[layer].second.on_hold_bound())
-          // if (layers[layer].second.Bound(keys[i * 8 + j], fex::Operation::HOLD))
+          if (!(curr & 1))
           {
-            if (pressed)
-            {
-              printf("fex: pressed??\n");
-              timeouts[i * 8 + j] = now;
-            }
-            else
-            {
-              if (timeouts[i * 8 + j] != -1 && now - timeouts[i * 8 + j] < hold)
-              {
-                layers[layer].second.Enqueue(keys[i * 8 + j], fex::Operation::PRESS, fex::BoundActionEnqueue::DO, xEventQueue);
-                layers[layer].second.Enqueue(keys[i * 8 + j], fex::Operation::PRESS, fex::BoundActionEnqueue::UNDO, xEventQueue);
-              }
-              else // TODO(fex): holding a key w/o a hold bind sends no key (key is dropped)
-              {
-                layers[layer].second.Enqueue(keys[i * 8 + j], fex::Operation::HOLD, fex::BoundActionEnqueue::UNDO, xEventQueue);
-              }
-              timeouts[i * 8 + j] = -1;
-            }
+            fex::telemetry().CountPress(keys[i * 8 + j]);
           }
-          else
+
+          // Layer switches take effect immediately, so look the layer up per edge
+          combos.Process(layers.Get(state.active()).combos(), {i * 8 + j, keys[i * 8 + j], !(curr & 1), now}, xEventQueue);
+          while (combos.Next(&event))
           {
-            fex::BoundActionEnqueue bae = (pressed) ? fex::BoundActionEnqueue::DO : fex::BoundActionEnqueue::UNDO;
-            layers[layer].second.Enqueue(keys[i * 8 + j], fex::Operation::PRESS, bae, xEventQueue);
+            dispatch(event);
           }
         }
 
@@ -515,7 +813,9 @@ static void prvDrawDisplaysTask(void *pvParameters)
     // display.setTextSize(1);
     // display.setTextColor(WHITE);
     // display.setCursor(0, SSD1306_LCDHEIGHT / 3);
-    // display.println(layers[layer].first.c_str());
+    // auto set = fex::shared_layer_set().Read();
+    // const std::string *name = set->Name(fex::layer_state().snapshot());
+    // display.println(name ? name->c_str() : "");
     // display.display();
     // display2.setTextSize(1);
     // display2.setTextColor(WHITE);
@@ -531,6 +831,108 @@ static void prvDrawDisplaysTask(void *pvParameters)
 
 /*-----------------------------------------------------------*/
 
+static uint8_t modifier_bit(uint8_t code)
+{
+  switch (code)
+  {
+  case HID_KEY_CONTROL_LEFT:
+    return KEYBOARD_MODIFIER_LEFTCTRL;
+  case HID_KEY_SHIFT_LEFT:
+    return KEYBOARD_MODIFIER_LEFTSHIFT;
+  case HID_KEY_ALT_LEFT:
+    return KEYBOARD_MODIFIER_LEFTALT;
+  case HID_KEY_GUI_LEFT:
+    return KEYBOARD_MODIFIER_LEFTGUI;
+  case HID_KEY_CONTROL_RIGHT:
+    return KEYBOARD_MODIFIER_RIGHTCTRL;
+  case HID_KEY_SHIFT_RIGHT:
+    return KEYBOARD_MODIFIER_RIGHTSHIFT;
+  case HID_KEY_ALT_RIGHT:
+    return KEYBOARD_MODIFIER_RIGHTALT;
+  case HID_KEY_GUI_RIGHT:
+    return KEYBOARD_MODIFIER_RIGHTGUI;
+  default:
+    return 0;
+  }
+}
+
+// Keyboard report state, only touched by the HID task
+static uint8_t keycode[KEY_ROLL_OVER] = {0};
+static uint8_t modifer = 0;
+
+// Returns true if code is a key rather than a modifier
+static bool press_code(uint8_t code)
+{
+  uint8_t bit = modifier_bit(code);
+  if (bit)
+  {
+    modifer = modifer | bit;
+    return false;
+  }
+
+  uint8_t index = 0;
+  while (index < KEY_ROLL_OVER)
+  {
+    // Already down, don't take a second slot for it
+    if (keycode[index] == code)
+    {
+      return true;
+    }
+    index++;
+  }
+
+  index = 0;
+  while (index < KEY_ROLL_OVER)
+  {
+    if (keycode[index] == 0)
+    {
+      break;
+    }
+    index++;
+  }
+
+  if (index == KEY_ROLL_OVER)
+  {
+    // TODO(fex): if next == KEY_ROLL_OVER; report error message
+    return true;
+  }
+
+  keycode[index] = code;
+  return true;
+}
+
+static void release_code(uint8_t code)
+{
+  uint8_t bit = modifier_bit(code);
+  if (bit)
+  {
+    modifer = modifer & ~bit;
+    return;
+  }
+
+  for (int8_t i = 0; i < KEY_ROLL_OVER; i++)
+  {
+    if (keycode[i] == code)
+    {
+      keycode[i] = 0;
+      break;
+    }
+  }
+}
+
+static void send_keyboard_report(uint8_t modifier)
+{
+  hid_send_complete = false;
+  tud_hid_keyboard_report(REPORT_ID_KEYBOARD, modifier, keycode);
+
+  printf("%d: ", modifier);
+  for (uint8_t i = 0; i < KEY_ROLL_OVER; i++)
+  {
+    printf("%d, ", keycode[i]);
+  }
+  printf("\n");
+}
+
 // TODO(fex): I'd like to delete this entirely
 // and/or make a more generic "process queue" function
 static void send_hid_report()
@@ -546,10 +948,26 @@ static void send_hid_report()
     return;
   }
 
-  static uint8_t keycode[KEY_ROLL_OVER] = {0};
-  static uint8_t modifer = 0;
+  static uint8_t one_shot_modifier = 0;
   static uint8_t mouse_buttons = 0;
 
+  // Repeats are applied straight to the report, ahead of queued events
+  fex::RepeatDelta delta;
+  if (fex::repeat_scheduler().Next(&delta))
+  {
+    if (delta.press)
+    {
+      press_code(delta.code);
+    }
+    else
+    {
+      release_code(delta.code);
+    }
+
+    send_keyboard_report(modifer);
+    return;
+  }
+
   fex::QueueMessage msg;
   if (xQueueReceive(xEventQueue, (void *)&msg, 0) != pdTRUE)
   {
@@ -568,6 +986,12 @@ static void send_hid_report()
     return;
   }
 
+  if (msg.type == fex::MessageType::RELOAD_KEYMAPS)
+  {
+    keymap_reload_request();
+    return;
+  }
+
   if (msg.type == fex::MessageType::MOUSE_MOVE_UP_DOWN)
   {
     hid_send_complete = false;
@@ -612,12 +1036,6 @@ static void send_hid_report()
     return;
   }
 
-  if (msg.type == fex::MessageType::LAYER_SWITCH)
-  {
-    layer = msg.layer;
-    return;
-  }
-
   if (msg.type == fex::MessageType::DELAY)
   {
     // TODO(fex): There is a weird bug where state gets messed
@@ -627,118 +1045,44 @@ static void send_hid_report()
     return;
   }
 
-  if (msg.type == fex::MessageType::PRESS)
+  if (msg.type == fex::MessageType::ONE_SHOT_MODIFIER)
   {
+    // Held until the next key goes out, tapping it again cancels it
     for (uint8_t i = 0; i < msg.length; i++)
     {
-      uint8_t code = msg.codes[i];
-      switch (code)
-      {
-      case HID_KEY_CONTROL_LEFT:
-        modifer = modifer | KEYBOARD_MODIFIER_LEFTCTRL;
-        break;
-      case HID_KEY_SHIFT_LEFT:
-        modifer = modifer | KEYBOARD_MODIFIER_LEFTSHIFT;
-        break;
-      case HID_KEY_ALT_LEFT:
-        modifer = modifer | KEYBOARD_MODIFIER_LEFTALT;
-        break;
-      case HID_KEY_GUI_LEFT:
-        modifer = modifer | KEYBOARD_MODIFIER_LEFTGUI;
-        break;
-      case HID_KEY_CONTROL_RIGHT:
-        modifer = modifer | KEYBOARD_MODIFIER_RIGHTCTRL;
-        break;
-      case HID_KEY_SHIFT_RIGHT:
-        modifer = modifer | KEYBOARD_MODIFIER_RIGHTSHIFT;
-        break;
-      case HID_KEY_ALT_RIGHT:
-        modifer = modifer | KEYBOARD_MODIFIER_RIGHTALT;
-        break;
-      case HID_KEY_GUI_RIGHT:
-        modifer = modifer | KEYBOARD_MODIFIER_RIGHTGUI;
-        break;
-
-      default:
-      {
-        uint8_t index = 0;
-        while (index < KEY_ROLL_OVER)
-        {
-          if (keycode[index] == 0)
-          {
-            break;
-          }
-          index++;
-        }
-
-        if (index == KEY_ROLL_OVER)
-        {
-          // TODO(fex): if next == KEY_ROLL_OVER; report error message
-        }
-
-        keycode[index] = code;
-        break;
-      }
-      }
+      one_shot_modifier = one_shot_modifier ^ modifier_bit(msg.codes[i]);
     }
+    return;
   }
 
-  if (msg.type == fex::MessageType::RELEASE)
+  uint8_t report_modifier = modifer;
+
+  if (msg.type == fex::MessageType::PRESS)
   {
     for (uint8_t i = 0; i < msg.length; i++)
     {
-      uint8_t code = msg.codes[i];
-      switch (code)
-      {
-      case HID_KEY_CONTROL_LEFT:
-        modifer = modifer & ~KEYBOARD_MODIFIER_LEFTCTRL;
-        break;
-      case HID_KEY_SHIFT_LEFT:
-        modifer = modifer & ~KEYBOARD_MODIFIER_LEFTSHIFT;
-        break;
-      case HID_KEY_ALT_LEFT:
-        modifer = modifer & ~KEYBOARD_MODIFIER_LEFTALT;
-        break;
-      case HID_KEY_GUI_LEFT:
-        modifer = modifer & ~KEYBOARD_MODIFIER_LEFTGUI;
-        break;
-      case HID_KEY_CONTROL_RIGHT:
-        modifer = modifer & ~KEYBOARD_MODIFIER_RIGHTCTRL;
-        break;
-      case HID_KEY_SHIFT_RIGHT:
-        modifer = modifer & ~KEYBOARD_MODIFIER_RIGHTSHIFT;
-        break;
-      case HID_KEY_ALT_RIGHT:
-        modifer = modifer & ~KEYBOARD_MODIFIER_RIGHTALT;
-        break;
-      case HID_KEY_GUI_RIGHT:
-        modifer = modifer & ~KEYBOARD_MODIFIER_RIGHTGUI;
-        break;
-
-      default:
+      if (press_code(msg.codes[i]))
       {
-        for (int8_t i = 0; i < KEY_ROLL_OVER; i++)
-        {
-          if (keycode[i] == code)
-          {
-            keycode[i] = 0;
-            break;
-          }
-        }
-      }
+        // One shot modifiers ride along with the first real key press
+        report_modifier = report_modifier | one_shot_modifier;
+        one_shot_modifier = 0;
       }
     }
-  }
 
-  hid_send_complete = false;
-  tud_hid_keyboard_report(REPORT_ID_KEYBOARD, modifer, keycode);
+    report_modifier = report_modifier | modifer;
+  }
 
-  printf("%d: ", modifer);
-  for (uint8_t i = 0; i < KEY_ROLL_OVER; i++)
+  if (msg.type == fex::MessageType::RELEASE)
   {
-    printf("%d, ", keycode[i]);
+    for (uint8_t i = 0; i < msg.length; i++)
+    {
+      release_code(msg.codes[i]);
+    }
+
+    report_modifier = modifer;
   }
-  printf("\n");
+
+  send_keyboard_report(report_modifier);
 }
 
 static void prvUsbHidTask(void *pvParameters)
@@ -785,6 +1129,122 @@ static void prvBlinkTask(void *pvParameters)
 
 /*-----------------------------------------------------------*/
 
+static void prvLoadKeymapsTask(void *pvParameters)
+{
+  printf("Starting Load Keymaps Task...\n");
+
+  // Everything parsing leaves behind is dropped in one go after each file
+  fex::Arena arena(pvParameters, PARSE_ARENA_SIZE);
+
+  int index;
+  while ((index = next_keymap_file++) < keymap_files.size())
+  {
+    const std::string &file = keymap_files[index];
+
+    LoadedLayer *loaded = new LoadedLayer{file, fex::Layer()};
+    printf("core %d: loading %s\n", get_core_num(), file.c_str());
+    fex::KeymapDeps deps;
+
+    // USB is up by now and the host may have the drive mounted, so compiled
+    // keymaps are only read, never written back
+    std::string error = fex::LoadKeymap(fs, file, &loaded->layer, &deps, &arena, false);
+    arena.Reset();
+
+    xSemaphoreTake(xKeymapMutex, portMAX_DELAY);
+    if (error != "")
+    {
+      printf("%s: '%s'\n", file.c_str(), error.c_str());
+      parse_status = error;
+      fex::telemetry().AddParseError(file + ": " + error);
+    }
+    else
+    {
+      keymap_deps[file] = std::move(deps);
+    }
+    keymap_image.Add(file, loaded->layer);
+    xSemaphoreGive(xKeymapMutex);
+
+    xQueueSend(xLayerQueue, (void *)&loaded, portMAX_DELAY);
+  }
+
+  printf("core %d: parse arena peak %d of %d bytes, %d spilled to heap\n", get_core_num(), (int)arena.peak(), (int)arena.size(), (int)arena.spilled());
+
+  // The last loader out rebuilds the image, unless something failed to parse
+  if (--keymap_loaders_running == 0)
+  {
+    fs.Unmount();
+
+    xSemaphoreTake(xKeymapMutex, portMAX_DELAY);
+    if (parse_status == "Parse: Success")
+    {
+      keymap_image_written = prvWriteKeymapImage(keymap_image.Finish(keymap_sources));
+    }
+    keymap_image = fex::KeymapImageBuilder();
+    xSemaphoreGive(xKeymapMutex);
+
+    prvReportHeap("after load");
+    keymap_loaders_done = true;
+  }
+
+  vTaskDelete(NULL);
+}
+
+/*-----------------------------------------------------------*/
+
+static void prvReloadKeymapsTask(void *pvParameters)
+{
+  printf("Starting Reload Keymaps Task...\n");
+
+  fex::Arena arena(pvParameters, PARSE_ARENA_SIZE);
+
+  while (true)
+  {
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+    // Hosts write a file as many separate commands, wait for them to stop
+    while (ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(KEYMAP_RELOAD_DEBOUNCE_MS)) > 0)
+    {
+    }
+
+    // Host writes are held in the flash cache until now
+    flash_flush();
+    flash_stats_t stats;
+    flash_get_stats(&stats);
+    printf("Flash: %d sector writes, %d erases, %d erases avoided, %d written without erase, %d pages programmed, %d evictions, %d relocations\n",
+           (int)stats.writes, (int)stats.erases, (int)stats.erases_avoided, (int)stats.program_only, (int)stats.pages_programmed, (int)stats.evictions, (int)stats.relocations);
+
+    // The load keymaps tasks share the filesystem, the image and the arena buffer
+    while (!keymap_loaders_done)
+    {
+      vTaskDelay(pdMS_TO_TICKS(KEYMAP_RELOAD_DEBOUNCE_MS));
+    }
+
+    prvReloadKeymaps(&arena);
+  }
+}
+
+static void prvFlashWriterTask(void *pvParameters)
+{
+  printf("Starting Flash Writer Task...\n");
+
+  while (true)
+  {
+    flash_write_back_next();
+  }
+}
+
+/*-----------------------------------------------------------*/
+
+void keymap_reload_request(void)
+{
+  if (reload_keymaps_handle != NULL)
+  {
+    xTaskNotifyGive(reload_keymaps_handle);
+  }
+}
+
+/*-----------------------------------------------------------*/
+
 void tud_hid_report_complete_cb(uint8_t instance, uint8_t const *report, uint8_t len)
 {
   hid_send_complete = true;
@@ -792,6 +1252,217 @@ void tud_hid_report_complete_cb(uint8_t instance, uint8_t const *report, uint8_t
 
 /*-----------------------------------------------------------*/
 
+static std::vector<std::string> prvListKeymapFiles()
+{
+  printf("Listing filesystem\n");
+  std::vector<std::string> files = fs.List("/");
+  printf("Done listing filesystem\n");
+
+  printf("Collecting files on disk\n");
+  std::vector<std::string> names;
+  for (auto file : files)
+  {
+    printf("--- '%s'\n", file.c_str());
+
+    int idx = file.rfind('.');
+    if (idx != std::string::npos)
+    {
+      std::string ext = file.substr(idx + 1);
+      if (ext == "kmf")
+      {
+        names.push_back(file.substr(2, idx - 2));
+      }
+    }
+  }
+  return names;
+}
+
+/*-----------------------------------------------------------*/
+
+static void prvReloadKeymaps(fex::Arena *arena)
+{
+  printf("Reloading keymaps\n");
+  if (!fs.Mount())
+  {
+    return;
+  }
+
+  if (fs.FileExists("//KEYMAP.IMG"))
+  {
+    printf("KEYMAP.IMG is only read at boot\n");
+    fs.Unmount();
+    return;
+  }
+
+  std::vector<std::string> names = prvListKeymapFiles();
+  uint32_t sources = fex::KeymapSourcesStamp(fs, names);
+
+  // Records of the layers in use, while the image still matches them
+  std::unordered_map<std::string, std::string_view> records;
+  std::string_view current((const char *)(XIP_BASE + KEYMAP_IMAGE_OFFSET), KEYMAP_IMAGE_SIZE);
+  fex::KeymapImageInfo info;
+  std::vector<fex::KeymapImageEntry> entries;
+  flash_xip_lock();
+  bool indexed = fex::CheckKeymapImage(current, &info) && info.sources == keymap_sources && fex::IndexKeymapImage(info, &entries);
+  flash_xip_unlock();
+  if (indexed)
+  {
+    for (const fex::KeymapImageEntry &entry : entries)
+    {
+      records[entry.name] = entry.record;
+    }
+  }
+
+  // Files whose contents still hash the same are not parsed, their record is
+  // carried over as is. Directory entries can't tell, FAT times only resolve
+  // to two seconds. Nothing is written to the drive, the host has it mounted,
+  // but changed files whose contents are the same still load from their
+  // compiled keymaps.
+  KeymapReload *reload = new KeymapReload{names, {}};
+  std::unordered_map<std::string, fex::KeymapDeps> deps;
+  fex::KeymapImageBuilder image;
+  std::string error;
+  std::string error_file;
+  for (const std::string &name : names)
+  {
+    auto known = keymap_deps.find(name);
+    auto record = records.find(name);
+    if (known != keymap_deps.end() && record != records.end() && fex::HashFile("//" + name + ".kmf") == known->second.stamp.hash)
+    {
+      flash_xip_lock();
+      image.AddRecord(name, record->second);
+      flash_xip_unlock();
+      deps[name] = known->second;
+      continue;
+    }
+
+    fex::Layer layer;
+    error = fex::LoadKeymap(fs, name, &layer, &deps[name], arena, false);
+    arena->Reset();
+    if (error != "")
+    {
+      printf("%s: '%s'\n", name.c_str(), error.c_str());
+      error_file = name;
+      break;
+    }
+
+    image.Add(name, layer);
+    reload->changed.push_back({name, std::move(layer)});
+  }
+  fs.Unmount();
+
+  // Every file carried over and none gone, the layers in use still stand
+  if (error == "" && reload->changed.empty() && deps.size() == keymap_deps.size())
+  {
+    printf("Keymaps unchanged\n");
+    delete reload;
+    return;
+  }
+
+  // References are by name, so they resolve to whatever now has that name.
+  // Only ones left without a layer need pointing out.
+  if (error == "")
+  {
+    for (const auto &[name, file] : deps)
+    {
+      for (const std::string &target : file.references)
+      {
+        if (deps.find(target) == deps.end())
+        {
+          printf("%s: no layer named %s\n", name.c_str(), target.c_str());
+        }
+      }
+    }
+  }
+
+  xSemaphoreTake(xKeymapMutex, portMAX_DELAY);
+  parse_status = (error != "") ? error : "Parse: Success";
+  xSemaphoreGive(xKeymapMutex);
+
+  fex::telemetry().ClearParseErrors();
+  if (error != "")
+  {
+    fex::telemetry().AddParseError(error_file + ": " + error);
+  }
+
+  // Any error keeps the layers already in use
+  if (error != "")
+  {
+    delete reload;
+    return;
+  }
+
+  printf("Recompiled %d of %d keymaps\n", (int)reload->changed.size(), (int)names.size());
+  reload->image = image.Finish(sources);
+  xQueueSend(xReloadQueue, (void *)&reload, portMAX_DELAY);
+
+  // Layers load from reload->image once it is installed, so nothing reads the
+  // old image. The process keys task frees reload after the write is indexed.
+  xSemaphoreTake(xReloadInstalled, portMAX_DELAY);
+  keymap_sources = sources;
+  keymap_deps = std::move(deps);
+
+  keymap_image_written = prvWriteKeymapImage(reload->image);
+}
+
+/*-----------------------------------------------------------*/
+
+static bool prvIndexKeymapImage(std::string_view image, bool any_sources, std::string_view header)
+{
+  // The image is only trusted while the files it was built from are untouched.
+  // A header, when given, names the image expected: its body size and CRC.
+  fex::KeymapImageInfo info;
+  std::vector<fex::KeymapImageEntry> entries;
+  flash_xip_lock();
+  bool indexed = image.substr(0, header.size()) == header && fex::CheckKeymapImage(image, &info) &&
+                 (any_sources || info.sources == keymap_sources) && fex::IndexKeymapImage(info, &entries);
+  flash_xip_unlock();
+  if (!indexed)
+  {
+    return false;
+  }
+
+  printf("Indexed %d layers in keymap image\n", info.layer_count);
+  for (const fex::KeymapImageEntry &entry : entries)
+  {
+    layers.Index(std::hash<std::string>()(entry.name), entry.name, entry.record);
+  }
+  return true;
+}
+
+/*-----------------------------------------------------------*/
+
+static bool prvWriteKeymapImage(const std::string &built)
+{
+  extern char __flash_binary_end;
+  if (built.size() > KEYMAP_IMAGE_SIZE)
+  {
+    printf("Keymap image too large (%d bytes)\n", (int)built.size());
+    return false;
+  }
+  if ((uintptr_t)&__flash_binary_end > XIP_BASE + KEYMAP_IMAGE_OFFSET)
+  {
+    printf("Firmware overlaps the keymap image partition\n");
+    return false;
+  }
+
+  printf("Writing keymap image (%d bytes)\n", (int)built.size());
+  flash_program(KEYMAP_IMAGE_OFFSET, built.data(), built.size());
+  return true;
+}
+
+/*-----------------------------------------------------------*/
+
+static void prvReportHeap(const char *when)
+{
+  // The newlib heap never gives memory back to sbrk, so its arena is the high water mark
+  struct mallinfo info = mallinfo();
+  printf("Heap %s: %d used, %d free, %d high water, FreeRTOS heap %d free\n",
+         when, (int)info.uordblks, (int)info.fordblks, (int)info.arena, (int)xPortGetFreeHeapSize());
+}
+
+/*-----------------------------------------------------------*/
+
 static void prvHardwareInit(void)
 {
   stdio_init_all();
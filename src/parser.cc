@@ -3,6 +3,7 @@
 #include <algorithm>
 #include <iostream>
 #include <optional>
+#include <string_view>
 #include <unordered_map>
 
 #include "actions.h"
@@ -14,234 +15,233 @@
 namespace fex
 {
 
-	const std::unordered_map<std::string, int> key_names({{"A", 0x04}, // Keyboard a and A
-														  {"B", 0x05}, // Keyboard b and B
-														  {"C", 0x06}, // Keyboard c and C
-														  {"D", 0x07}, // Keyboard d and D
-														  {"E", 0x08}, // Keyboard e and E
-														  {"F", 0x09}, // Keyboard f and F
-														  {"G", 0x0a}, // Keyboard g and G
-														  {"H", 0x0b}, // Keyboard h and H
-														  {"I", 0x0c}, // Keyboard i and I
-														  {"J", 0x0d}, // Keyboard j and J
-														  {"K", 0x0e}, // Keyboard k and K
-														  {"L", 0x0f}, // Keyboard l and L
-														  {"M", 0x10}, // Keyboard m and M
-														  {"N", 0x11}, // Keyboard n and N
-														  {"O", 0x12}, // Keyboard o and O
-														  {"P", 0x13}, // Keyboard p and P
-														  {"Q", 0x14}, // Keyboard q and Q
-														  {"R", 0x15}, // Keyboard r and R
-														  {"S", 0x16}, // Keyboard s and S
-														  {"T", 0x17}, // Keyboard t and T
-														  {"U", 0x18}, // Keyboard u and U
-														  {"V", 0x19}, // Keyboard v and V
-														  {"W", 0x1a}, // Keyboard w and W
-														  {"X", 0x1b}, // Keyboard x and X
-														  {"Y", 0x1c}, // Keyboard y and Y
-														  {"Z", 0x1d}, // Keyboard z and Z
-
-														  {"1", 0x1e}, // Keyboard 1 and !
-														  {"2", 0x1f}, // Keyboard 2 and @
-														  {"3", 0x20}, // Keyboard 3 and//
-														  {"4", 0x21}, // Keyboard 4 and $
-														  {"5", 0x22}, // Keyboard 5 and %
-														  {"6", 0x23}, // Keyboard 6 and ^
-														  {"7", 0x24}, // Keyboard 7 and &
-														  {"8", 0x25}, // Keyboard 8 and *
-														  {"9", 0x26}, // Keyboard 9 and (
-														  {"0", 0x27}, // Keyboard 0 and )
-
-														  {"ENTER", 0x28},		  // Keyboard Return (ENTER)
-														  {"ESC", 0x29},		  // Keyboard ESCAPE
-														  {"ESCAPE", 0x29},		  // Keyboard ESCAPE
-														  {"BACKSPACE", 0x2a},	  // Keyboard DELETE (Backspace)
-														  {"TAB", 0x2b},		  // Keyboard Tab
-														  {"SPACE", 0x2c},		  // Keyboard Spacebar
-														  {"LEFTBRACE", 0x2f},	  // Keyboard [ and {
-														  {"LEFTBRACKET", 0x2f},  // Keyboard [ and {
-														  {"MINUS", 0x2d},		  // Keyboard - and _
-														  {"EQUAL", 0x2e},		  // Keyboard = and +
-														  {"EQUALS", 0x2e},		  // Keyboard = and +
-														  {"PLUS", 0x2e},		  // Keyboard = and +
-														  {"RIGHTBRACE", 0x30},	  // Keyboard ] and }
-														  {"RIGHTBRACKET", 0x30}, // Keyboard ] and }
-														  {"BACKSLASH", 0x31},	  // Keyboard \ and |
-														  {"HASHTILDE", 0x32},	  // Keyboard Non-US // and ~
-														  {"HASHANDTILDE", 0x32}, // Keyboard Non-US // and ~
-														  {"SEMICOLON", 0x33},	  // Keyboard ; and ,
-														  {"APOSTROPHE", 0x34},	  // Keyboard " and "
-														  {"QUOTE", 0x34},		  // Keyboard " and "
-														  {"GRAVE", 0x35},		  // Keyboard ` and ~
-														  {"BACKTICK", 0x35},	  // Keyboard ` and ~
-														  {"TILDE", 0x35},		  // Keyboard ` and ~
-														  {"COMMA", 0x36},		  // Keyboard , and <
-														  {"DOT", 0x37},		  // Keyboard . and >
-														  {"PERIOD", 0x37},		  // Keyboard . and >
-														  {"SLASH", 0x38},		  // Keyboard / and ?
-														  {"FORWARDSLASH", 0x38}, // Keyboard / and ?
-														  {"CAPSLOCK", 0x39},	  // Keyboard Caps Lock
-
-														  {"F1", 0x3a},	 // Keyboard F1
-														  {"F2", 0x3b},	 // Keyboard F2
-														  {"F3", 0x3c},	 // Keyboard F3
-														  {"F4", 0x3d},	 // Keyboard F4
-														  {"F5", 0x3e},	 // Keyboard F5
-														  {"F6", 0x3f},	 // Keyboard F6
-														  {"F7", 0x40},	 // Keyboard F7
-														  {"F8", 0x41},	 // Keyboard F8
-														  {"F9", 0x42},	 // Keyboard F9
-														  {"F10", 0x43}, // Keyboard F10
-														  {"F11", 0x44}, // Keyboard F11
-														  {"F12", 0x45}, // Keyboard F12
-
-														  {"SYSRQ", 0x46},		// Keyboard Print Screen
-														  {"SCROLLLOCK", 0x47}, // Keyboard Scroll Lock
-														  {"PAUSE", 0x48},		// Keyboard Pause
-														  {"INSERT", 0x49},		// Keyboard Insert
-														  {"HOME", 0x4a},		// Keyboard Home
-														  {"PAGEUP", 0x4b},		// Keyboard Page Up
-														  {"DELETE", 0x4c},		// Keyboard Delete Forward
-														  {"END", 0x4d},		// Keyboard End
-														  {"PAGEDOWN", 0x4e},	// Keyboard Page Down
-														  {"RIGHT", 0x4f},		// Keyboard Right Arrow
-														  {"RIGHTARROW", 0x4f}, // Keyboard Right Arrow
-														  {"LEFT", 0x50},		// Keyboard Left Arrow
-														  {"LEFTARROW", 0x50},	// Keyboard Left Arrow
-														  {"DOWN", 0x51},		// Keyboard Down Arrow
-														  {"DOWNARROW", 0x51},	// Keyboard Down Arrow
-														  {"UP", 0x52},			// Keyboard Up Arrow
-														  {"UPARROW", 0x52},	// Keyboard Up Arrow
-
-														  {"NUMLOCK", 0x53},		// Keyboard Num Lock and Clear
-														  {"KPSLASH", 0x54},		// Keypad /
-														  {"NUMPADSLASH", 0x54},	// Keypad /
-														  {"KPASTERISK", 0x55},		// Keypad *
-														  {"NUMPADASTERISK", 0x55}, // Keypad *
-														  {"NUMPADTIMES", 0x55},	// Keypad *
-														  {"KPMINUS", 0x56},		// Keypad -
-														  {"NUMPADMINUS", 0x56},	// Keypad -
-														  {"KPPLUS", 0x57},			// Keypad +
-														  {"NUMPADPLUS", 0x57},		// Keypad +
-														  {"KPENTER", 0x58},		// Keypad ENTER
-														  {"NUMPADENTER", 0x58},	// Keypad ENTER
-														  {"KP1", 0x59},			// Keypad 1 and End
-														  {"NUMPAD1", 0x59},		// Keypad 1 and End
-														  {"KP2", 0x5a},			// Keypad 2 and Down Arrow
-														  {"NUMPAD2", 0x5a},		// Keypad 2 and Down Arrow
-														  {"KP3", 0x5b},			// Keypad 3 and PageDn
-														  {"NUMPAD3", 0x5b},		// Keypad 3 and PageDn
-														  {"KP4", 0x5c},			// Keypad 4 and Left Arrow
-														  {"NUMPAD4", 0x5c},		// Keypad 4 and Left Arrow
-														  {"KP5", 0x5d},			// Keypad 5
-														  {"NUMPAD5", 0x5d},		// Keypad 5
-														  {"KP6", 0x5e},			// Keypad 6 and Right Arrow
-														  {"NUMPAD6", 0x5e},		// Keypad 6 and Right Arrow
-														  {"KP7", 0x5f},			// Keypad 7 and Home
-														  {"NUMPAD7", 0x5f},		// Keypad 7 and Home
-														  {"KP8", 0x60},			// Keypad 8 and Up Arrow
-														  {"NUMPAD8", 0x60},		// Keypad 8 and Up Arrow
-														  {"KP9", 0x61},			// Keypad 9 and Page Up
-														  {"NUMPAD9", 0x61},		// Keypad 9 and Page Up
-														  {"KP0", 0x62},			// Keypad 0 and Insert
-														  {"NUMPAD0", 0x62},		// Keypad 0 and Insert
-														  {"KPDOT", 0x63},			// Keypad . and Delete
-														  {"NUMPADDOT", 0x63},		// Keypad . and Delete
-
-														  {"102ND", 0x64},		  // Keyboard Non-US \ and |
-														  {"COMPOSE", 0x65},	  // Keyboard Application
-														  {"POWER", 0x66},		  // Keyboard Power
-														  {"KPEQUAL", 0x67},	  // Keypad =
-														  {"NUMPADEQUAL", 0x67},  // Keypad =
-														  {"NUMPADEQUALS", 0x67}, // Keypad =
-
-														  {"F13", 0x68}, // Keyboard F13
-														  {"F14", 0x69}, // Keyboard F14
-														  {"F15", 0x6a}, // Keyboard F15
-														  {"F16", 0x6b}, // Keyboard F16
-														  {"F17", 0x6c}, // Keyboard F17
-														  {"F18", 0x6d}, // Keyboard F18
-														  {"F19", 0x6e}, // Keyboard F19
-														  {"F20", 0x6f}, // Keyboard F20
-														  {"F21", 0x70}, // Keyboard F21
-														  {"F22", 0x71}, // Keyboard F22
-														  {"F23", 0x72}, // Keyboard F23
-														  {"F24", 0x73}, // Keyboard F24
-
-														  {"OPEN", 0x74},			  // Keyboard Execute
-														  {"HELP", 0x75},			  // Keyboard Help
-														  {"PROPS", 0x76},			  // Keyboard Menu
-														  {"FRONT", 0x77},			  // Keyboard Select
-														  {"STOP", 0x78},			  // Keyboard Stop
-														  {"AGAIN", 0x79},			  // Keyboard Again
-														  {"UNDO", 0x7a},			  // Keyboard Undo
-														  {"CUT", 0x7b},			  // Keyboard Cut
-														  {"COPY", 0x7c},			  // Keyboard Copy
-														  {"PASTE", 0x7d},			  // Keyboard Paste
-														  {"FIND", 0x7e},			  // Keyboard Find
-														  {"MUTE", 0x7f},			  // Keyboard Mute
-														  {"VOLUMEUP", 0x80},		  // Keyboard Volume Up
-														  {"VOLUMEDOWN", 0x81},		  // Keyboard Volume Down
-														  {"KPCOMMA", 0x85},		  // Keypad Comma
-														  {"KEYPAD EQUAL", 0x86},	  // Keypad Equal Sign
-														  {"RO", 0x87},				  // Keyboard International1
-														  {"KATAKANAHIRAGANA", 0x88}, // Keyboard International2
-														  {"YEN", 0x89},			  // Keyboard International3
-														  {"HENKAN", 0x8a},			  // Keyboard International4
-														  {"MUHENKAN", 0x8b},		  // Keyboard International5
-														  {"KPJPCOMMA", 0x8c},		  // Keyboard International6
-														  {"HANGEUL", 0x90},		  // Keyboard LANG1
-														  {"HANJA", 0x91},			  // Keyboard LANG2
-														  {"KATAKANA", 0x92},		  // Keyboard LANG3
-														  {"HIRAGANA", 0x93},		  // Keyboard LANG4
-														  {"ZENKAKUHANKAKU", 0x94},	  // Keyboard LANG5
-														  {"KPLEFTPAREN", 0xb6},	  // Keypad (
-														  {"KPRIGHTPAREN", 0xb7},	  // Keypad )
-
-														  {"CTRL", 0xe0},		  // Keyboard Left Control
-														  {"CONTROL", 0xe0},	  // Keyboard Left Control
-														  {"LEFTCTRL", 0xe0},	  // Keyboard Left Control
-														  {"LEFTCONTROL", 0xe0},  // Keyboard Left Control
-														  {"SHIFT", 0xe1},		  // Keyboard Left Shift
-														  {"LEFTSHIFT", 0xe1},	  // Keyboard Left Shift
-														  {"ALT", 0xe2},		  // Keyboard Left Alt
-														  {"LEFTALT", 0xe2},	  // Keyboard Left Alt
-														  {"LEFTMETA", 0xe3},	  // Keyboard Left GUI
-														  {"WINDOWS", 0xe3},	  // Keyboard Left GUI
-														  {"GUI", 0xe3},		  // Keyboard Left GUI
-														  {"LEFTGUI", 0xe3},	  // Keyboard Left GUI
-														  {"LEFTWINDOWS", 0xe3},  // Keyboard Left GUI
-														  {"RIGHTCTRL", 0xe4},	  // Keyboard Right Control
-														  {"RIGHTCONTROL", 0xe4}, // Keyboard Right Control
-														  {"RIGHTSHIFT", 0xe5},	  // Keyboard Right Shift
-														  {"RIGHTALT", 0xe6},	  // Keyboard Right Alt
-														  {"RIGHTMETA", 0xe7},	  // Keyboard Right GUI
-														  {"RIGHTWINDOWS", 0xe7}, // Keyboard Right GUI
-														  {"RIGHTGUI", 0xe7},	  // Keyboard Right GUI
-
-														  {"MEDIAPLAYPAUSE", 0xe8},
-														  {"MEDIASTOPCD", 0xe9},
-														  {"MEDIAPREVIOUSSONG", 0xea},
-														  {"MEDIANEXTSONG", 0xeb},
-														  {"MEDIAEJECTCD", 0xec},
-														  {"VOLUMEUP", 0xed},
-														  {"MEDIAVOLUMEDOWN", 0xee},
-														  {"MEDIAMUTE", 0xef},
-														  {"MUTE", 0xef},
-														  {"MEDIAWWW", 0xf0},
-														  {"MEDIABACK", 0xf1},
-														  {"BACK", 0xf1},
-														  {"MEDIAFORWARD", 0xf2},
-														  {"FORWARD", 0xf2},
-														  {"MEDIASTOP", 0xf3},
-														  {"MEDIAFIND", 0xf4},
-														  {"MEDIASCROLLUP", 0xf5},
-														  {"MEDIASCROLLDOWN", 0xf6},
-														  {"MEDIAEDIT", 0xf7},
-														  {"MEDIASLEEP", 0xf8},
-														  {"MEDIACOFFEE", 0xf9},
-														  {"MEDIAREFRESH", 0xfa},
-														  {"MEDIACALC", 0xfb}});
+	struct KeyName
+	{
+		std::string_view name;
+		int code;
+	};
+
+	// Note: MUST BE KEPT IN SORTED ORDER
+	// VOLUMEUP and MUTE are the keyboard page codes (0x80, 0x7f), not the media ones (0xed, 0xef)
+	constexpr KeyName key_names[] = {
+		{"0", 0x27},                 // Keyboard 0 and )
+		{"1", 0x1e},                 // Keyboard 1 and !
+		{"102ND", 0x64},             // Keyboard Non-US \ and |
+		{"2", 0x1f},                 // Keyboard 2 and @
+		{"3", 0x20},                 // Keyboard 3 and//
+		{"4", 0x21},                 // Keyboard 4 and $
+		{"5", 0x22},                 // Keyboard 5 and %
+		{"6", 0x23},                 // Keyboard 6 and ^
+		{"7", 0x24},                 // Keyboard 7 and &
+		{"8", 0x25},                 // Keyboard 8 and *
+		{"9", 0x26},                 // Keyboard 9 and (
+		{"A", 0x04},                 // Keyboard a and A
+		{"AGAIN", 0x79},             // Keyboard Again
+		{"ALT", 0xe2},               // Keyboard Left Alt
+		{"APOSTROPHE", 0x34},        // Keyboard " and "
+		{"B", 0x05},                 // Keyboard b and B
+		{"BACK", 0xf1},
+		{"BACKSLASH", 0x31},         // Keyboard \ and |
+		{"BACKSPACE", 0x2a},         // Keyboard DELETE (Backspace)
+		{"BACKTICK", 0x35},          // Keyboard ` and ~
+		{"C", 0x06},                 // Keyboard c and C
+		{"CAPSLOCK", 0x39},          // Keyboard Caps Lock
+		{"COMMA", 0x36},             // Keyboard , and <
+		{"COMPOSE", 0x65},           // Keyboard Application
+		{"CONTROL", 0xe0},           // Keyboard Left Control
+		{"COPY", 0x7c},              // Keyboard Copy
+		{"CTRL", 0xe0},              // Keyboard Left Control
+		{"CUT", 0x7b},               // Keyboard Cut
+		{"D", 0x07},                 // Keyboard d and D
+		{"DELETE", 0x4c},            // Keyboard Delete Forward
+		{"DOT", 0x37},               // Keyboard . and >
+		{"DOWN", 0x51},              // Keyboard Down Arrow
+		{"DOWNARROW", 0x51},         // Keyboard Down Arrow
+		{"E", 0x08},                 // Keyboard e and E
+		{"END", 0x4d},               // Keyboard End
+		{"ENTER", 0x28},             // Keyboard Return (ENTER)
+		{"EQUAL", 0x2e},             // Keyboard = and +
+		{"EQUALS", 0x2e},            // Keyboard = and +
+		{"ESC", 0x29},               // Keyboard ESCAPE
+		{"ESCAPE", 0x29},            // Keyboard ESCAPE
+		{"F", 0x09},                 // Keyboard f and F
+		{"F1", 0x3a},                // Keyboard F1
+		{"F10", 0x43},               // Keyboard F10
+		{"F11", 0x44},               // Keyboard F11
+		{"F12", 0x45},               // Keyboard F12
+		{"F13", 0x68},               // Keyboard F13
+		{"F14", 0x69},               // Keyboard F14
+		{"F15", 0x6a},               // Keyboard F15
+		{"F16", 0x6b},               // Keyboard F16
+		{"F17", 0x6c},               // Keyboard F17
+		{"F18", 0x6d},               // Keyboard F18
+		{"F19", 0x6e},               // Keyboard F19
+		{"F2", 0x3b},                // Keyboard F2
+		{"F20", 0x6f},               // Keyboard F20
+		{"F21", 0x70},               // Keyboard F21
+		{"F22", 0x71},               // Keyboard F22
+		{"F23", 0x72},               // Keyboard F23
+		{"F24", 0x73},               // Keyboard F24
+		{"F3", 0x3c},                // Keyboard F3
+		{"F4", 0x3d},                // Keyboard F4
+		{"F5", 0x3e},                // Keyboard F5
+		{"F6", 0x3f},                // Keyboard F6
+		{"F7", 0x40},                // Keyboard F7
+		{"F8", 0x41},                // Keyboard F8
+		{"F9", 0x42},                // Keyboard F9
+		{"FIND", 0x7e},              // Keyboard Find
+		{"FORWARD", 0xf2},
+		{"FORWARDSLASH", 0x38},      // Keyboard / and ?
+		{"FRONT", 0x77},             // Keyboard Select
+		{"G", 0x0a},                 // Keyboard g and G
+		{"GRAVE", 0x35},             // Keyboard ` and ~
+		{"GUI", 0xe3},               // Keyboard Left GUI
+		{"H", 0x0b},                 // Keyboard h and H
+		{"HANGEUL", 0x90},           // Keyboard LANG1
+		{"HANJA", 0x91},             // Keyboard LANG2
+		{"HASHANDTILDE", 0x32},      // Keyboard Non-US // and ~
+		{"HASHTILDE", 0x32},         // Keyboard Non-US // and ~
+		{"HELP", 0x75},              // Keyboard Help
+		{"HENKAN", 0x8a},            // Keyboard International4
+		{"HIRAGANA", 0x93},          // Keyboard LANG4
+		{"HOME", 0x4a},              // Keyboard Home
+		{"I", 0x0c},                 // Keyboard i and I
+		{"INSERT", 0x49},            // Keyboard Insert
+		{"J", 0x0d},                 // Keyboard j and J
+		{"K", 0x0e},                 // Keyboard k and K
+		{"KATAKANA", 0x92},          // Keyboard LANG3
+		{"KATAKANAHIRAGANA", 0x88},  // Keyboard International2
+		{"KEYPAD EQUAL", 0x86},      // Keypad Equal Sign
+		{"KP0", 0x62},               // Keypad 0 and Insert
+		{"KP1", 0x59},               // Keypad 1 and End
+		{"KP2", 0x5a},               // Keypad 2 and Down Arrow
+		{"KP3", 0x5b},               // Keypad 3 and PageDn
+		{"KP4", 0x5c},               // Keypad 4 and Left Arrow
+		{"KP5", 0x5d},               // Keypad 5
+		{"KP6", 0x5e},               // Keypad 6 and Right Arrow
+		{"KP7", 0x5f},               // Keypad 7 and Home
+		{"KP8", 0x60},               // Keypad 8 and Up Arrow
+		{"KP9", 0x61},               // Keypad 9 and Page Up
+		{"KPASTERISK", 0x55},        // Keypad *
+		{"KPCOMMA", 0x85},           // Keypad Comma
+		{"KPDOT", 0x63},             // Keypad . and Delete
+		{"KPENTER", 0x58},           // Keypad ENTER
+		{"KPEQUAL", 0x67},           // Keypad =
+		{"KPJPCOMMA", 0x8c},         // Keyboard International6
+		{"KPLEFTPAREN", 0xb6},       // Keypad (
+		{"KPMINUS", 0x56},           // Keypad -
+		{"KPPLUS", 0x57},            // Keypad +
+		{"KPRIGHTPAREN", 0xb7},      // Keypad )
+		{"KPSLASH", 0x54},           // Keypad /
+		{"L", 0x0f},                 // Keyboard l and L
+		{"LEFT", 0x50},              // Keyboard Left Arrow
+		{"LEFTALT", 0xe2},           // Keyboard Left Alt
+		{"LEFTARROW", 0x50},         // Keyboard Left Arrow
+		{"LEFTBRACE", 0x2f},         // Keyboard [ and {
+		{"LEFTBRACKET", 0x2f},       // Keyboard [ and {
+		{"LEFTCONTROL", 0xe0},       // Keyboard Left Control
+		{"LEFTCTRL", 0xe0},          // Keyboard Left Control
+		{"LEFTGUI", 0xe3},           // Keyboard Left GUI
+		{"LEFTMETA", 0xe3},          // Keyboard Left GUI
+		{"LEFTSHIFT", 0xe1},         // Keyboard Left Shift
+		{"LEFTWINDOWS", 0xe3},       // Keyboard Left GUI
+		{"M", 0x10},                 // Keyboard m and M
+		{"MEDIABACK", 0xf1},
+		{"MEDIACALC", 0xfb},
+		{"MEDIACOFFEE", 0xf9},
+		{"MEDIAEDIT", 0xf7},
+		{"MEDIAEJECTCD", 0xec},
+		{"MEDIAFIND", 0xf4},
+		{"MEDIAFORWARD", 0xf2},
+		{"MEDIAMUTE", 0xef},
+		{"MEDIANEXTSONG", 0xeb},
+		{"MEDIAPLAYPAUSE", 0xe8},
+		{"MEDIAPREVIOUSSONG", 0xea},
+		{"MEDIAREFRESH", 0xfa},
+		{"MEDIASCROLLDOWN", 0xf6},
+		{"MEDIASCROLLUP", 0xf5},
+		{"MEDIASLEEP", 0xf8},
+		{"MEDIASTOP", 0xf3},
+		{"MEDIASTOPCD", 0xe9},
+		{"MEDIAVOLUMEDOWN", 0xee},
+		{"MEDIAWWW", 0xf0},
+		{"MINUS", 0x2d},             // Keyboard - and _
+		{"MUHENKAN", 0x8b},          // Keyboard International5
+		{"MUTE", 0x7f},              // Keyboard Mute
+		{"N", 0x11},                 // Keyboard n and N
+		{"NUMLOCK", 0x53},           // Keyboard Num Lock and Clear
+		{"NUMPAD0", 0x62},           // Keypad 0 and Insert
+		{"NUMPAD1", 0x59},           // Keypad 1 and End
+		{"NUMPAD2", 0x5a},           // Keypad 2 and Down Arrow
+		{"NUMPAD3", 0x5b},           // Keypad 3 and PageDn
+		{"NUMPAD4", 0x5c},           // Keypad 4 and Left Arrow
+		{"NUMPAD5", 0x5d},           // Keypad 5
+		{"NUMPAD6", 0x5e},           // Keypad 6 and Right Arrow
+		{"NUMPAD7", 0x5f},           // Keypad 7 and Home
+		{"NUMPAD8", 0x60},           // Keypad 8 and Up Arrow
+		{"NUMPAD9", 0x61},           // Keypad 9 and Page Up
+		{"NUMPADASTERISK", 0x55},    // Keypad *
+		{"NUMPADDOT", 0x63},         // Keypad . and Delete
+		{"NUMPADENTER", 0x58},       // Keypad ENTER
+		{"NUMPADEQUAL", 0x67},       // Keypad =
+		{"NUMPADEQUALS", 0x67},      // Keypad =
+		{"NUMPADMINUS", 0x56},       // Keypad -
+		{"NUMPADPLUS", 0x57},        // Keypad +
+		{"NUMPADSLASH", 0x54},       // Keypad /
+		{"NUMPADTIMES", 0x55},       // Keypad *
+		{"O", 0x12},                 // Keyboard o and O
+		{"OPEN", 0x74},              // Keyboard Execute
+		{"P", 0x13},                 // Keyboard p and P
+		{"PAGEDOWN", 0x4e},          // Keyboard Page Down
+		{"PAGEUP", 0x4b},            // Keyboard Page Up
+		{"PASTE", 0x7d},             // Keyboard Paste
+		{"PAUSE", 0x48},             // Keyboard Pause
+		{"PERIOD", 0x37},            // Keyboard . and >
+		{"PLUS", 0x2e},              // Keyboard = and +
+		{"POWER", 0x66},             // Keyboard Power
+		{"PROPS", 0x76},             // Keyboard Menu
+		{"Q", 0x14},                 // Keyboard q and Q
+		{"QUOTE", 0x34},             // Keyboard " and "
+		{"R", 0x15},                 // Keyboard r and R
+		{"RIGHT", 0x4f},             // Keyboard Right Arrow
+		{"RIGHTALT", 0xe6},          // Keyboard Right Alt
+		{"RIGHTARROW", 0x4f},        // Keyboard Right Arrow
+		{"RIGHTBRACE", 0x30},        // Keyboard ] and }
+		{"RIGHTBRACKET", 0x30},      // Keyboard ] and }
+		{"RIGHTCONTROL", 0xe4},      // Keyboard Right Control
+		{"RIGHTCTRL", 0xe4},         // Keyboard Right Control
+		{"RIGHTGUI", 0xe7},          // Keyboard Right GUI
+		{"RIGHTMETA", 0xe7},         // Keyboard Right GUI
+		{"RIGHTSHIFT", 0xe5},        // Keyboard Right Shift
+		{"RIGHTWINDOWS", 0xe7},      // Keyboard Right GUI
+		{"RO", 0x87},                // Keyboard International1
+		{"S", 0x16},                 // Keyboard s and S
+		{"SCROLLLOCK", 0x47},        // Keyboard Scroll Lock
+		{"SEMICOLON", 0x33},         // Keyboard ; and ,
+		{"SHIFT", 0xe1},             // Keyboard Left Shift
+		{"SLASH", 0x38},             // Keyboard / and ?
+		{"SPACE", 0x2c},             // Keyboard Spacebar
+		{"STOP", 0x78},              // Keyboard Stop
+		{"SYSRQ", 0x46},             // Keyboard Print Screen
+		{"T", 0x17},                 // Keyboard t and T
+		{"TAB", 0x2b},               // Keyboard Tab
+		{"TILDE", 0x35},             // Keyboard ` and ~
+		{"U", 0x18},                 // Keyboard u and U
+		{"UNDO", 0x7a},              // Keyboard Undo
+		{"UP", 0x52},                // Keyboard Up Arrow
+		{"UPARROW", 0x52},           // Keyboard Up Arrow
+		{"V", 0x19},                 // Keyboard v and V
+		{"VOLUMEDOWN", 0x81},        // Keyboard Volume Down
+		{"VOLUMEUP", 0x80},          // Keyboard Volume Up
+		{"W", 0x1a},                 // Keyboard w and W
+		{"WINDOWS", 0xe3},           // Keyboard Left GUI
+		{"X", 0x1b},                 // Keyboard x and X
+		{"Y", 0x1c},                 // Keyboard y and Y
+		{"YEN", 0x89},               // Keyboard International3
+		{"Z", 0x1d},                 // Keyboard z and Z
+		{"ZENKAKUHANKAKU", 0x94},    // Keyboard LANG5
+	};
+	static_assert(sorted_by_name(key_names), "key_names must be sorted");
 
 	Operation operation_from_token(const TokenType &type)
 	{
@@ -262,11 +262,11 @@ namespace fex
 		}
 	}
 
-	std::pair<std::string, std::vector<Token>> parse_action(
-		const std::string &source, const std::vector<Token> &tokens, int *index)
+	std::pair<std::string, TokenSpan> parse_action(
+		std::string_view source, TokenSpan tokens, int *index)
 	{
 		// Note: MUST BE KEPT IN SORTED ORDER
-		std::vector<TokenType> front_disallowed_tokens = {
+		static const std::vector<TokenType> front_disallowed_tokens = {
 			TokenType::SYM_COMMA,
 			TokenType::SYM_PLUS,
 			TokenType::STRING_LIT,
@@ -275,16 +275,18 @@ namespace fex
 			TokenType::PARAMETER_REPEATEDLY,
 			TokenType::PARAMETER_AT_HUMAN_SPEED,
 			TokenType::PARAMETER_UNTIL_RELEASED,
+			TokenType::PARAMETER_AFTER,
+			TokenType::PARAMETER_EVERY,
 		};
 
 		// Note: MUST BE KEPT IN SORTED ORDER
-		std::vector<TokenType> back_disallowed_tokens = {
+		static const std::vector<TokenType> back_disallowed_tokens = {
 			TokenType::SYM_COMMA,
 			TokenType::SYM_PLUS,
 		};
 
 		// Note: MUST BE KEPT IN SORTED ORDER
-		std::vector<TokenType> allowed_tokens = {
+		static const std::vector<TokenType> allowed_tokens = {
 			TokenType::SYM_COMMA,
 			TokenType::SYM_PLUS,
 			TokenType::STRING_LIT,
@@ -326,28 +328,31 @@ namespace fex
 			TokenType::PARAMETER_TIME_MS,
 			TokenType::PARAMETER_TIME_SEC,
 			TokenType::PARAMETER_TIME_MIN,
+			TokenType::ACTION_LEADER,
+			TokenType::PARAMETER_AFTER,
+			TokenType::PARAMETER_EVERY,
 		};
 
 		const Token &head = tokens[*index];
 		if (std::binary_search(front_disallowed_tokens.begin(), front_disallowed_tokens.end(), head.type))
 		{
-			return {errmsg("Token not allowed at start of action: " + TokenStr(source, head), head.line_number), {}};
+			return {errmsg("Token not allowed at start of action: " + std::string(TokenStr(source, head)), head.line_number), {}};
 		}
 
-		(*index)++;
 		int start = *index;
-		std::vector<Token> action = {head};
+		(*index)++;
 
 		while (*index < tokens.size() && std::binary_search(allowed_tokens.begin(), allowed_tokens.end(), tokens[*index].type))
 		{
-			action.push_back(tokens[*index]);
 			(*index)++;
 		}
 
+		TokenSpan action(&tokens[start], tokens.begin() + *index);
+
 		// Check for trailing two '+' and ','
 		if (std::binary_search(back_disallowed_tokens.begin(), back_disallowed_tokens.end(), action.back().type))
 		{
-			return {errmsg("Token not allowed at end of action: " + TokenStr(source, action.back()), action.back().line_number), {}};
+			return {errmsg("Token not allowed at end of action: " + std::string(TokenStr(source, action.back())), action.back().line_number), {}};
 		}
 
 		// Check for two '+' in a row
@@ -359,13 +364,44 @@ namespace fex
 			}
 		}
 
-		return {"", std::move(action)};
+		return {"", action};
 	}
 
-	std::pair<std::string, std::pair<TopLevel, BindingList>> parse(const std::string &source, const std::vector<Token> &tokens)
+	std::pair<std::string, int> parse_row_key(std::string_view source, TokenSpan tokens, int *index)
 	{
-		TopLevel top_level;
-		BindingList bindings;
+		const Token &row = tokens[*index];
+		if (row.type != TokenType::ROW_LIT)
+		{
+			return {errmsg("Expected row literal, saw: " + std::string(TokenStr(source, row)), row.line_number), {}};
+		}
+
+		(*index)++;
+
+		if (*index >= tokens.size() || tokens[*index].type != TokenType::SYM_COMMA)
+		{
+			return {errmsg("Expected comma after: " + std::string(TokenStr(source, row)), row.line_number), {}};
+		}
+
+		(*index)++;
+
+		if (*index >= tokens.size() || tokens[*index].type != TokenType::KEY_LIT)
+		{
+			return {errmsg("Expected key literal", row.line_number), {}};
+		}
+
+		const Token &key = tokens[*index];
+		(*index)++;
+
+		int row_val = to_ulong(TokenStr(source, row).substr(1));
+		int key_val = to_ulong(TokenStr(source, key).substr(1));
+		std::cout << row_val << " " << key_val << std::endl;
+
+		return {"", ROWKEY_VALUE(row_val, key_val)};
+	}
+
+	std::pair<std::string, ParseTree> parse(std::string_view source, TokenSpan tokens, std::pmr::memory_resource *memory)
+	{
+		ParseTree tree(memory);
 
 		int index = 0;
 		while (index < tokens.size())
@@ -374,50 +410,124 @@ namespace fex
 
 			if (row.type == TokenType::TOP_BLOCK_OTHER_KEYS || row.type == TokenType::TOP_OTHER_KEYS_FALL_THROUGH)
 			{
-				top_level.push_back(row);
+				tree.top_level.push_back({&row, &row + 1});
 				index++;
 				continue;
 			}
 
-			if (row.type != TokenType::ROW_LIT)
+			if (row.type == TokenType::TOP_COMBO_WINDOW)
 			{
-				return {errmsg("Expected row literal, saw: " + TokenStr(source, row), row.line_number), {}};
+				if (index + 2 >= tokens.size())
+				{
+					return {errmsg("Combo window requires a time parameter", row.line_number), {}};
+				}
+				tree.top_level.push_back({&row, &row + 3});
+				index += 3;
+				continue;
 			}
 
-			index++;
-
-			if (index >= tokens.size() || tokens[index].type != TokenType::SYM_COMMA)
+			// leader sequence G S: <action>
+			if (row.type == TokenType::TOP_LEADER_SEQUENCE)
 			{
-				return {errmsg("Expected comma after: " + TokenStr(source, row), row.line_number), {}};
+				index++;
+
+				LeaderBinding leader;
+				int keys_start = index;
+				while (index < tokens.size() && tokens[index].type != TokenType::SYM_COLON)
+				{
+					const Token &key = tokens[index];
+					if (key.type != TokenType::IDENTIFIER && key.type != TokenType::NUM_LIT && key.type != TokenType::HEX_LIT)
+					{
+						return {errmsg("Expected key name in leader sequence, saw: " + std::string(TokenStr(source, key)), key.line_number), {}};
+					}
+					index++;
+				}
+				leader.keys = TokenSpan(tokens.begin() + keys_start, tokens.begin() + index);
+
+				if (leader.keys.empty())
+				{
+					return {errmsg("Leader sequence requires at least one key", row.line_number), {}};
+				}
+
+				if (index >= tokens.size())
+				{
+					return {errmsg("Expected colon after leader sequence", row.line_number), {}};
+				}
+
+				index++;
+
+				if (index >= tokens.size())
+				{
+					return {errmsg("Expected action definition after leader sequence", row.line_number), {}};
+				}
+
+				auto actions = parse_action(source, tokens, &index);
+				if (actions.first != "")
+				{
+					return {actions.first, {}};
+				}
+
+				leader.action = actions.second;
+				tree.leaders.push_back(leader);
+				continue;
 			}
 
-			index++;
+			auto row_key = parse_row_key(source, tokens, &index);
+			if (row_key.first != "")
+			{
+				return {row_key.first, {}};
+			}
 
-			if (index >= tokens.size() || tokens[index].type != TokenType::KEY_LIT)
+			// R1, K1 + R1, K2: binds the keys pressed together
+			std::pmr::vector<int> combo_keys({row_key.second}, memory);
+			while (index < tokens.size() && tokens[index].type == TokenType::SYM_PLUS)
 			{
-				return {errmsg("Expected key literal", tokens[index].line_number), {}};
+				index++;
+				if (index >= tokens.size())
+				{
+					return {errmsg("Expected row literal after '+'", row.line_number), {}};
+				}
+
+				auto next = parse_row_key(source, tokens, &index);
+				if (next.first != "")
+				{
+					return {next.first, {}};
+				}
+				combo_keys.push_back(next.second);
 			}
 
-			const Token &key = tokens[index];
-			index++;
+			const Token &key = tokens[index - 1];
 
 			if (index >= tokens.size() || tokens[index].type != TokenType::SYM_COLON)
 			{
-				return {errmsg("Expected colon after: " + TokenStr(source, key), key.line_number), {}};
+				return {errmsg("Expected colon after: " + std::string(TokenStr(source, key)), key.line_number), {}};
 			}
 
 			index++;
-			int row_val = std::atoi(TokenStr(source, row).erase(0, 1).c_str());
-			int key_val = std::atoi(TokenStr(source, key).erase(0, 1).c_str());
-			std::cout << row_val << " " << key_val << std::endl;
 
-			Binding binding;
-			binding.insert({ROWKEY_VALUE(row_val, key_val), {}});
+			if (combo_keys.size() > 1)
+			{
+				if (index >= tokens.size())
+				{
+					return {errmsg("Expected action definition after: " + std::string(TokenStr(source, key)), key.line_number), {}};
+				}
+
+				auto actions = parse_action(source, tokens, &index);
+				if (actions.first != "")
+				{
+					return {actions.first, {}};
+				}
+
+				tree.combos.push_back({std::move(combo_keys), actions.second});
+				continue;
+			}
+
+			Binding binding = {row_key.second, {}};
 
 			bool is_inline = true;
 
 			// Note: MUST BE KEPT IN SORTERD ORDER
-			std::vector<TokenType> on_x_tokens = {
+			static const std::vector<TokenType> on_x_tokens = {
 				TokenType::OPERATION_PRESS,
 				TokenType::OPERATION_CLICK,
 				TokenType::OPERATION_HOLD,
@@ -434,13 +544,13 @@ namespace fex
 
 				if (index >= tokens.size() || tokens[index].type != TokenType::SYM_COLON)
 				{
-					return {errmsg("Expected colon after: " + TokenStr(source, operation), operation.line_number), {}};
+					return {errmsg("Expected colon after: " + std::string(TokenStr(source, operation)), operation.line_number), {}};
 				}
 				index++;
 
 				if (index >= tokens.size())
 				{
-					return {errmsg("Expected action definition after: " + TokenStr(source, operation), operation.line_number), {}};
+					return {errmsg("Expected action definition after: " + std::string(TokenStr(source, operation)), operation.line_number), {}};
 				}
 
 				auto operation_actions = parse_action(source, tokens, &index);
@@ -449,7 +559,7 @@ namespace fex
 					return {operation_actions.first, {}};
 				}
 
-				binding[ROWKEY_VALUE(row_val, key_val)][operation_from_token(operation.type)] = std::move(operation_actions.second);
+				binding.actions[(int)operation_from_token(operation.type)] = operation_actions.second;
 			}
 
 			// otherwise process the inline statement
@@ -457,7 +567,7 @@ namespace fex
 			{
 				if (index >= tokens.size())
 				{
-					return {errmsg("Expected action definition after: " + TokenStr(source, key), key.line_number), {}};
+					return {errmsg("Expected action definition after: " + std::string(TokenStr(source, key)), key.line_number), {}};
 				}
 
 				int old_index = index;
@@ -469,16 +579,16 @@ namespace fex
 
 				// If we aren't told explictly, bind to press
 				// TODO(fex): bind also to RELEASE?
-				binding[ROWKEY_VALUE(row_val, key_val)][Operation::PRESS] = std::move(actions.second);
+				binding.actions[(int)Operation::PRESS] = actions.second;
 			}
 
-			bindings.push_back(std::move(binding));
+			tree.bindings.push_back(binding);
 		}
 
-		return {"", {std::move(top_level), std::move(bindings)}};
+		return {"", std::move(tree)};
 	}
 
-	std::pair<std::string, unsigned long> parse_time(const std::string &source, const std::vector<Token> &tokens)
+	std::pair<std::string, unsigned long> parse_time(std::string_view source, TokenSpan tokens)
 	{
 		if (tokens.size() != 2)
 		{
@@ -493,7 +603,7 @@ namespace fex
 			return {errmsg("Expected number in time literal", duration.line_number), {}};
 		}
 
-		unsigned long time = std::stoul(TokenStr(source, duration));
+		unsigned long time = to_ulong(TokenStr(source, duration));
 
 		if (units.type == TokenType::PARAMETER_TIME_MS)
 		{
@@ -513,63 +623,117 @@ namespace fex
 		return {errmsg("Expected units in time literal", units.line_number), {}};
 	}
 
-	std::pair<std::string, std::vector<int>> parse_key_codes(const std::string &source, const std::vector<Token> &tokens)
+	// Parses the timing after 'repeatedly': [after <time>] [every <time>]
+	std::string parse_repeat(std::string_view source, TokenSpan tokens, unsigned long *delay, unsigned long *rate)
 	{
-		std::vector<int> key_codes;
-		std::vector<std::vector<Token>> subtokens;
-		subtokens.push_back({});
-
-		// Split token list [LEFT, ALT, +, F, +, A]
-		// into [[LEFT, ALT], [F], [A]]
-		for (const Token &token : tokens)
+		int index = 0;
+		while (index < tokens.size())
 		{
-			if (token.type == TokenType::SYM_PLUS)
+			const Token &keyword = tokens[index];
+			if (keyword.type != TokenType::PARAMETER_AFTER && keyword.type != TokenType::PARAMETER_EVERY)
 			{
-				subtokens.push_back({});
-				continue;
+				return errmsg("Expected 'after' or 'every' in repeat timing, saw: " + std::string(TokenStr(source, keyword)), keyword.line_number);
+			}
+
+			if (index + 2 >= tokens.size())
+			{
+				return errmsg("Expected time after: " + std::string(TokenStr(source, keyword)), keyword.line_number);
+			}
+
+			auto time = parse_time(source, {tokens.begin() + index + 1, tokens.begin() + index + 3});
+			if (time.first != "")
+			{
+				return time.first;
+			}
+
+			if (keyword.type == TokenType::PARAMETER_AFTER)
+			{
+				*delay = time.second;
 			}
-			subtokens.back().push_back(token);
+			else
+			{
+				*rate = time.second;
+			}
+
+			index += 3;
 		}
 
-		for (const std::vector<Token> &token : subtokens)
+		if (*rate == 0)
+		{
+			return errmsg("Repeat rate must be greater than 0", tokens[0].line_number);
+		}
+
+		return "";
+	}
+
+	std::pair<std::string, std::vector<int>> parse_key_codes(std::string_view source, TokenSpan tokens)
+	{
+		std::vector<int> key_codes;
+
+		// Walk token list [LEFT, ALT, +, F, +, A]
+		// as [[LEFT, ALT], [F], [A]]
+		const Token *end = tokens.begin();
+		while (end != tokens.end())
 		{
+			const Token *begin = (end == tokens.begin()) ? end : end + 1;
+			end = begin;
+			while (end != tokens.end() && end->type != TokenType::SYM_PLUS)
+			{
+				end++;
+			}
+
+			if (begin == end)
+			{
+				return {errmsg("Expected key name", tokens[0].line_number), {}};
+			}
+
 			// Process hex literal keys
-			if (token[0].type == TokenType::HEX_LIT)
+			if (begin->type == TokenType::HEX_LIT)
 			{
-				if (token.size() != 1)
+				if (end - begin != 1)
 				{
-					return {errmsg("Hex literals must be separated by '+'", token[0].line_number), {}};
+					return {errmsg("Hex literals must be separated by '+'", begin->line_number), {}};
 				}
 
-				key_codes.push_back(strtoul(TokenStr(source, token[0]).c_str(), NULL, 16));
+				key_codes.push_back(to_ulong(TokenStr(source, *begin).substr(2), 16));
 				continue;
 			}
 
-			// Merge tokens into single name [LEFT, ALT] => 'LEFT ALT'
-			std::string key_name = "";
-			for (const Token &t : token)
+			// Merge tokens into single name [LEFT, ALT] => 'LEFTALT'
+			char buffer[32];
+			size_t length = 0;
+			for (const Token *t = begin; t != end; t++)
 			{
-				key_name = key_name + TokenStr(source, t);
+				std::string_view part = TokenStr(source, *t);
+				if (length + part.size() > sizeof(buffer))
+				{
+					length = 0; // Longer than any key name
+					break;
+				}
+				part.copy(buffer + length, part.size());
+				length += part.size();
 			}
+			std::string_view key_name(buffer, length);
 
-			printf("val: %s\n", key_name.c_str());
+			printf("val: %.*s\n", (int)key_name.size(), key_name.data());
 
-			auto item = key_names.find(key_name);
-			if (item == key_names.end())
+			auto item = std::lower_bound(std::begin(key_names), std::end(key_names), key_name, [](const KeyName &entry, std::string_view name)
+										 { return entry.name < name; });
+			if (item == std::end(key_names) || item->name != key_name)
 			{
-				return {errmsg("Invalid Action or Key: '" + TokenStr(source, token[0]) + "'", token[0].line_number), {}};
+				return {errmsg("Invalid Action or Key: '" + std::string(TokenStr(source, *begin)) + "'", begin->line_number), {}};
 			}
 
-			key_codes.push_back(item->second);
+			key_codes.push_back(item->code);
 		}
 
 		return {"", std::move(key_codes)};
 	}
 
-	std::pair<std::string, std::unique_ptr<BoundAction>> parse_action_token(const std::string &source, const std::vector<Token> &tokens, Operation operation)
+	std::pair<std::string, std::unique_ptr<BoundAction>> parse_action_token(std::string_view source, TokenSpan tokens, Operation operation)
 	{
 		const Token &action_token = tokens[0];
-		const std::vector<Token> rest = std::vector<Token>{tokens.begin() + 1, tokens.end()};
+		const TokenSpan rest = tokens.from(1);
 
 		switch (action_token.type)
 		{
@@ -638,7 +802,7 @@ namespace fex
 
 			if (tokens.size() == 2 && tokens[1].type == TokenType::PARAMETER_UNTIL_RELEASED)
 			{
-				return {errmsg("Missing layer name for temporary switch: '" + TokenRunStr(source, tokens[0], tokens.back()) + "'", action_token.line_number), nullptr};
+				return {errmsg("Missing layer name for temporary switch: '" + std::string(TokenRunStr(source, tokens[0], tokens.back())) + "'", action_token.line_number), nullptr};
 			}
 
 			if (tokens.back().type == TokenType::PARAMETER_UNTIL_RELEASED)
@@ -648,11 +812,11 @@ namespace fex
 					return {errmsg("TemporaryLayerAction can only bind to On Hold", action_token.line_number), nullptr};
 				}
 
-				std::string layer_name = TokenRunStr(source, tokens[1], tokens[tokens.size() - 2]);
+				std::string layer_name(TokenRunStr(source, tokens[1], tokens[tokens.size() - 2]));
 				return {"", std::make_unique<TemporaryLayerAction>(layer_name)};
 			}
 
-			std::string layer_name = TokenRunStr(source, tokens[1], tokens.back());
+			std::string layer_name(TokenRunStr(source, tokens[1], tokens.back()));
 			return {"", std::make_unique<SwitchToLayerAction>(layer_name)};
 		}
 		case TokenType::ACTION_TOGGLE:
@@ -662,7 +826,7 @@ namespace fex
 				return {errmsg("Toggle action requires layer parameter", action_token.line_number), nullptr};
 			}
 
-			std::string param = TokenRunStr(source, tokens[1], tokens.back());
+			std::string param(TokenRunStr(source, tokens[1], tokens.back()));
 			return {"", std::make_unique<ToggleLayerAction>(param)};
 		}
 		case TokenType::ACTION_LEAVE:
@@ -672,7 +836,7 @@ namespace fex
 				return {errmsg("Leave action requires layer parameter", action_token.line_number), nullptr};
 			}
 
-			std::string param = TokenRunStr(source, tokens[1], tokens.back());
+			std::string param(TokenRunStr(source, tokens[1], tokens.back()));
 			return {"", std::make_unique<LeaveLayerAction>(param)};
 		}
 		case TokenType::ACTION_RESET_KEYBOARD:
@@ -745,13 +909,13 @@ namespace fex
 			unsigned long delay = 10; // in milliseconds
 
 			// Adjust both sides by 1 to remove quotes
-			std::string str = TokenStr(source, string_lit);
-			std::string string_to_type = str.substr(1, str.size() - 2);
+			std::string_view str = TokenStr(source, string_lit);
+			std::string string_to_type(str.substr(1, str.size() - 2));
 
 			bool repeating = false;
 			int time_keyword_count = 0;
 
-			std::unordered_map<std::string, std::string> replacements = {
+			static const std::pair<std::string_view, std::string_view> replacements[] = {
 				// {"[COMMA]", ","}, // Not needed, just type ,
 				{"[DOUBLE QUOTES]", "\""},
 				{"[SINGLE QUOTE]", "'"},
@@ -759,7 +923,7 @@ namespace fex
 				// TODO: Should escape sequences be allowed? i.e. '\n' in the text
 			};
 
-			for (auto &it : replacements)
+			for (const auto &it : replacements)
 			{
 				int index = string_to_type.find(it.first);
 				if (index != std::string::npos)
@@ -768,15 +932,24 @@ namespace fex
 				}
 			}
 
-			std::vector<Token> time_tokens;
+			Token time_tokens[2];
+			int time_token_count = 0;
+			std::vector<Token> repeat_tokens;
 
-			for (const Token &token : std::vector<Token>{tokens.begin() + 2, tokens.end()})
+			for (int i = 2; i < tokens.size(); i++)
 			{
+				const Token &token = tokens[i];
 				switch (token.type)
 				{
 				case TokenType::PARAMETER_REPEATEDLY: // TODO: 'once' and timing strings are mutually exclusive, improve parsing to catch multiple tokens
 					repeating = true;
 					break;
+				case TokenType::PARAMETER_AFTER:
+				case TokenType::PARAMETER_EVERY:
+					// The time that follows belongs to the repeat, not the typing speed
+					repeat_tokens.insert(repeat_tokens.end(), tokens.begin() + i, tokens.begin() + std::min<int>(i + 3, tokens.size()));
+					i += 2;
+					break;
 				case TokenType::PARAMETER_SLOWLY:
 					delay = 200;
 					time_keyword_count++;
@@ -793,7 +966,11 @@ namespace fex
 				case TokenType::PARAMETER_TIME_MS:
 				case TokenType::PARAMETER_TIME_SEC:
 				case TokenType::PARAMETER_TIME_MIN:
-					time_tokens.push_back(token);
+					if (time_token_count < 2)
+					{
+						time_tokens[time_token_count] = token;
+					}
+					time_token_count++;
 					break;
 
 				default:
@@ -801,14 +978,14 @@ namespace fex
 				}
 			}
 
-			if (time_tokens.size() != 0 && time_tokens.size() != 2)
+			if (time_token_count != 0 && time_token_count != 2)
 			{
 				return {errmsg("Incorrect number of time tokens provided", action_token.line_number), nullptr};
 			}
 
-			if (time_tokens.size() == 2)
+			if (time_token_count == 2)
 			{
-				auto parsed = parse_time(source, time_tokens);
+				auto parsed = parse_time(source, {time_tokens, time_tokens + 2});
 				if (parsed.first != "")
 				{
 					return {parsed.first, nullptr};
@@ -819,17 +996,75 @@ namespace fex
 
 			if (time_keyword_count > 1)
 			{
-				return {errmsg("Multiple speeds set for Type action. Please select one.\n\t" + TokenRunStr(source, tokens[0], tokens[tokens.size() - 1]), action_token.line_number), nullptr};
+				return {errmsg("Multiple speeds set for Type action. Please select one.\n\t" + std::string(TokenRunStr(source, tokens[0], tokens[tokens.size() - 1])), action_token.line_number), nullptr};
+			}
+
+			if (repeat_tokens.size() != 0 && !repeating)
+			{
+				return {errmsg("Repeat timing requires 'repeatedly'", action_token.line_number), nullptr};
 			}
 
 			if (repeating)
 			{
-				return {"", std::make_unique<StringTyperAction>(string_to_type, delay, 0)};
+				// Text repeats at the initial delay unless told otherwise
+				unsigned long repeat_delay = REPEAT_DEFAULT_DELAY_MS;
+				unsigned long repeat_rate = REPEAT_DEFAULT_DELAY_MS;
+				std::string error = parse_repeat(source, repeat_tokens, &repeat_delay, &repeat_rate);
+				if (error != "")
+				{
+					return {error, nullptr};
+				}
+				return {"", std::make_unique<StringTyperAction>(string_to_type, delay, repeat_delay, repeat_rate)};
 			}
 
 			return {"", std::make_unique<NonRepeatingStringTyperAction>(string_to_type, delay)};
 		}
 
+		case TokenType::ACTION_LEADER:
+		{
+			if (tokens.size() != 1)
+			{
+				return {errmsg("Leader action shouldn\'t have any parameters", action_token.line_number), nullptr};
+			}
+
+			return {"", std::make_unique<LeaderAction>()};
+		}
+
+		case TokenType::ACTION_ONE_SHOT:
+		{
+			if (tokens.size() == 1)
+			{
+				return {errmsg("One shot action requires modifier or layer parameter", action_token.line_number), nullptr};
+			}
+
+			if (tokens[1].type == TokenType::ACTION_SWITCH_TO)
+			{
+				if (tokens.size() == 2)
+				{
+					return {errmsg("Missing layer name for one shot switch", action_token.line_number), nullptr};
+				}
+
+				std::string layer_name(TokenRunStr(source, tokens[2], tokens.back()));
+				return {"", std::make_unique<OneShotLayerAction>(layer_name)};
+			}
+
+			auto key_codes = parse_key_codes(source, rest);
+			if (key_codes.first != "")
+			{
+				return {key_codes.first, nullptr};
+			}
+
+			for (int code : key_codes.second)
+			{
+				// Left Control (0xe0) through Right GUI (0xe7)
+				if (code < 0xe0 || code > 0xe7)
+				{
+					return {errmsg("One shot action only supports modifier keys: '" + std::string(TokenRunStr(source, tokens[1], tokens.back())) + "'", action_token.line_number), nullptr};
+				}
+			}
+			return {"", std::make_unique<OneShotModifierAction>(key_codes.second)};
+		}
+
 		case TokenType::ACTION_MOUSE_MOVE_UP:
 		case TokenType::ACTION_MOUSE_MOVE_DOWN:
 		case TokenType::ACTION_MOUSE_MOVE_LEFT:
@@ -846,7 +1081,7 @@ namespace fex
 				return {errmsg("Expected speed for mouse move", speed.line_number), nullptr};
 			}
 
-			long sp = std::stol(TokenStr(source, speed));
+			long sp = to_ulong(TokenStr(source, speed));
 			if (sp < 0 || sp > 100) 
 			{
 				return {errmsg("Spped must be in range 0-100", speed.line_number), nullptr};
@@ -879,7 +1114,7 @@ namespace fex
 				return {errmsg("Expected speed for mouse scroll", speed.line_number), nullptr};
 			}
 
-			long sp = std::stol(TokenStr(source, speed));
+			long sp = to_ulong(TokenStr(source, speed));
 			if (sp < 0 || sp > 100) 
 			{
 				return {errmsg("Spped must be in range 0-100", speed.line_number), nullptr};
@@ -921,6 +1156,32 @@ namespace fex
 
 		}
 
+		// A 'repeatedly' after the keys turns on typematic repeat for the binding
+		auto repeat = std::find_if(tokens.begin(), tokens.end(), [](const Token &token)
+								   { return token.type == TokenType::PARAMETER_REPEATEDLY; });
+		if (repeat != tokens.end())
+		{
+			if (repeat == tokens.begin())
+			{
+				return {errmsg("Repeat requires key parameter", action_token.line_number), nullptr};
+			}
+
+			auto key_codes = parse_key_codes(source, {tokens.begin(), repeat});
+			if (key_codes.first != "")
+			{
+				return {key_codes.first, nullptr};
+			}
+
+			unsigned long repeat_delay = REPEAT_DEFAULT_DELAY_MS;
+			unsigned long repeat_rate = REPEAT_DEFAULT_RATE_MS;
+			std::string error = parse_repeat(source, {repeat + 1, tokens.end()}, &repeat_delay, &repeat_rate);
+			if (error != "")
+			{
+				return {error, nullptr};
+			}
+			return {"", std::make_unique<RepeatingKeyAction>(key_codes.second, repeat_delay, repeat_rate)};
+		}
+
 		auto key_codes = parse_key_codes(source, tokens);
 		if (key_codes.first != "")
 		{
@@ -929,34 +1190,39 @@ namespace fex
 		return {"", std::make_unique<GenericKeyAction>(key_codes.second)};
 	}
 
-	std::pair<std::string, std::unique_ptr<BoundAction>> parse_action_list(const std::string &source, const std::vector<Token> &tokens, Operation operation)
+	std::pair<std::string, std::unique_ptr<BoundAction>> parse_action_list(std::string_view source, TokenSpan tokens, Operation operation)
 	{
-		std::vector<std::vector<Token>> token_sets = {{}};
+		std::vector<std::unique_ptr<BoundAction>> actions;
 
-		// Split the token list on commas, each index into token_sets
+		// Split the token list on commas, each run
 		// represents a single action with any params
-		for (const Token &token : tokens)
+		const Token *begin = tokens.begin();
+		while (true)
 		{
-			if (token.type == TokenType::SYM_COMMA)
+			const Token *end = begin;
+			while (end != tokens.end() && end->type != TokenType::SYM_COMMA)
 			{
-				token_sets.push_back({});
+				end++;
 			}
-			else
+
+			if (begin == end)
 			{
-				token_sets.back().push_back(token);
+				return {errmsg("Expected action", tokens[0].line_number), nullptr};
 			}
-		}
 
-		std::vector<std::unique_ptr<BoundAction>> actions;
-		for (const std::vector<Token> &token_set : token_sets)
-		{
-			auto parsed = parse_action_token(source, token_set, operation);
+			auto parsed = parse_action_token(source, {begin, end}, operation);
 			if (parsed.first != "" || !parsed.second)
 			{
 				return {parsed.first, nullptr};
 			}
 
 			actions.push_back(std::move(parsed.second));
+
+			if (end == tokens.end())
+			{
+				break;
+			}
+			begin = end + 1;
 		}
 
 		if (actions.size() == 1)
@@ -967,57 +1233,215 @@ namespace fex
 		return {"", std::make_unique<SequenceAction>(std::move(actions))};
 	}
 
-	std::string parse_source(const std::string &source, Layer *layer)
+	// Binds everything in tree, the combo index and leader trie are left to the caller
+	std::string build_layer(std::string_view source, const ParseTree &tree, Layer *layer)
+	{
+		for (const TokenSpan &statement : tree.top_level)
+		{
+			if (statement[0].type == TokenType::TOP_OTHER_KEYS_FALL_THROUGH)
+			{
+				layer->set_unassigned_keys_fall_through(true);
+				continue;
+			}
+			if (statement[0].type == TokenType::TOP_BLOCK_OTHER_KEYS)
+			{
+				layer->set_unassigned_keys_fall_through(false);
+				continue;
+			}
+			if (statement[0].type == TokenType::TOP_COMBO_WINDOW)
+			{
+				auto window = parse_time(source, statement.from(1));
+				if (window.first != "")
+				{
+					return window.first;
+				}
+				layer->set_combo_window(window.second);
+				continue;
+			}
+		}
+
+		for (const Binding &binding : tree.bindings)
+		{
+			int key_val = binding.key;
+			for (int op = 0; op <= (int)Operation::RELEASE; op++)
+			{
+				const TokenSpan &action_tokens = binding.actions[op];
+				if (action_tokens.empty())
+				{
+					continue;
+				}
+
+				Operation operation_val = (Operation)op;
+
+				printf("parsing action for key: %d\n", key_val);
+				auto action = parse_action_list(source, action_tokens, operation_val);
+
+				if (action.first != "" || !action.second)
+				{
+					return action.first;
+				}
+
+				layer->Bind(key_val, std::move(action.second), operation_val);
+			}
+		}
+
+		for (const ComboBinding &combo : tree.combos)
+		{
+			KeyMask keys;
+			for (int key_val : combo.keys)
+			{
+				if (key_val < 0 || key_val >= KEY_MASK_BITS)
+				{
+					return errmsg("Combo key out of range", combo.action[0].line_number);
+				}
+				keys.Set(key_val);
+			}
+
+			auto action = parse_action_list(source, combo.action, Operation::PRESS);
+			if (action.first != "" || !action.second)
+			{
+				return action.first;
+			}
+
+			layer->BindCombo(keys, std::move(action.second));
+		}
+
+		for (const LeaderBinding &leader : tree.leaders)
+		{
+			std::vector<uint8_t> sequence;
+			for (const Token &key : leader.keys)
+			{
+				auto code = parse_key_codes(source, {&key, &key + 1});
+				if (code.first != "")
+				{
+					return code.first;
+				}
+				if (code.second[0] < 0 || code.second[0] > 0xFF)
+				{
+					return errmsg("Key code out of range in leader sequence: " + std::string(TokenStr(source, key)), key.line_number);
+				}
+				sequence.push_back(code.second[0]);
+			}
+
+			auto action = parse_action_list(source, leader.action, Operation::PRESS);
+			if (action.first != "" || !action.second)
+			{
+				return action.first;
+			}
+
+			layer->BindLeaderSequence(std::move(sequence), std::move(action.second));
+		}
+
+		return "";
+	}
+
+	std::string parse_source(std::string_view source, Layer *layer, Arena *arena)
 	{
-		auto tokens = tokenize(source);
+		std::pmr::memory_resource *memory = arena ? arena : std::pmr::get_default_resource();
+
+		auto tokens = tokenize(source, memory);
 		if (tokens.first != "")
 		{
 			return tokens.first;
 		}
 
-		auto parsed = parse(source, tokens.second);
+		auto parsed = parse(source, tokens.second, memory);
 		if (parsed.first != "")
 		{
 			return parsed.first;
 		}
 
-		for (const Token &statement : parsed.second.first)
+		std::string error = build_layer(source, parsed.second, layer);
+		if (error != "")
+		{
+			return error;
+		}
+
+		layer->BuildComboIndex();
+		layer->BuildLeaderTrie();
+		return "";
+	}
+
+	// Actions never contain these, so a statement ends where the next one starts
+	static bool starts_statement(const Token &token, const Token &previous)
+	{
+		switch (token.type)
+		{
+		case TokenType::TOP_BLOCK_OTHER_KEYS:
+		case TokenType::TOP_OTHER_KEYS_FALL_THROUGH:
+		case TokenType::TOP_COMBO_WINDOW:
+		case TokenType::TOP_LEADER_SEQUENCE:
+			return true;
+		case TokenType::ROW_LIT:
+			return previous.type != TokenType::SYM_PLUS; // R1, K1 + R1, K2
+		default:
+			return false;
+		}
+	}
+
+	std::string parse_stream(TokenStream *stream, Layer *layer, Arena *arena)
+	{
+		std::pmr::memory_resource *memory = arena ? arena : std::pmr::get_default_resource();
+		std::pmr::vector<Token> statement(memory);
+
+		Token token;
+		bool more = stream->Next(&token);
+		while (more)
 		{
-			if (statement.type == TokenType::TOP_OTHER_KEYS_FALL_THROUGH)
+			statement.clear();
+			int start = token.start;
+			do
 			{
-				layer->set_unassigned_keys_fall_through(true);
-				continue;
+				statement.push_back(token);
+				more = stream->Next(&token);
+			} while (more && !starts_statement(token, statement.back()));
+
+			if (stream->error() != "")
+			{
+				return stream->error();
 			}
-			if (statement.type == TokenType::TOP_BLOCK_OTHER_KEYS)
+
+			// Parse the statement against its own text
+			for (Token &t : statement)
 			{
-				layer->set_unassigned_keys_fall_through(false);
-				continue;
+				t.start -= start;
 			}
-		}
+			std::string_view source = stream->Text(start, statement.back().start + statement.back().length);
 
-		for (const Binding &binding : parsed.second.second)
-		{
-			for (const auto &key : binding)
+			size_t mark = arena ? arena->Mark() : 0;
 			{
-				int key_val = key.first;
-				const auto &operations = key.second;
-				for (const auto &operation : operations)
+				auto parsed = parse(source, statement, memory);
+				if (parsed.first != "")
 				{
-					Operation operation_val = operation.first;
-					const std::vector<Token> &action_tokens = operation.second;
+					return parsed.first;
+				}
 
-					printf("parsing action for key: %d\n", key_val);
-					auto action = parse_action_list(source, action_tokens, operation_val);
+				std::string error = build_layer(source, parsed.second, layer);
+				if (error != "")
+				{
+					return error;
+				}
+			}
 
-					if (action.first != "" || !action.second)
-					{
-						return action.first;
-					}
+			// The parse tree is bound and gone, the next statement reuses its memory
+			if (arena)
+			{
+				arena->Rewind(mark);
+			}
 
-					layer->Bind(key_val, std::move(action.second), operation_val);
-				}
+			if (more)
+			{
+				stream->Release(token.start);
 			}
 		}
+
+		if (stream->error() != "")
+		{
+			return stream->error();
+		}
+
+		layer->BuildComboIndex();
+		layer->BuildLeaderTrie();
 		return "";
 	}
 }
\ No newline at end of file
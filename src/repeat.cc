@@ -0,0 +1,241 @@
+#include "repeat.h"
+
+#include <stdio.h>
+
+#include "task.h"
+
+namespace fex
+{
+    void RepeatScheduler::Initialize()
+    {
+        // Period is replaced every time the timer is armed
+        timer_ = xTimerCreate("repeat", 1, pdFALSE, this, TimerCallback);
+        if (timer_ == NULL)
+        {
+            printf("---- FAILED TO CREATE REPEAT TIMER ----\n");
+        }
+    }
+
+    void RepeatScheduler::Start(const void *owner, int key, const RepeatProgram *program, unsigned long delay, unsigned long first_gap)
+    {
+        if (!program || program->empty())
+        {
+            return;
+        }
+
+        TickType_t now = xTaskGetTickCount();
+
+        taskENTER_CRITICAL();
+        Slot *free = nullptr;
+        for (Slot &slot : slots_)
+        {
+            if ((slot.owner == owner && slot.key == key && !slot.releasing) || (!free && !slot.owner))
+            {
+                free = &slot;
+            }
+        }
+
+        if (free)
+        {
+            *free = {owner, key, program, 0, now + pdMS_TO_TICKS(delay), 0, first_gap, false, false, false};
+        }
+        taskEXIT_CRITICAL();
+
+        if (!free)
+        {
+            printf("repeat: no free slot\n");
+            return;
+        }
+
+        Arm(now);
+    }
+
+    void RepeatScheduler::Stop(const void *owner, int key, bool finish_pass)
+    {
+        bool retry = false;
+        TickType_t now = xTaskGetTickCount();
+
+        taskENTER_CRITICAL();
+        for (Slot &slot : slots_)
+        {
+            if (slot.owner != owner || slot.key != key || slot.releasing)
+            {
+                continue;
+            }
+
+            if (finish_pass && !(slot.wrapped && slot.step == 0))
+            {
+                slot.stopping = true;
+                continue;
+            }
+
+            // Don't leave a key from the middle of the program held down. If the
+            // HID task is behind the timer sends the release once there is room.
+            if (slot.down && !Push({slot.down, false}))
+            {
+                slot.releasing = true;
+                slot.due = now;
+                retry = true;
+                continue;
+            }
+            slot = {};
+        }
+        taskEXIT_CRITICAL();
+
+        if (retry)
+        {
+            Arm(now);
+        }
+    }
+
+    bool RepeatScheduler::Next(RepeatDelta *delta)
+    {
+        bool found = false;
+
+        taskENTER_CRITICAL();
+        if (ready_count_ > 0)
+        {
+            *delta = ready_[ready_head_];
+            ready_head_ = (ready_head_ + 1) % REPEAT_MAX_READY;
+            ready_count_--;
+            found = true;
+        }
+        taskEXIT_CRITICAL();
+
+        return found;
+    }
+
+    bool RepeatScheduler::Idle()
+    {
+        bool idle = true;
+
+        taskENTER_CRITICAL();
+        for (const Slot &slot : slots_)
+        {
+            if (slot.owner)
+            {
+                idle = false;
+            }
+        }
+        taskEXIT_CRITICAL();
+
+        return idle;
+    }
+
+    void RepeatScheduler::TimerCallback(TimerHandle_t timer)
+    {
+        RepeatScheduler *scheduler = static_cast<RepeatScheduler *>(pvTimerGetTimerID(timer));
+        TickType_t now = xTaskGetTickCount();
+
+        scheduler->Advance(now);
+        scheduler->Arm(now);
+    }
+
+    void RepeatScheduler::Advance(TickType_t now)
+    {
+        taskENTER_CRITICAL();
+        for (Slot &slot : slots_)
+        {
+            while (slot.owner && (int32_t)(now - slot.due) >= 0)
+            {
+                if (slot.releasing)
+                {
+                    if (Push({slot.down, false}))
+                    {
+                        slot = {};
+                    }
+                    break;
+                }
+
+                const RepeatStep &step = (*slot.program)[slot.step];
+                if (!Push(step.delta))
+                {
+                    // HID task is behind, try again on the next pass
+                    break;
+                }
+
+                slot.down = step.delta.press ? step.delta.code : 0;
+
+                unsigned long wait = step.wait;
+                if (++slot.step == slot.program->size())
+                {
+                    slot.step = 0;
+                    if (slot.stopping)
+                    {
+                        slot = {};
+                        break;
+                    }
+
+                    if (!slot.wrapped)
+                    {
+                        wait = slot.first_gap;
+                        slot.wrapped = true;
+                    }
+                }
+                slot.due += pdMS_TO_TICKS(wait);
+            }
+        }
+        taskEXIT_CRITICAL();
+    }
+
+    void RepeatScheduler::Arm(TickType_t now)
+    {
+        if (timer_ == NULL)
+        {
+            return;
+        }
+
+        bool active = false;
+        TickType_t wait = 0;
+
+        taskENTER_CRITICAL();
+        for (const Slot &slot : slots_)
+        {
+            if (!slot.owner)
+            {
+                continue;
+            }
+
+            int32_t until = (int32_t)(slot.due - now);
+            TickType_t slot_wait = (until > 0) ? until : 0;
+            if (slot_wait == 0 && ready_count_ == REPEAT_MAX_READY)
+            {
+                slot_wait = pdMS_TO_TICKS(REPEAT_RETRY_MS);
+            }
+
+            if (!active || slot_wait < wait)
+            {
+                wait = slot_wait;
+            }
+            active = true;
+        }
+        taskEXIT_CRITICAL();
+
+        if (!active)
+        {
+            xTimerStop(timer_, 0);
+            return;
+        }
+
+        // Changing the period also (re)starts the timer
+        xTimerChangePeriod(timer_, (wait > 0) ? wait : 1, 0);
+    }
+
+    bool RepeatScheduler::Push(const RepeatDelta &delta)
+    {
+        if (ready_count_ == REPEAT_MAX_READY)
+        {
+            return false;
+        }
+
+        ready_[(ready_head_ + ready_count_) % REPEAT_MAX_READY] = delta;
+        ready_count_++;
+        return true;
+    }
+
+    RepeatScheduler &repeat_scheduler()
+    {
+        static RepeatScheduler scheduler;
+        return scheduler;
+    }
+}
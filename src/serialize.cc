@@ -0,0 +1,95 @@
+#include "serialize.h"
+
+namespace fex
+{
+    void ByteWriter::U16(uint16_t value)
+    {
+        U8(value);
+        U8(value >> 8);
+    }
+
+    void ByteWriter::U32(uint32_t value)
+    {
+        U16(value);
+        U16(value >> 16);
+    }
+
+    void ByteWriter::String(std::string_view value)
+    {
+        U32(value.size());
+        data_.append(value.data(), value.size());
+    }
+
+    const uint8_t *ByteReader::Take(size_t length)
+    {
+        if (failed_ || data_.size() - offset_ < length)
+        {
+            failed_ = true;
+            return nullptr;
+        }
+
+        const uint8_t *bytes = reinterpret_cast<const uint8_t *>(data_.data()) + offset_;
+        offset_ += length;
+        return bytes;
+    }
+
+    uint8_t ByteReader::U8()
+    {
+        const uint8_t *bytes = Take(1);
+        return bytes ? bytes[0] : 0;
+    }
+
+    uint16_t ByteReader::U16()
+    {
+        const uint8_t *bytes = Take(2);
+        return bytes ? bytes[0] | (bytes[1] << 8) : 0;
+    }
+
+    uint32_t ByteReader::U32()
+    {
+        const uint8_t *bytes = Take(4);
+        return bytes ? bytes[0] | (bytes[1] << 8) | (bytes[2] << 16) | ((uint32_t)bytes[3] << 24) : 0;
+    }
+
+    std::string ByteReader::String()
+    {
+        uint32_t length = U32();
+        const uint8_t *bytes = Take(length);
+        return bytes ? std::string(reinterpret_cast<const char *>(bytes), length) : "";
+    }
+
+    std::string_view ByteReader::View()
+    {
+        uint32_t length = U32();
+        const uint8_t *bytes = Take(length);
+        return bytes ? std::string_view(reinterpret_cast<const char *>(bytes), length) : std::string_view();
+    }
+
+    uint32_t hash_bytes(std::string_view data, uint32_t hash)
+    {
+        for (char c : data)
+        {
+            hash ^= (uint8_t)c;
+            hash *= 16777619u;
+        }
+        return hash;
+    }
+
+    uint32_t crc32(std::string_view data)
+    {
+        // Half a byte at a time, the table stays in flash
+        static const uint32_t table[16] = {
+            0x00000000, 0x1db71064, 0x3b6e20c8, 0x26d930ac, 0x76dc4190, 0x6b6b51f4, 0x4db26158, 0x5005713c,
+            0xedb88320, 0xf00f9344, 0xd6d6a3e8, 0xcb61b38c, 0x9b64c2b0, 0x86d3d2d4, 0xa00ae278, 0xbdbdf21c,
+        };
+
+        uint32_t crc = 0xffffffff;
+        for (char c : data)
+        {
+            crc ^= (uint8_t)c;
+            crc = (crc >> 4) ^ table[crc & 0x0f];
+            crc = (crc >> 4) ^ table[crc & 0x0f];
+        }
+        return ~crc;
+    }
+}
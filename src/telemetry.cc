@@ -0,0 +1,214 @@
+#include "telemetry.h"
+
+#include <algorithm>
+#include <malloc.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "task.h"
+
+#include "flash.h"
+#include "layer.h"
+#include "layer_set.h"
+#include "virtual_files.h"
+
+#define TELEMETRY_ROW_WIDTH 12 // Key ids are row * width + key, as the parser numbers them
+
+namespace fex
+{
+    enum VirtualFile
+    {
+        STATS_FILE,
+        LAYERS_FILE,
+        VIRTUAL_FILE_COUNT,
+    };
+
+    static const char *kVirtualFileNames[VIRTUAL_FILE_COUNT] = {"//STATS.TXT", "//LAYERS.TXT"};
+
+    // Set before the host can see the drive, cleared by the USB device task
+    static uint32_t virtual_file_sectors[VIRTUAL_FILE_COUNT] = {UINT32_MAX, UINT32_MAX};
+
+    // The host reads a sector in pieces, each read of a file gets one snapshot
+    static char virtual_file_buffer[VIRTUAL_FILE_SIZE];
+    static uint32_t virtual_file_buffer_lba = UINT32_MAX;
+
+    void Telemetry::Publish(Filesystem &fs)
+    {
+        for (int i = 0; i < VIRTUAL_FILE_COUNT; i++)
+        {
+            uint32_t sector;
+            if (fs.Reserve(kVirtualFileNames[i], VIRTUAL_FILE_SIZE, &sector))
+            {
+                virtual_file_sectors[i] = sector;
+            }
+            else
+            {
+                printf("Failed to reserve %s\n", kVirtualFileNames[i]);
+            }
+        }
+    }
+
+    void Telemetry::CountPress(int key)
+    {
+        if (key >= 0 && key < KEY_MASK_BITS)
+        {
+            presses_[key].fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    void Telemetry::RecordLatency(uint32_t ms)
+    {
+        int bucket = 0;
+        while (bucket < TELEMETRY_LATENCY_BUCKETS - 1 && ms >= (1u << bucket))
+        {
+            bucket++;
+        }
+        latency_[bucket].fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void Telemetry::ClearParseErrors()
+    {
+        xSemaphoreTake(mutex_, portMAX_DELAY);
+        parse_errors_.clear();
+        xSemaphoreGive(mutex_);
+    }
+
+    void Telemetry::AddParseError(const std::string &error)
+    {
+        xSemaphoreTake(mutex_, portMAX_DELAY);
+        parse_errors_.push_back(error);
+        xSemaphoreGive(mutex_);
+    }
+
+    std::string Telemetry::Stats()
+    {
+        std::string out;
+        char line[96];
+
+        snprintf(line, sizeof(line), "Uptime: %d s\n\n", (int)(xTaskGetTickCount() / configTICK_RATE_HZ));
+        out += line;
+
+        // The newlib heap never gives memory back to sbrk, so its arena is the high water mark
+        struct mallinfo info = mallinfo();
+        snprintf(line, sizeof(line), "Heap: %d used, %d free, %d high water\nFreeRTOS heap: %d free\n\n",
+                 (int)info.uordblks, (int)info.fordblks, (int)info.arena, (int)xPortGetFreeHeapSize());
+        out += line;
+
+        std::vector<TaskStatus_t> tasks(uxTaskGetNumberOfTasks());
+        tasks.resize(uxTaskGetSystemState(tasks.data(), tasks.size(), NULL));
+        out += "Stack high water (words never used):\n";
+        for (const TaskStatus_t &task : tasks)
+        {
+            snprintf(line, sizeof(line), "  %-16s %d\n", task.pcTaskName, (int)task.usStackHighWaterMark);
+            out += line;
+        }
+
+        static const char *kLatencyLabels[TELEMETRY_LATENCY_BUCKETS] = {"0", "1", "2-3", "4-7", "8-15", "16+"};
+        out += "\nKey latency, polled to processed:\n";
+        for (int i = 0; i < TELEMETRY_LATENCY_BUCKETS; i++)
+        {
+            snprintf(line, sizeof(line), "  %5s ms  %d\n", kLatencyLabels[i], (int)latency_[i].load(std::memory_order_relaxed));
+            out += line;
+        }
+
+        out += "\nKey presses:\n";
+        for (int key = 0; key < KEY_MASK_BITS; key++)
+        {
+            uint32_t count = presses_[key].load(std::memory_order_relaxed);
+            if (count > 0)
+            {
+                snprintf(line, sizeof(line), "  R%d, K%-2d %d\n", key / TELEMETRY_ROW_WIDTH, key % TELEMETRY_ROW_WIDTH, (int)count);
+                out += line;
+            }
+        }
+
+        flash_stats_t stats;
+        flash_get_stats(&stats);
+        snprintf(line, sizeof(line), "\nFlash: %d sector writes, %d erases, %d relocations\n",
+                 (int)stats.writes, (int)stats.erases, (int)stats.relocations);
+        out += line;
+
+        uint32_t sectors = FTL_AREA_SECTORS;
+        uint32_t least = UINT32_MAX, most = 0, total = 0;
+        for (uint32_t i = 0; i < sectors; i++)
+        {
+            uint32_t erases = flash_sector_erases(i);
+            least = std::min(least, erases);
+            most = std::max(most, erases);
+            total += erases;
+        }
+        snprintf(line, sizeof(line), "Sector erases: %d least, %d most, %d mean\n", (int)least, (int)most, (int)(total / sectors));
+        out += line;
+
+        return out;
+    }
+
+    std::string Telemetry::Layers()
+    {
+        std::string out;
+        {
+            SharedLayerSet::Reader set = shared_layer_set().Read();
+            const std::string *active = set->Name(layer_state().snapshot());
+            out += "Active layer: " + (active ? *active : std::string("none")) + "\n\n";
+            out += "Layers (set " + std::to_string(set->generation) + "):\n";
+            for (const LayerSet::Entry &entry : set->layers)
+            {
+                out += "  " + entry.name + "\n";
+            }
+        }
+
+        xSemaphoreTake(mutex_, portMAX_DELAY);
+        out += parse_errors_.empty() ? "\nParse: Success\n" : "\nParse errors:\n";
+        for (const std::string &error : parse_errors_)
+        {
+            out += "  " + error + "\n";
+        }
+        xSemaphoreGive(mutex_);
+
+        return out;
+    }
+
+    Telemetry &telemetry()
+    {
+        static Telemetry telemetry;
+        return telemetry;
+    }
+}
+
+bool virtual_file_read(uint32_t lba, uint32_t offset, void *buffer, uint32_t bufsize)
+{
+    using namespace fex;
+
+    int file = std::find(virtual_file_sectors, virtual_file_sectors + VIRTUAL_FILE_COUNT, lba) - virtual_file_sectors;
+    if (file == VIRTUAL_FILE_COUNT || offset >= VIRTUAL_FILE_SIZE)
+    {
+        return false;
+    }
+
+    if (offset == 0 || virtual_file_buffer_lba != lba)
+    {
+        std::string text = file == STATS_FILE ? telemetry().Stats() : telemetry().Layers();
+        size_t size = std::min(text.size(), (size_t)VIRTUAL_FILE_SIZE - 1);
+        memcpy(virtual_file_buffer, text.data(), size);
+        memset(virtual_file_buffer + size, ' ', VIRTUAL_FILE_SIZE - 1 - size);
+        virtual_file_buffer[VIRTUAL_FILE_SIZE - 1] = '\n';
+        virtual_file_buffer_lba = lba;
+    }
+
+    memcpy(buffer, virtual_file_buffer + offset, std::min(bufsize, (uint32_t)VIRTUAL_FILE_SIZE - offset));
+    return true;
+}
+
+void virtual_file_written(uint32_t lba)
+{
+    using namespace fex;
+
+    for (int i = 0; i < VIRTUAL_FILE_COUNT; i++)
+    {
+        if (virtual_file_sectors[i] == lba)
+        {
+            virtual_file_sectors[i] = UINT32_MAX;
+            virtual_file_buffer_lba = UINT32_MAX;
+        }
+    }
+}
@@ -1,5 +1,8 @@
 #include <algorithm>
+#include <charconv>
+#include <functional>
 #include <string>
+#include <string_view>
 #include <vector>
 
 #include "tokenizer.h"
@@ -7,12 +10,80 @@
 namespace fex
 {
 
+    struct Keyword
+    {
+        std::string_view name;
+        std::string_view rest; // Words that must follow the name
+        TokenType type;
+    };
+
+    // Note: MUST BE KEPT IN SORTED ORDER
+    // Names are lower case and at most 16 characters, entries without rest go last among equal names
+    constexpr Keyword keywords[] = {
+        {"after", "", TokenType::PARAMETER_AFTER},
+        {"at", " human speed", TokenType::PARAMETER_AT_HUMAN_SPEED},
+        {"block", " other keys", TokenType::TOP_BLOCK_OTHER_KEYS},
+        {"bootloader", "", TokenType::ACTION_BOOTLOADER},
+        {"click", "", TokenType::ACTION_CLICK},
+        {"combo", " window", TokenType::TOP_COMBO_WINDOW},
+        {"every", "", TokenType::PARAMETER_EVERY},
+        {"home", "", TokenType::ACTION_HOME},
+        {"leader", " sequence", TokenType::TOP_LEADER_SEQUENCE},
+        {"leader", "", TokenType::ACTION_LEADER},
+        {"leave", "", TokenType::ACTION_LEAVE},
+        {"millisecond", "", TokenType::PARAMETER_TIME_MS},
+        {"milliseconds", "", TokenType::PARAMETER_TIME_MS},
+        {"min", "", TokenType::PARAMETER_TIME_MIN},
+        {"minute", "", TokenType::PARAMETER_TIME_MIN},
+        {"minutes", "", TokenType::PARAMETER_TIME_MIN},
+        {"mouse", " click back", TokenType::ACTION_MOUSE_CLICK_BACKWARDS},
+        {"mouse", " click backwards", TokenType::ACTION_MOUSE_CLICK_BACKWARDS},
+        {"mouse", " click center", TokenType::ACTION_MOUSE_CLICK_CENTER},
+        {"mouse", " click forwards", TokenType::ACTION_MOUSE_CLICK_FORWARDS},
+        {"mouse", " click left", TokenType::ACTION_MOUSE_CLICK_LEFT},
+        {"mouse", " click right", TokenType::ACTION_MOUSE_CLICK_RIGHT},
+        {"mouse", " move down", TokenType::ACTION_MOUSE_MOVE_DOWN},
+        {"mouse", " move left", TokenType::ACTION_MOUSE_MOVE_LEFT},
+        {"mouse", " move right", TokenType::ACTION_MOUSE_MOVE_RIGHT},
+        {"mouse", " move up", TokenType::ACTION_MOUSE_MOVE_UP},
+        {"mouse", " scroll down", TokenType::ACTION_MOUSE_SCROLL_DOWN},
+        {"mouse", " scroll left", TokenType::ACTION_MOUSE_SCROLL_LEFT},
+        {"mouse", " scroll right", TokenType::ACTION_MOUSE_SCROLL_RIGHT},
+        {"mouse", " scroll up", TokenType::ACTION_MOUSE_SCROLL_UP},
+        {"ms", "", TokenType::PARAMETER_TIME_MS},
+        {"nothing", "", TokenType::ACTION_NOTHING},
+        {"on", " click", TokenType::OPERATION_CLICK},
+        {"on", " double-click", TokenType::OPERATION_DOUBLE_CLICK},
+        {"on", " hold", TokenType::OPERATION_HOLD},
+        {"on", " press", TokenType::OPERATION_PRESS},
+        {"on", " release", TokenType::OPERATION_RELEASE},
+        {"one", " shot", TokenType::ACTION_ONE_SHOT},
+        {"other", " keys fall through", TokenType::TOP_OTHER_KEYS_FALL_THROUGH},
+        {"pass", " through", TokenType::ACTION_PASS_THROUGH},
+        {"press", "", TokenType::ACTION_PRESS},
+        {"quickly", "", TokenType::PARAMETER_QUICKLY},
+        {"release", "", TokenType::ACTION_RELEASE},
+        {"reload", " key maps", TokenType::ACTION_RELOAD_KEY_MAPS},
+        {"repeatedly", "", TokenType::PARAMETER_REPEATEDLY},
+        {"reset", " keyboard", TokenType::ACTION_RESET_KEYBOARD},
+        {"sec", "", TokenType::PARAMETER_TIME_SEC},
+        {"second", "", TokenType::PARAMETER_TIME_SEC},
+        {"seconds", "", TokenType::PARAMETER_TIME_SEC},
+        {"slowly", "", TokenType::PARAMETER_SLOWLY},
+        {"switch", " to", TokenType::ACTION_SWITCH_TO},
+        {"toggle", "", TokenType::ACTION_TOGGLE},
+        {"type", "", TokenType::ACTION_TYPE},
+        {"until", " released", TokenType::PARAMETER_UNTIL_RELEASED},
+        {"wait", "", TokenType::ACTION_WAIT},
+    };
+    static_assert(sorted_by_name(keywords), "keywords must be sorted");
+
     std::string errmsg(const std::string &message, int line_number)
     {
         return "Line " + std::to_string(line_number) + ": " + message;
     }
 
-    bool isdigits(const std::string &s)
+    bool isdigits(std::string_view s)
     {
         if (s.size() == 0)
         {
@@ -28,419 +99,333 @@ namespace fex
         return true;
     }
 
-    std::string to_lower(const std::string &s)
+    bool iequals(std::string_view a, std::string_view b)
+    {
+        if (a.size() != b.size())
+        {
+            return false;
+        }
+        for (size_t i = 0; i < a.size(); i++)
+        {
+            if (tolower(a[i]) != tolower(b[i]))
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    unsigned long to_ulong(std::string_view s, int base)
     {
-        std::string out(s);
-        std::transform(s.begin(), s.end(), out.begin(), ::tolower);
-        return out;
+        unsigned long value = 0;
+        std::from_chars(s.data(), s.data() + s.size(), value, base);
+        return value;
     }
 
-    std::string TokenStr(const std::string &source, const Token &token)
+    std::string_view TokenStr(std::string_view source, const Token &token)
     {
         return source.substr(token.start, token.length);
     }
 
-    std::string TokenRunStr(const std::string &source, const Token &start, const Token &end)
+    std::string_view TokenRunStr(std::string_view source, const Token &start, const Token &end)
     {
         return source.substr(start.start, end.start - start.start + end.length);
     }
 
-    std::pair<std::string, std::vector<Token>> tokenize(const std::string &source)
+    enum class Lexed
     {
-        std::vector<Token> tokens;
+        TOKEN,
+        SKIPPED, // Whitespace or a comment
+        ERROR,
+    };
 
-        int index = 0;
-        int line_number = 1;
+    // Lexes whatever starts at *index. Looks at most TOKEN_LOOKAHEAD bytes past where it stops.
+    static Lexed lex(std::string_view source, int *index_ptr, int *line_number_ptr, Token *token, std::string *error)
+    {
+        int &index = *index_ptr;
+        int &line_number = *line_number_ptr;
 
-        while (index < source.length())
-        {
-            char c = source[index];
+        // Reads past the end as '\0' instead of running off the view
+        auto peek = [&](int i)
+        { return i < source.length() ? source[i] : '\0'; };
 
-            switch (c)
-            {
-            case ' ':
-            case '\t':
-                index++;
-                continue;
-            case '\n':
-                line_number++;
-                index++;
-                continue;
-            case '#':
-                while (index < source.length() && source[index] != '\n')
-                {
-                    index++;
-                }
+        char c = source[index];
 
-                line_number++;
-                index++; // eat the '\n'
-                continue;
-            case ',':
-                tokens.push_back({
-                    .type = TokenType::SYM_COMMA,
-                    .start = index,
-                    .length = 1,
-                    .line_number = line_number,
-                });
-                index++;
-                continue;
-            case '+':
-                tokens.push_back({
-                    .type = TokenType::SYM_PLUS,
-                    .start = index,
-                    .length = 1,
-                    .line_number = line_number,
-                });
-                index++;
-                continue;
-            case ':':
-                tokens.push_back({
-                    .type = TokenType::SYM_COLON,
-                    .start = index,
-                    .length = 1,
-                    .line_number = line_number,
-                });
-                index++;
-                continue;
-            case '"':
+        switch (c)
+        {
+        case ' ':
+        case '\t':
+            index++;
+            return Lexed::SKIPPED;
+        case '\n':
+            line_number++;
+            index++;
+            return Lexed::SKIPPED;
+        case '#':
+            while (index < source.length() && source[index] != '\n')
             {
-                int start = index;
                 index++;
-
-                while (index < source.length() && source[index] != '"')
-                    index++;
-
-                if (source[index] != '"')
-                {
-                    return {errmsg("Unterminated string", line_number), {}};
-                }
-
-                index++; // Eat the "
-
-                tokens.push_back({
-                    .type = TokenType::STRING_LIT,
-                    .start = start,
-                    .length = index - start,
-                    .line_number = line_number,
-                });
-
-                continue;
             }
-            case '0':
-            { // Maybe hex literal
-                if (source[index + 1] != 'x')
-                {
-                    break; // Not a hex literal, parse as a number literal
-                }
-                int start = index;
-                index++;
-                index++; // eat the 'x'
-
-                if (!isxdigit(source[index]))
-                {
-                    return {errmsg("Hex literal must have a digit", line_number), {}};
-                }
-
-                while (index < source.length() && isxdigit(source[index]))
-                    index++;
 
-                tokens.push_back({
-                    .type = TokenType::HEX_LIT,
-                    .start = start,
-                    .length = index - start,
-                    .line_number = line_number,
-                });
+            line_number++;
+            index++; // eat the '\n'
+            return Lexed::SKIPPED;
+        case ',':
+            *token = {
+                .type = TokenType::SYM_COMMA,
+                .start = index,
+                .length = 1,
+                .line_number = line_number,
+            };
+            index++;
+            return Lexed::TOKEN;
+        case '+':
+            *token = {
+                .type = TokenType::SYM_PLUS,
+                .start = index,
+                .length = 1,
+                .line_number = line_number,
+            };
+            index++;
+            return Lexed::TOKEN;
+        case ':':
+            *token = {
+                .type = TokenType::SYM_COLON,
+                .start = index,
+                .length = 1,
+                .line_number = line_number,
+            };
+            index++;
+            return Lexed::TOKEN;
+        case '"':
+        {
+            int start = index;
+            index++;
 
-                continue;
-            }
-            }
+            while (index < source.length() && source[index] != '"')
+                index++;
 
-            if (isdigit(c))
-            { // Number literal
-                int start = index;
-                while (index < source.length() && isdigit(source[index]))
-                    index++;
-                // if (source[index] == '.') { // allow one '.'
-                //     index++;
-                //     while (index < source.length() && isdigit(source[index])) index++;
-                // }
-                tokens.push_back({
-                    .type = TokenType::NUM_LIT,
-                    .start = start,
-                    .length = index - start,
-                    .line_number = line_number,
-                });
-                continue;
+            if (peek(index) != '"')
+            {
+                *error = errmsg("Unterminated string", line_number);
+                return Lexed::ERROR;
             }
 
-            if (!isalnum(c))
-            { // Everything else must be an identifier or keyword
-                return {errmsg("Unexpected character '" + std::string{c} + "'", line_number), {}};
-            }
+            index++; // Eat the "
 
-            int start = index;
-            while (index < source.length() && isalnum(source[index]))
-                index++;
-            int length = index - start;
+            *token = {
+                .type = TokenType::STRING_LIT,
+                .start = start,
+                .length = index - start,
+                .line_number = line_number,
+            };
 
-            // Grab Row/Key Literals if they exist (K33, R999)
-            if ((source[start] == 'R' || source[start] == 'K') && isdigits(source.substr(start + 1, length - 1)))
+            return Lexed::TOKEN;
+        }
+        case '0':
+        { // Maybe hex literal
+            if (peek(index + 1) != 'x')
             {
-                if (source[start] == 'R')
-                {
-                    tokens.push_back({
-                        .type = TokenType::ROW_LIT,
-                        .start = start,
-                        .length = index - start,
-                        .line_number = line_number,
-                    });
-                }
-                else
-                {
-                    tokens.push_back({
-                        .type = TokenType::KEY_LIT,
-                        .start = start,
-                        .length = index - start,
-                        .line_number = line_number,
-                    });
-                }
-                continue;
+                break; // Not a hex literal, parse as a number literal
             }
+            int start = index;
+            index++;
+            index++; // eat the 'x'
 
-            // Handle Keywords
-            std::string identifier = to_lower(source.substr(start, length));
-            TokenType type = TokenType::IDENTIFIER;
-
-            if (identifier == "on" && source[index] == ' ')
+            if (!isxdigit(peek(index)))
             {
-                // make a restore point
-                int old_index = index;
+                *error = errmsg("Hex literal must have a digit", line_number);
+                return Lexed::ERROR;
+            }
 
-                // move past the space
+            while (index < source.length() && isxdigit(source[index]))
                 index++;
 
-                // look forward to see if we find the trigger
-                while (index < source.length() // "-"" for double-click
-                       && (isalnum(source[index]) || source[index] == '-'))
-                    index++;
-
-                length = index - start;
-                std::string trigger = to_lower(source.substr(start, length));
-
-                // Save type before starting
-                TokenType old_type = type;
-
-                if (trigger == "on press")
-                    type = TokenType::OPERATION_PRESS;
-                if (trigger == "on click")
-                    type = TokenType::OPERATION_CLICK;
-                if (trigger == "on hold")
-                    type = TokenType::OPERATION_HOLD;
-                if (trigger == "on double-click")
-                    type = TokenType::OPERATION_DOUBLE_CLICK;
-                if (trigger == "on release")
-                    type = TokenType::OPERATION_RELEASE;
-
-                // if type is still old then a trigger was not found, restore index
-                if (type == old_type)
-                    index = old_index;
-            }
+            *token = {
+                .type = TokenType::HEX_LIT,
+                .start = start,
+                .length = index - start,
+                .line_number = line_number,
+            };
 
-            if (identifier == "mouse" && source[index] == ' ')
-            {
-                // make a restore point
-                int old_index = index;
+            return Lexed::TOKEN;
+        }
+        }
 
-                // move past the space
+        if (isdigit(c))
+        { // Number literal
+            int start = index;
+            while (index < source.length() && isdigit(source[index]))
                 index++;
+            // if (source[index] == '.') { // allow one '.'
+            //     index++;
+            //     while (index < source.length() && isdigit(source[index])) index++;
+            // }
+            *token = {
+                .type = TokenType::NUM_LIT,
+                .start = start,
+                .length = index - start,
+                .line_number = line_number,
+            };
+            return Lexed::TOKEN;
+        }
 
-                // look forward to see if we find the next keyword
-                while (index < source.length() && isalpha(source[index]))
-                    index++;
-
-                int next_start = start + identifier.size() + 1;
-                length = index - next_start;
-                std::string mouse_kwd = to_lower(source.substr(next_start, length));
+        if (!isalnum(c))
+        { // Everything else must be an identifier or keyword
+            *error = errmsg("Unexpected character '" + std::string{c} + "'", line_number);
+            return Lexed::ERROR;
+        }
 
-                bool is_mouse_action = false;
+        int start = index;
+        while (index < source.length() && isalnum(source[index]))
+            index++;
+        int length = index - start;
 
-                std::string dir_kwd = "";
-                if (mouse_kwd == "move" || mouse_kwd == "scroll" || mouse_kwd == "click")
-                {
-                    // move past the space
-                    index++;
+        // Grab Row/Key Literals if they exist (K33, R999)
+        if ((source[start] == 'R' || source[start] == 'K') && isdigits(source.substr(start + 1, length - 1)))
+        {
+            *token = {
+                .type = source[start] == 'R' ? TokenType::ROW_LIT : TokenType::KEY_LIT,
+                .start = start,
+                .length = index - start,
+                .line_number = line_number,
+            };
+            return Lexed::TOKEN;
+        }
 
-                    // look forward to see if we find the last keyword
-                    while (index < source.length() && isalpha(source[index]))
-                        index++;
+        // Handle Keywords, multi-word keywords must match up to a word boundary
+        TokenType type = TokenType::IDENTIFIER;
 
-                    int last_start = next_start + mouse_kwd.size() + 1;
-                    length = index - last_start;
-                    dir_kwd = to_lower(source.substr(last_start, length));
-                }
+        char lower[16];
+        if (length <= sizeof(lower))
+        {
+            for (int i = 0; i < length; i++)
+            {
+                lower[i] = tolower(source[start + i]);
+            }
+            std::string_view identifier(lower, length);
 
-                if (mouse_kwd == "move")
-                {
-                    if (dir_kwd == "up")
-                    {
-                        type = TokenType::ACTION_MOUSE_MOVE_UP;
-                        is_mouse_action = true;
-                    }
-                    if (dir_kwd == "down")
-                    {
-                        type = TokenType::ACTION_MOUSE_MOVE_DOWN;
-                        is_mouse_action = true;
-                    }
-                    if (dir_kwd == "left")
-                    {
-                        type = TokenType::ACTION_MOUSE_MOVE_LEFT;
-                        is_mouse_action = true;
-                    }
-                    if (dir_kwd == "right")
-                    {
-                        type = TokenType::ACTION_MOUSE_MOVE_RIGHT;
-                        is_mouse_action = true;
-                    }
-                }
-                if (mouse_kwd == "scroll")
-                {
-                    if (dir_kwd == "up")
-                    {
-                        type = TokenType::ACTION_MOUSE_SCROLL_UP;
-                        is_mouse_action = true;
-                    }
-                    if (dir_kwd == "down")
-                    {
-                        type = TokenType::ACTION_MOUSE_SCROLL_DOWN;
-                        is_mouse_action = true;
-                    }
-                    if (dir_kwd == "left")
-                    {
-                        type = TokenType::ACTION_MOUSE_SCROLL_LEFT;
-                        is_mouse_action = true;
-                    }
-                    if (dir_kwd == "right")
-                    {
-                        type = TokenType::ACTION_MOUSE_SCROLL_RIGHT;
-                        is_mouse_action = true;
-                    }
-                }
-                if (mouse_kwd == "click")
+            const Keyword *keyword = std::lower_bound(std::begin(keywords), std::end(keywords), identifier, [](const Keyword &entry, std::string_view word)
+                                                      { return entry.name < word; });
+            for (; keyword != std::end(keywords) && keyword->name == identifier; keyword++)
+            {
+                std::string_view rest = source.substr(index, keyword->rest.size());
+                if (iequals(rest, keyword->rest) && !isalnum(peek(index + rest.size())))
                 {
-                    if (dir_kwd == "left")
-                    {
-                        type = TokenType::ACTION_MOUSE_CLICK_LEFT;
-                        is_mouse_action = true;
-                    }
-                    if (dir_kwd == "right")
-                    {
-                        type = TokenType::ACTION_MOUSE_CLICK_RIGHT;
-                        is_mouse_action = true;
-                    }
-                    if (dir_kwd == "center")
-                    {
-                        type = TokenType::ACTION_MOUSE_CLICK_CENTER;
-                        is_mouse_action = true;
-                    }
-                    if (dir_kwd == "backwards" || dir_kwd == "back")
-                    {
-                        type = TokenType::ACTION_MOUSE_CLICK_BACKWARDS;
-                        is_mouse_action = true;
-                    }
-                    if (dir_kwd == "forwards")
-                    {
-                        type = TokenType::ACTION_MOUSE_CLICK_FORWARDS;
-                        is_mouse_action = true;
-                    }
+                    index += rest.size();
+                    type = keyword->type;
+                    break;
                 }
-
-                // if a mouse action wasn't found, restore index
-                if (!is_mouse_action)
-                    index = old_index;
             }
+        }
 
-            if (identifier == "press")
-                type = TokenType::ACTION_PRESS;
-            if (identifier == "release")
-                type = TokenType::ACTION_RELEASE;
-            if (identifier == "click")
-                type = TokenType::ACTION_CLICK;
-            if (identifier == "wait")
-                type = TokenType::ACTION_WAIT;
-            if (identifier == "toggle")
-                type = TokenType::ACTION_TOGGLE;
-            if (identifier == "leave")
-                type = TokenType::ACTION_LEAVE;
-            if (identifier == "type")
-                type = TokenType::ACTION_TYPE;
-            if (identifier == "bootloader")
-                type = TokenType::ACTION_BOOTLOADER;
-            if (identifier == "home")
-                type = TokenType::ACTION_HOME;
-            if (identifier == "nothing")
-                type = TokenType::ACTION_NOTHING;
-            if (identifier == "quickly")
-                type = TokenType::PARAMETER_QUICKLY;
-            if (identifier == "slowly")
-                type = TokenType::PARAMETER_SLOWLY;
-            if (identifier == "repeatedly")
-                type = TokenType::PARAMETER_REPEATEDLY;
-            if (identifier == "ms" || identifier == "millisecond" || identifier == "milliseconds")
-                type = TokenType::PARAMETER_TIME_MS;
-            if (identifier == "sec" || identifier == "second" || identifier == "seconds")
-                type = TokenType::PARAMETER_TIME_SEC;
-            if (identifier == "min" || identifier == "minute" || identifier == "minutes")
-                type = TokenType::PARAMETER_TIME_MIN;
-
-            if (identifier == "switch" && to_lower(source.substr(index, 3)) == " to")
-            {
-                index += 3;
-                type = TokenType::ACTION_SWITCH_TO;
-            }
-            if (identifier == "reset" && to_lower(source.substr(index, 9)) == " keyboard")
-            {
-                index += 9;
-                type = TokenType::ACTION_RESET_KEYBOARD;
-            }
-            if (identifier == "pass" && to_lower(source.substr(index, 8)) == " through")
-            {
-                index += 8;
-                type = TokenType::ACTION_PASS_THROUGH;
-            }
-            if (identifier == "reload" && to_lower(source.substr(index, 9)) == " key maps")
+        *token = {
+            .type = type,
+            .start = start,
+            .length = index - start,
+            .line_number = line_number,
+        };
+        return Lexed::TOKEN;
+    }
+
+    std::pair<std::string, std::pmr::vector<Token>> tokenize(std::string_view source, std::pmr::memory_resource *memory)
+    {
+        std::pmr::vector<Token> tokens(memory);
+
+        // Keymaps average a little over 4 bytes per token
+        tokens.reserve(source.length() / 4);
+
+        int index = 0;
+        int line_number = 1;
+
+        while (index < source.length())
+        {
+            Token token;
+            std::string error;
+            switch (lex(source, &index, &line_number, &token, &error))
             {
-                index += 9;
-                type = TokenType::ACTION_RELOAD_KEY_MAPS;
+            case Lexed::TOKEN:
+                tokens.push_back(token);
+                break;
+            case Lexed::SKIPPED:
+                break;
+            case Lexed::ERROR:
+                return {error, {}};
             }
-            if (identifier == "at" && to_lower(source.substr(index, 1)) == " human speed")
+        }
+        return {"", std::move(tokens)};
+    }
+
+    bool TokenStream::Next(Token *token)
+    {
+        while (error_ == "")
+        {
+            int index = index_ - base_;
+            if (index >= text().size() && !Fill())
             {
-                index += 12;
-                type = TokenType::PARAMETER_AT_HUMAN_SPEED;
+                return false;
             }
-            if (identifier == "until" && to_lower(source.substr(index, 9)) == " released")
+
+            int line_number = line_number_;
+            std::string error;
+            Lexed lexed = lex(text(), &index, &line_number, token, &error);
+
+            // The token may continue into text that hasn't been read yet
+            if (!eof_ && index + TOKEN_LOOKAHEAD >= buffer_.size())
             {
-                index += 9;
-                type = TokenType::PARAMETER_UNTIL_RELEASED;
+                Fill();
+                continue;
             }
-            if (identifier == "other" && to_lower(source.substr(index, 18)) == " keys fall through")
+
+            if (lexed == Lexed::ERROR)
             {
-                index += 18;
-                type = TokenType::TOP_OTHER_KEYS_FALL_THROUGH;
+                error_ = error;
+                return false;
             }
-            if (identifier == "block" && to_lower(source.substr(index, 11)) == " other keys")
+
+            index_ = base_ + index;
+            line_number_ = line_number;
+
+            if (lexed == Lexed::TOKEN)
             {
-                index += 11;
-                type = TokenType::TOP_BLOCK_OTHER_KEYS;
+                token->start += base_;
+                return true;
             }
+        }
+        return false;
+    }
 
-            tokens.push_back({
-                .type = type,
-                .start = start,
-                .length = index - start,
-                .line_number = line_number,
-            });
+    std::string_view TokenStream::Text(int start, int length) const
+    {
+        return text().substr(start - base_, length);
+    }
+
+    void TokenStream::Release(int offset)
+    {
+        released_ = std::max(released_, std::min(offset, index_));
+    }
+
+    bool TokenStream::Fill()
+    {
+        if (eof_)
+        {
+            return false;
         }
-        return {"", tokens};
+
+        // Drop released text rather than growing
+        if (released_ > base_)
+        {
+            buffer_.erase(0, released_ - base_);
+            base_ = released_;
+        }
+
+        size_t size = buffer_.size();
+        buffer_.resize(size + TOKEN_STREAM_CHUNK);
+        size_t count = read_(&buffer_[size], TOKEN_STREAM_CHUNK);
+        buffer_.resize(size + count);
+
+        eof_ = count == 0;
+        return !eof_;
     }
 
 }
\ No newline at end of file
@@ -27,9 +27,14 @@
 #include <stdio.h>
 #include <string.h>
 
+#include "FreeRTOS.h"
+#include "task.h"
+
 #include "bsp/board.h"
 #include "flash.h"
+#include "keymap_reload.h"
 #include "tusb.h"
+#include "virtual_files.h"
 
 #include "usb_descriptors.h"
 
@@ -62,7 +67,10 @@ int32_t tud_msc_read10_cb(uint8_t lun, uint32_t lba, uint32_t offset, void *buff
   uint32_t const addr = FATFS_OFFSET + lba * SECTOR_SIZE + offset;
   printf("[read] lba: %d, off: %d, buffsize: %d, addr: %d\n", lba, offset, bufsize, addr);
 
-  flash_read(addr, buffer, bufsize);
+  if (!virtual_file_read(lba, offset, buffer, bufsize))
+  {
+    flash_read(addr, buffer, bufsize);
+  }
 
   return bufsize;
 }
@@ -73,17 +81,25 @@ int32_t tud_msc_write10_cb(uint8_t lun, uint32_t lba, uint32_t offset, uint8_t *
 {
   uint32_t const addr = FATFS_OFFSET + lba * SECTOR_SIZE + offset;
   printf("[write] lba: %d, off: %d, buffsize: %d, addr: %d\n", lba, offset, bufsize, addr);
-  flash_write(addr, buffer, bufsize);
 
-  return bufsize;
+  virtual_file_written(lba);
+
+  // Returning 0 makes TinyUSB call again, once the flash writer task has
+  // made room. Lets the other core 0 tasks run in the meantime.
+  int32_t written = flash_try_write(addr, buffer, bufsize);
+  if (written == 0)
+  {
+    vTaskDelay(1);
+  }
+  return written;
 }
 
 void tud_msc_write10_complete_cb(uint8_t lun)
 {
-  flash_flush();
-  // TODO(fex): Use this to autodetct file and re-boot keeb?
-  // Probably not, just add a key mapping to reload key maps
-  printf("[flush][flush][flush]\n");
+  // Sectors stay in the flash cache while the host keeps writing, the
+  // reload task flushes them once it has gone quiet. Picks up keymaps
+  // copied onto the drive at the same time.
+  keymap_reload_request();
 }
 
 // Invoked when received SCSI_CMD_INQUIRY
@@ -110,7 +126,7 @@ bool tud_msc_test_unit_ready_cb(uint8_t lun)
 // Application update block count and block size
 void tud_msc_capacity_cb(uint8_t lun, uint32_t *block_count, uint16_t *block_size)
 {
-  *block_count = FATFS_SIZE / SECTOR_SIZE;
+  *block_count = FATFS_SECTOR_COUNT;
   *block_size = SECTOR_SIZE;
 }
 
@@ -129,6 +145,7 @@ bool tud_msc_start_stop_cb(uint8_t lun, uint8_t power_condition, bool start, boo
     else
     {
       // unload disk storage
+      flash_flush_async();
     }
   }
 
@@ -155,6 +172,11 @@ int32_t tud_msc_scsi_cb(uint8_t lun, uint8_t const scsi_cmd[16], void *buffer, u
     resplen = 0;
     break;
 
+  case 0x35: // SYNCHRONIZE CACHE (10)
+    flash_flush_async();
+    resplen = 0;
+    break;
+
   default:
     // Set Sense = Invalid Command Operation
     tud_msc_set_sense(lun, SCSI_SENSE_ILLEGAL_REQUEST, 0x20, 0x00);
@@ -26,61 +26,484 @@
 #include <string.h>
 #include <stdio.h>
 #include "pico/stdlib.h"
+#include "pico/mutex.h"
 #include "hardware/flash.h"
 #include "hardware/sync.h"
+#include "FreeRTOS.h"
+#include "queue.h"
+#include "task.h"
+#include "flash.h"
 //--------------------------------------------------------------------+
 // MACRO TYPEDEF CONSTANT ENUM DECLARATION
 //--------------------------------------------------------------------+
 
 #define FLASH_CACHE_SIZE          (4*1024U)
-#define FLASH_CACHE_INVALID_ADDR  0xffffffff
 
-static uint32_t _fl_addr = FLASH_CACHE_INVALID_ADDR;
-static uint8_t _fl_buf[FLASH_CACHE_SIZE] __attribute__((aligned(4)));
+// Host writes interleave FAT, directory and data sectors, so more than one
+// sector is kept in RAM and written back least recently used first
+typedef struct
+{
+  uint8_t buf[FLASH_CACHE_SIZE] __attribute__((aligned(4)));
+  uint32_t addr;
+  uint32_t last_used;
+  bool valid;
+  bool dirty;
+  bool queued;  // Waiting for the writer task
+  bool writing; // Being written back, still served from here until done
+} flash_cache_slot_t;
+
+static flash_cache_slot_t _fl_slots[FLASH_CACHE_SLOTS];
+static flash_cache_slot_t *_fl_last_written;
+static uint32_t _fl_clock;
+static flash_stats_t _fl_stats;
+
+// Slots are written back from a copy, so writes can carry on meanwhile
+static uint8_t _fl_write_buf[FLASH_CACHE_SIZE] __attribute__((aligned(4)));
+
+// Slot indices for the writer task, each slot is queued at most once
+static QueueHandle_t _fl_queue;
+static StaticQueue_t _fl_queue_buf;
+static uint8_t _fl_queue_storage[FLASH_CACHE_SLOTS * sizeof(int)];
+
+// _fl_mutex guards the slots and is never held across an erase or a
+// program. _fl_op_mutex keeps write backs and direct erases from
+// interleaving, and is always taken before _fl_mutex. _fl_xip_mutex is
+// held around each single erase or program, and by anything reading flash
+// through XIP meanwhile. It is always taken last.
+auto_init_mutex(_fl_mutex);
+auto_init_mutex(_fl_op_mutex);
+auto_init_mutex(_fl_xip_mutex);
+
+// The FatFs volume, cached by sector address, is remapped onto the flash
+// by the translation layer. Its map only changes under _fl_op_mutex.
+static ftl_t _fl_ftl;
+
+_Static_assert(FTL_AREA_SECTORS <= FTL_MAX_SECTORS, "the translation layer can't map the whole volume");
+_Static_assert(FTL_LOGICAL_SECTORS(FTL_AREA_SECTORS) == FATFS_SECTOR_COUNT, "the volume must be all of the FTL's logical sectors");
 
 //------------- IMPLEMENTATION -------------//
 
+static void _fl_range_erase(uint32_t addr, uint32_t len);
+static void _fl_range_program(uint32_t addr, uint8_t const *data, uint32_t len);
+
+static void _fl_ftl_erase(uint32_t offset)
+{
+  _fl_range_erase(FTL_AREA_OFFSET + offset, FLASH_SECTOR_SIZE);
+}
+
+static void _fl_ftl_program(uint32_t offset, uint8_t const *data, uint32_t len)
+{
+  _fl_range_program(FTL_AREA_OFFSET + offset, data, len);
+}
+
+// Where a volume sector is now, read under _fl_xip_mutex
+static uint8_t const *_fl_sector_xip(uint32_t addr)
+{
+  return (uint8_t const *) (XIP_BASE + FTL_AREA_OFFSET + ftl_offset(&_fl_ftl, (addr - FATFS_OFFSET) / FLASH_CACHE_SIZE));
+}
+
+// Caller holds _fl_op_mutex, so flash_get_stats never waits on a write back
+static void _fl_sync_stats(void)
+{
+  mutex_enter_blocking(&_fl_mutex);
+  _fl_stats.erases = _fl_ftl.erase_count;
+  _fl_stats.program_only = _fl_ftl.program_only;
+  _fl_stats.pages_programmed = _fl_ftl.pages_programmed;
+  _fl_stats.relocations = _fl_ftl.relocations;
+  mutex_exit(&_fl_mutex);
+}
+
+void flash_init(void)
+{
+  _fl_queue = xQueueCreateStatic(FLASH_CACHE_SLOTS, sizeof(int), _fl_queue_storage, &_fl_queue_buf);
+
+  ftl_flash_t flash = {(uint8_t const *) (XIP_BASE + FTL_AREA_OFFSET), _fl_ftl_erase, _fl_ftl_program};
+  ftl_setup(&_fl_ftl, flash, FTL_AREA_SECTORS);
+
+  mutex_enter_blocking(&_fl_op_mutex);
+  if ( !ftl_mount(&_fl_ftl) )
+  {
+    // Also the first boot after the volume was mapped straight onto flash,
+    // sectors start out where they were and the files are kept
+    printf("No flash translation table, formatting\n");
+    ftl_format(&_fl_ftl);
+  }
+  _fl_sync_stats();
+  mutex_exit(&_fl_op_mutex);
+}
+
+void flash_xip_lock(void)
+{
+  mutex_enter_blocking(&_fl_xip_mutex);
+}
+
+void flash_xip_unlock(void)
+{
+  mutex_exit(&_fl_xip_mutex);
+}
+
+// Flash reads through XIP return garbage while it is erased or programmed.
+// copy_to_ram builds run all code and read-only data from SRAM, so both
+// cores and interrupts carry on and only reads of flash contents wait.
+// Anything else still runs from flash, and interrupts must stay off.
+static void _fl_range_erase(uint32_t addr, uint32_t len)
+{
+  mutex_enter_blocking(&_fl_xip_mutex);
+#if PICO_COPY_TO_RAM
+  flash_range_erase(addr, len);
+#else
+  uint32_t state = save_and_disable_interrupts();
+  flash_range_erase(addr, len);
+  restore_interrupts(state);
+#endif
+  mutex_exit(&_fl_xip_mutex);
+}
+
+static void _fl_range_program(uint32_t addr, uint8_t const *data, uint32_t len)
+{
+  mutex_enter_blocking(&_fl_xip_mutex);
+#if PICO_COPY_TO_RAM
+  flash_range_program(addr, data, len);
+#else
+  uint32_t state = save_and_disable_interrupts();
+  flash_range_program(addr, data, len);
+  restore_interrupts(state);
+#endif
+  mutex_exit(&_fl_xip_mutex);
+}
+
+static flash_cache_slot_t *_fl_find(uint32_t addr)
+{
+  for ( int i = 0; i < FLASH_CACHE_SLOTS; i++ )
+  {
+    if ( _fl_slots[i].valid && _fl_slots[i].addr == addr ) return &_fl_slots[i];
+  }
+  return NULL;
+}
+
+static void _fl_queue_slot(flash_cache_slot_t *slot)
+{
+  if ( !slot->dirty || slot->queued ) return;
+
+  int index = slot - _fl_slots;
+  slot->queued = true;
+  xQueueSend(_fl_queue, &index, 0);
+}
+
+// A slot that can take another sector, the least recently used clean one
+static flash_cache_slot_t *_fl_reusable_slot(void)
+{
+  flash_cache_slot_t *slot = NULL;
+  for ( int i = 0; i < FLASH_CACHE_SLOTS; i++ )
+  {
+    flash_cache_slot_t *other = &_fl_slots[i];
+    if ( !other->valid ) return other;
+    if ( other->dirty || other->writing ) continue;
+    if ( !slot || other->last_used < slot->last_used ) slot = other;
+  }
+  return slot;
+}
+
+// Hands the least recently used dirty slot to the writer when no slot is left to reuse
+static void _fl_make_room(void)
+{
+  if ( _fl_reusable_slot() ) return;
+
+  flash_cache_slot_t *oldest = NULL;
+  for ( int i = 0; i < FLASH_CACHE_SLOTS; i++ )
+  {
+    flash_cache_slot_t *other = &_fl_slots[i];
+    if ( other->queued || other->writing ) return; // Room is already on the way
+    if ( other->dirty && (!oldest || other->last_used < oldest->last_used) ) oldest = other;
+  }
+
+  if ( oldest )
+  {
+    _fl_queue_slot(oldest);
+    _fl_stats.evictions++;
+  }
+}
+
+static void _fl_write_back(flash_cache_slot_t *slot)
+{
+  mutex_enter_blocking(&_fl_op_mutex);
+
+  mutex_enter_blocking(&_fl_mutex);
+  slot->queued = false;
+  bool dirty = slot->valid && slot->dirty;
+  uint32_t addr = slot->addr;
+  if ( dirty )
+  {
+    memcpy(_fl_write_buf, slot->buf, FLASH_CACHE_SIZE);
+    slot->dirty = false;
+    slot->writing = true;
+  }
+  mutex_exit(&_fl_mutex);
+
+  if ( dirty )
+  {
+    printf("Write back sector %d\n", (int) ((addr - FATFS_OFFSET) / FLASH_CACHE_SIZE));
+    ftl_write(&_fl_ftl, (addr - FATFS_OFFSET) / FLASH_CACHE_SIZE, _fl_write_buf);
+
+    mutex_enter_blocking(&_fl_mutex);
+    slot->writing = false;
+    mutex_exit(&_fl_mutex);
+    _fl_sync_stats();
+  }
+
+  mutex_exit(&_fl_op_mutex);
+}
+
+// Gives the writer task a chance to free up slots. Before the scheduler
+// runs there is no writer, so whatever is queued is written back here.
+static void _fl_wait(void)
+{
+  if ( xTaskGetSchedulerState() != taskSCHEDULER_NOT_STARTED )
+  {
+    vTaskDelay(1);
+    return;
+  }
+
+  int index;
+  while ( xQueueReceive(_fl_queue, &index, 0) == pdTRUE )
+  {
+    _fl_write_back(&_fl_slots[index]);
+  }
+}
+
+// Drops cached sectors in the range, whatever is written there directly wins.
+// Caller holds _fl_op_mutex, so none of them is being written back.
+static void _fl_invalidate(uint32_t addr, uint32_t len)
+{
+  mutex_enter_blocking(&_fl_mutex);
+  for ( int i = 0; i < FLASH_CACHE_SLOTS; i++ )
+  {
+    flash_cache_slot_t *slot = &_fl_slots[i];
+    if ( slot->valid && slot->addr + FLASH_CACHE_SIZE > addr && slot->addr < addr + len )
+    {
+      slot->valid = false;
+      slot->dirty = false;
+      if ( slot == _fl_last_written ) _fl_last_written = NULL;
+    }
+  }
+  mutex_exit(&_fl_mutex);
+}
+
 void flash_read(uint32_t addr, void* buffer, uint32_t len)
 {
-  memcpy(buffer, (void*) (XIP_BASE + addr), len);
+  uint8_t *dst = (uint8_t *) buffer;
+
+  mutex_enter_blocking(&_fl_mutex);
+  while ( len > 0 )
+  {
+    uint32_t offset = addr & (FLASH_CACHE_SIZE - 1);
+    uint32_t count = MIN(len, FLASH_CACHE_SIZE - offset);
+
+    // Sectors not yet written back are only up to date in the cache
+    flash_cache_slot_t *slot = _fl_find(addr - offset);
+    if ( !slot )
+    {
+      // Waiting out an erase here would stall writers and stats, so the
+      // slots are let go meanwhile. A sector cached since is newer.
+      mutex_exit(&_fl_mutex);
+      mutex_enter_blocking(&_fl_xip_mutex);
+      memcpy(dst, _fl_sector_xip(addr - offset) + offset, count);
+      mutex_exit(&_fl_xip_mutex);
+      mutex_enter_blocking(&_fl_mutex);
+      slot = _fl_find(addr - offset);
+    }
+    if ( slot ) memcpy(dst, slot->buf + offset, count);
+
+    addr += count;
+    dst += count;
+    len -= count;
+  }
+  mutex_exit(&_fl_mutex);
+}
+
+void const *flash_map(uint32_t addr, uint32_t len)
+{
+  if ( addr < FATFS_OFFSET || addr + len > FATFS_OFFSET + FATFS_SECTOR_COUNT * SECTOR_SIZE ) return NULL;
+
+  // Nothing is erased or programmed until flash_unmap
+  mutex_enter_blocking(&_fl_op_mutex);
+
+  uint32_t start = addr & ~(FLASH_CACHE_SIZE - 1);
+  uint8_t const *base = _fl_sector_xip(start);
+  bool mapped = true;
+
+  mutex_enter_blocking(&_fl_mutex);
+  for ( uint32_t sector = start; sector < addr + len && mapped; sector += FLASH_CACHE_SIZE )
+  {
+    // Sectors the translation layer scattered, or not yet written back, are only readable a piece at a time
+    flash_cache_slot_t *slot = _fl_find(sector);
+    mapped = !(slot && slot->dirty) && _fl_sector_xip(sector) == base + (sector - start);
+  }
+  mutex_exit(&_fl_mutex);
+
+  if ( !mapped )
+  {
+    mutex_exit(&_fl_op_mutex);
+    return NULL;
+  }
+  return base + (addr - start);
+}
+
+void flash_unmap(void)
+{
+  mutex_exit(&_fl_op_mutex);
 }
 
 void flash_erase(uint32_t add, uint32_t len)
 {
-    uint32_t state = save_and_disable_interrupts();
-    flash_range_erase(add, len);
-    restore_interrupts(state);
+    mutex_enter_blocking(&_fl_op_mutex);
+    _fl_invalidate(add, len);
+    _fl_range_erase(add, len);
+
+    // The translation table went with it, the volume starts over blank
+    if ( add < FATFS_OFFSET + FATFS_SIZE && add + len > FTL_AREA_OFFSET ) ftl_format(&_fl_ftl);
+    _fl_sync_stats();
+    mutex_exit(&_fl_op_mutex);
 }
 
-void flash_flush(void)
+void flash_flush_async(void)
 {
-  if ( _fl_addr == FLASH_CACHE_INVALID_ADDR ) return;
+  mutex_enter_blocking(&_fl_mutex);
+  for ( int i = 0; i < FLASH_CACHE_SLOTS; i++ )
+  {
+    _fl_queue_slot(&_fl_slots[i]);
+  }
+  _fl_last_written = NULL;
+  mutex_exit(&_fl_mutex);
+}
 
-  // Only erase and write if contents does not matches
-  if ( 0 != memcmp(_fl_buf, (void*) (XIP_BASE + _fl_addr), FLASH_CACHE_SIZE) )
+void flash_flush(void)
+{
+  while ( true )
   {
-    printf("Erase and Write at 1x%08X", _fl_addr);
+    bool pending = false;
 
-    uint32_t state = save_and_disable_interrupts();
-    flash_range_erase(_fl_addr, FLASH_CACHE_SIZE);
-    flash_range_program(_fl_addr, _fl_buf, FLASH_CACHE_SIZE);
-    restore_interrupts(state);
+    mutex_enter_blocking(&_fl_mutex);
+    for ( int i = 0; i < FLASH_CACHE_SLOTS; i++ )
+    {
+      _fl_queue_slot(&_fl_slots[i]);
+      pending = pending || _fl_slots[i].dirty || _fl_slots[i].writing;
+    }
+    _fl_last_written = NULL;
+    mutex_exit(&_fl_mutex);
+
+    if ( !pending ) return;
+    _fl_wait();
   }
+}
 
-  _fl_addr = FLASH_CACHE_INVALID_ADDR;
+void flash_write_back_next(void)
+{
+  int index;
+  if ( xQueueReceive(_fl_queue, &index, portMAX_DELAY) == pdTRUE )
+  {
+    _fl_write_back(&_fl_slots[index]);
+  }
 }
 
-void flash_write (uint32_t addr, void const *data, uint32_t len)
+void flash_program(uint32_t addr, void const *data, uint32_t len)
 {
-  uint32_t new_addr = addr & ~(FLASH_CACHE_SIZE - 1);
+  uint8_t page[FLASH_PAGE_SIZE] __attribute__((aligned(4)));
+  uint8_t const *src = (uint8_t const *) data;
+
+  mutex_enter_blocking(&_fl_op_mutex);
+  _fl_invalidate(addr, len);
 
-  if ( new_addr != _fl_addr )
+  // A sector at a time, XIP readers get a turn in between
+  for ( uint32_t offset = 0; offset < len; offset += FLASH_PAGE_SIZE )
   {
-    flash_flush();
+    if ( (offset & (FLASH_SECTOR_SIZE - 1)) == 0 ) _fl_range_erase(addr + offset, FLASH_SECTOR_SIZE);
 
-    _fl_addr = new_addr;
-    flash_read(new_addr, _fl_buf, FLASH_CACHE_SIZE);
+    // Pad the last page with the erased value
+    uint32_t count = MIN(len - offset, FLASH_PAGE_SIZE);
+    memset(page, 0xff, FLASH_PAGE_SIZE);
+    memcpy(page, src + offset, count);
+    _fl_range_program(addr + offset, page, FLASH_PAGE_SIZE);
   }
+  mutex_exit(&_fl_op_mutex);
+}
+
+uint32_t flash_try_write(uint32_t addr, void const *data, uint32_t len)
+{
+  uint8_t const *src = (uint8_t const *) data;
+  uint32_t written = 0;
+
+  mutex_enter_blocking(&_fl_mutex);
+  while ( written < len )
+  {
+    uint32_t new_addr = addr & ~(FLASH_CACHE_SIZE - 1);
+    uint32_t offset = addr - new_addr;
+    uint32_t count = MIN(len - written, FLASH_CACHE_SIZE - offset);
+
+    flash_cache_slot_t *slot = _fl_find(new_addr);
+    if ( slot == NULL )
+    {
+      slot = _fl_reusable_slot();
+      if ( slot == NULL )
+      {
+        // Every slot is waiting to be written back, come back once one is
+        _fl_make_room();
+        break;
+      }
+
+      // Never waits out an erase, the caller comes back instead
+      if ( !mutex_try_enter(&_fl_xip_mutex, NULL) ) break;
+      memcpy(slot->buf, _fl_sector_xip(new_addr), FLASH_CACHE_SIZE);
+      mutex_exit(&_fl_xip_mutex);
 
-  memcpy(_fl_buf + (addr & (FLASH_CACHE_SIZE - 1)), data, len);
+      slot->addr = new_addr;
+      slot->valid = true;
+    }
+    else if ( slot->dirty && slot != _fl_last_written )
+    {
+      // A single sector cache would have written this one back in between
+      _fl_stats.erases_avoided++;
+    }
+
+    memcpy(slot->buf + offset, src + written, count);
+    slot->dirty = true;
+    slot->last_used = ++_fl_clock;
+    _fl_last_written = slot;
+    _fl_stats.writes++;
+
+    addr += count;
+    written += count;
+  }
+
+  // Starts writing back before the next new sector needs the room
+  _fl_make_room();
+  mutex_exit(&_fl_mutex);
+
+  return written;
+}
+
+void flash_write(uint32_t addr, void const *data, uint32_t len)
+{
+  uint8_t const *src = (uint8_t const *) data;
+  while ( len > 0 )
+  {
+    uint32_t count = flash_try_write(addr, src, len);
+    if ( count == 0 ) _fl_wait();
+
+    addr += count;
+    src += count;
+    len -= count;
+  }
+}
+
+void flash_get_stats(flash_stats_t *stats)
+{
+  mutex_enter_blocking(&_fl_mutex);
+  *stats = _fl_stats;
+  mutex_exit(&_fl_mutex);
+}
+
+uint32_t flash_sector_erases(uint32_t sector)
+{
+  return sector < _fl_ftl.physical_count ? _fl_ftl.erases[sector] : 0;
 }
@@ -31,15 +31,72 @@
 #endif
 
 #include "pico/stdlib.h"
+#include "ftl.h"
 
 #define SECTOR_SIZE 4096 
 #define FATFS_OFFSET (1 * 1024 * 1024)
 #define FATFS_SIZE (PICO_FLASH_SIZE_BYTES - FATFS_OFFSET)
+#define FATFS_SECTOR_COUNT (FATFS_SIZE / SECTOR_SIZE)
+
+// The translation layer's own sectors sit just below the volume, so the
+// volume keeps the size it had when it was mapped straight onto flash
+#define FTL_AREA_OFFSET (FATFS_OFFSET - (FTL_META_SECTORS + FTL_SPARE_SECTORS) * SECTOR_SIZE)
+#define FTL_AREA_SECTORS ((FATFS_OFFSET + FATFS_SIZE - FTL_AREA_OFFSET) / SECTOR_SIZE)
+
+// Compiled keymap image, just below the translation layer (see keymap_image.h)
+#define KEYMAP_IMAGE_SIZE (216 * 1024) // Must match keymap_image.h
+#define KEYMAP_IMAGE_OFFSET (FTL_AREA_OFFSET - KEYMAP_IMAGE_SIZE)
+
+// Sectors held in RAM before any is written back, 4 KB each
+#ifndef FLASH_CACHE_SLOTS
+#define FLASH_CACHE_SLOTS 4
+#endif
+
+typedef struct
+{
+  uint32_t writes;         // flash_write calls, per sector touched
+  uint32_t erases;         // Sectors erased, the FTL's metadata included
+  uint32_t program_only;   // Sectors written without an erase, only bits were cleared
+  uint32_t pages_programmed;
+  uint32_t erases_avoided; // Rewrites of a dirty sector a single slot cache would have erased again
+  uint32_t evictions;      // Dirty sectors written back early to make room
+  uint32_t relocations;    // Sectors moved by wear levelling
+} flash_stats_t;
+
+// Before anything else touches the flash
+void flash_init(void);
 
 void flash_erase(uint32_t add, uint32_t len);
 void flash_read (uint32_t addr, void* buffer, uint32_t len);
 void flash_write(uint32_t addr, void const *data, uint32_t len);
 void flash_flush(void);
+void flash_get_stats(flash_stats_t *stats);
+uint32_t flash_sector_erases(uint32_t sector); // By physical sector of the FTL area
+
+// Never waits on the flash, for the USB callbacks. flash_try_write returns
+// how much fit in the cache, possibly 0 until the writer task frees a slot.
+// flash_flush_async only hands the dirty sectors to the writer task.
+uint32_t flash_try_write(uint32_t addr, void const *data, uint32_t len);
+void flash_flush_async(void);
+
+// Body of the flash writer task, writes back one sector once there is one
+void flash_write_back_next(void);
+
+// Held while reading flash contents through XIP rather than flash_read,
+// as for the keymap image. Erasing and programming wait for it, and it
+// waits for them. Keep it short and take no other flash call meanwhile.
+void flash_xip_lock(void);
+void flash_xip_unlock(void);
+
+// Points straight at a range of the FatFs volume in flash, NULL if it isn't
+// contiguous there or part of it is only in the cache. Until flash_unmap
+// nothing is written back or erased, so don't wait on anything that writes
+// (the filesystem included) meanwhile.
+void const *flash_map(uint32_t addr, uint32_t len);
+void flash_unmap(void);
+
+// Erases and writes directly, bypassing the FatFs sector cache
+void flash_program(uint32_t addr, void const *data, uint32_t len);
 
 #ifdef __cplusplus
  }